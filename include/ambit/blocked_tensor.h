@@ -189,6 +189,8 @@ class BlockedTensor
                            const std::vector<std::string> &subspaces);
     static void reset_mo_spaces();
     static void print_mo_spaces();
+    /// @return The n-th MOSpace
+    static MOSpace mo_space(size_t n) { return mo_spaces_[n]; }
 
     static void set_expert_mode(bool mode) { expert_mode_ = mode; }
 
@@ -349,8 +351,6 @@ class BlockedTensor
         const std::map<std::vector<size_t>, Tensor> &blocks,
         bool full_contraction);
 
-    /// @return The n-th MOSpace
-    static MOSpace mo_space(size_t n) { return mo_spaces_[n]; }
     /// @return The MOSpace corresponding to the name of a space
     size_t name_to_mo_space(const std::string &index);
     /// @return The MOSpace objects corresponding to the name of a space
@@ -390,6 +390,10 @@ class BlockedTensor
 /**
  * This function saves a blocked tensor to a binary file on disk
  *
+ * The file starts with an index of the blocks (label, dimensions and
+ * position), so that blocks are written and read concurrently and a single
+ * block can be loaded with load_block().
+ *
  * @param t a tensor
  * @param filename the name of the binary file
  * @param overwrite overwrite an existing file?
@@ -417,6 +421,17 @@ void load(BlockedTensor &bt, const std::string &filename);
  */
 BlockedTensor load_blocked_tensor(const std::string &filename);
 
+/**
+ * This function loads a single block of a blocked tensor saved with save(),
+ * seeking straight to it through the index of blocks in the file
+ *
+ * @param filename the name of the binary file
+ * @param block the label of the block (e.g. "OV")
+ * @return the block
+ *
+ */
+Tensor load_block(const std::string &filename, const std::string &block);
+
 class LabeledBlockedTensor
 {
 
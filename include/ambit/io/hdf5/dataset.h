@@ -34,6 +34,7 @@
 #ifndef AMBIT_DATASET_H
 #define AMBIT_DATASET_H
 
+#include <ambit/blocked_tensor.h>
 #include <ambit/common_types.h>
 #include <ambit/io/hdf5/location.h>
 #include <ambit/io/hdf5/dataspace.h>
@@ -49,6 +50,19 @@ namespace io
 namespace hdf5
 {
 
+/// Compression filter of a chunked dataset
+enum Filter
+{
+    kFilterNone,
+    kFilterDeflate,
+    kFilterSzip
+};
+
+/// Chunk dims of about target_bytes for a dataset of the given dims: the
+/// largest dimension is halved until the chunk fits
+Dimension chunk_dims(const Dimension& dims, size_t element_size,
+                     size_t target_bytes = 1024 * 1024);
+
 template <typename T> struct Dataset
 {
     Dataset() : id_(-1) {}
@@ -67,6 +81,14 @@ template <typename T> struct Dataset
         create(location, name, space);
     }
 
+    Dataset(const Location &location, const string &name,
+            const Dataspace &space, const Dimension &chunk,
+            Filter filter = kFilterNone)
+        : id_(-1)
+    {
+        create(location, name, space, chunk, filter);
+    }
+
     virtual ~Dataset() { close(); }
 
     void open(const Location &location, const string &name)
@@ -83,13 +105,48 @@ template <typename T> struct Dataset
     {
         close();
 
-        id_ = H5Dcreate2(location.id(), name.c_str(), detail::ctype<T>::hid(),
-                        space.id(), H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+        hid_t type = detail::ctype<T>::hid();
+        id_ = H5Dcreate2(location.id(), name.c_str(), type, space.id(),
+                         H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+        H5Tclose(type);
 
         if (id_ == -1)
             throw std::runtime_error("Unable to create dataset");
     }
 
+    /// Creates a dataset stored in chunks of the given dims, each passed
+    /// through filter
+    void create(const Location &location, const string &name,
+                const Dataspace &space, const Dimension &chunk,
+                Filter filter = kFilterNone, unsigned int level = 6)
+    {
+        close();
+
+        hid_t plist = H5Pcreate(H5P_DATASET_CREATE);
+        vector<hsize_t> cdims(chunk.begin(), chunk.end());
+        herr_t status =
+            H5Pset_chunk(plist, static_cast<int>(cdims.size()), cdims.data());
+        if (status >= 0 && filter == kFilterDeflate)
+        {
+            // The shuffle filter groups the bytes of the values first
+            status = H5Pset_shuffle(plist);
+            if (status >= 0)
+                status = H5Pset_deflate(plist, level);
+        }
+        else if (status >= 0 && filter == kFilterSzip)
+            status = H5Pset_szip(plist, H5_SZIP_NN_OPTION_MASK, 8);
+
+        hid_t type = detail::ctype<T>::hid();
+        if (status >= 0)
+            id_ = H5Dcreate2(location.id(), name.c_str(), type, space.id(),
+                             H5P_DEFAULT, plist, H5P_DEFAULT);
+        H5Tclose(type);
+        H5Pclose(plist);
+
+        if (status < 0 || id_ == -1)
+            throw std::runtime_error("Unable to create chunked dataset");
+    }
+
     void close()
     {
         if (id_ != -1)
@@ -99,26 +156,109 @@ template <typename T> struct Dataset
         }
     }
 
+    /// The dataspace of the dataset, with everything selected
+    Dataspace space() const { return Dataspace::adopt(H5Dget_space(id_)); }
+
+    Dimension dims() const { return space().dims(); }
+
     void write(const vector<T> &data)
     {
-        H5Dwrite(id_, detail::ctype<T>::hid(), H5S_ALL, H5S_ALL, H5P_DEFAULT,
-                 data.data());
+        hid_t type = detail::ctype<T>::hid();
+        herr_t status =
+            H5Dwrite(id_, type, H5S_ALL, H5S_ALL, H5P_DEFAULT, data.data());
+        H5Tclose(type);
+        if (status < 0)
+            throw std::runtime_error("Unable to write dataset");
     }
 
     void write(const Tensor &data)
     {
-        if (data.type() != CoreTensor)
+        IndexRange whole = ranges(data.dims());
+        write(data, whole, whole);
+    }
+
+    /**
+     * Writes the block Ainds of A into the hyperslab Cinds of the dataset
+     * (a {begin, end} pair per dimension; both blocks have the same
+     * shape). Core tensors are written in place; others go through a
+     * CoreTensor copy of the block.
+     */
+    void write(const Tensor &A, const IndexRange &Cinds, const IndexRange &Ainds)
+    {
+        if (A.type() != CoreTensor)
         {
-            throw std::runtime_error(
-                "Only able to write CoreTensor's to disk.");
+            Tensor block = Tensor::build(CoreTensor, A.name(), sizes(Ainds));
+            block.slice(A, ranges(block.dims()), Ainds);
+            write(block, Cinds, ranges(block.dims()));
+            return;
         }
 
-        write(data.data());
+        Dataspace memory(A.dims());
+        memory.select(Ainds);
+        Dataspace file = space();
+        file.select(Cinds);
+
+        hid_t type = detail::ctype<T>::hid();
+        herr_t status = H5Dwrite(id_, type, memory.id(), file.id(),
+                                 H5P_DEFAULT, A.data().data());
+        H5Tclose(type);
+        if (status < 0)
+            throw std::runtime_error("Unable to write hyperslab");
+    }
+
+    void read(vector<T> &data)
+    {
+        Dimension extent = dims();
+        size_t n = 1;
+        for (size_t dim : extent)
+            n *= dim;
+        data.resize(n);
+
+        hid_t type = detail::ctype<T>::hid();
+        herr_t status =
+            H5Dread(id_, type, H5S_ALL, H5S_ALL, H5P_DEFAULT, data.data());
+        H5Tclose(type);
+        if (status < 0)
+            throw std::runtime_error("Unable to read dataset");
     }
 
-    void read(const vector<T> &data)
+    void read(Tensor &data)
     {
-        //        H5Dread(id_, detail::ctype<T>::hid(), )
+        Dimension extent = dims();
+        if (data.dims() != extent)
+            throw std::runtime_error(
+                "Tensor dimensions do not match the dataset.");
+        IndexRange whole = ranges(extent);
+        read(data, whole, whole);
+    }
+
+    /**
+     * Reads the hyperslab Ainds of the dataset into the block Cinds of C
+     * (a {begin, end} pair per dimension; both blocks have the same
+     * shape), the way C.slice() copies a block of a tensor. Core tensors
+     * are read into in place; others through a CoreTensor block.
+     */
+    void read(Tensor &C, const IndexRange &Cinds, const IndexRange &Ainds)
+    {
+        if (C.type() != CoreTensor)
+        {
+            Tensor block = Tensor::build(CoreTensor, C.name(), sizes(Cinds));
+            read(block, ranges(block.dims()), Ainds);
+            C.slice(block, Cinds, ranges(block.dims()));
+            return;
+        }
+
+        Dataspace memory(C.dims());
+        memory.select(Cinds);
+        Dataspace file = space();
+        file.select(Ainds);
+
+        hid_t type = detail::ctype<T>::hid();
+        herr_t status = H5Dread(id_, type, memory.id(), file.id(),
+                                H5P_DEFAULT, C.data().data());
+        H5Tclose(type);
+        if (status < 0)
+            throw std::runtime_error("Unable to read hyperslab");
     }
 
     const hid_t &id() const { return id_; }
@@ -130,7 +270,43 @@ template <typename T> struct Dataset
         set.write(data);
     }
 
+    /// Writes data to a dataset of its name stored in chunks passed
+    /// through filter
+    static void write(const Location& location, const Tensor& data,
+                      Filter filter)
+    {
+        Dataspace space(data);
+        Dataset<T> set(location, data.name(), space,
+                       chunk_dims(data.dims(), sizeof(T)), filter);
+        set.write(data);
+    }
+
+    /// Reads the dataset name into a new CoreTensor
+    static Tensor read(const Location& location, const string& name)
+    {
+        Dataset<T> set(location, name);
+        Tensor data = Tensor::build(CoreTensor, name, set.dims());
+        set.read(data);
+        return data;
+    }
+
   private:
+    static IndexRange ranges(const Dimension &dims)
+    {
+        IndexRange whole;
+        for (size_t dim : dims)
+            whole.push_back({0, dim});
+        return whole;
+    }
+
+    static Dimension sizes(const IndexRange &ranges)
+    {
+        Dimension dims;
+        for (const auto &range : ranges)
+            dims.push_back(range[1] - range[0]);
+        return dims;
+    }
+
     hid_t id_;
 };
 
@@ -139,6 +315,24 @@ inline void write(const Location& location, const Tensor& data)
     Dataset<double>::write(location, data);
 }
 
+inline void write(const Location& location, const Tensor& data, Filter filter)
+{
+    Dataset<double>::write(location, data, filter);
+}
+
+inline Tensor read(const Location& location, const string& name)
+{
+    return Dataset<double>::read(location, name);
+}
+
+/// Writes the blocks of data as datasets named by their block labels, in a
+/// group of the name of data
+void write(const Location& location, BlockedTensor data,
+           Filter filter = kFilterNone);
+
+/// Reads the blocks in the group name into data, one block per dataset
+void read(const Location& location, const string& name, BlockedTensor& data);
+
 } // namespace hdf5
 
 } // namespace io
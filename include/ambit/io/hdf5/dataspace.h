@@ -51,14 +51,31 @@ struct Dataspace
     Dataspace(const Dimension& current_dims);
     Dataspace(const Dimension& current_dims, const Dimension& maximum_dims);
 
+    // The id is closed with the dataspace, so it may only be moved.
+    Dataspace(const Dataspace&) = delete;
+    Dataspace& operator=(const Dataspace&) = delete;
+    Dataspace(Dataspace&& other);
+
     virtual ~Dataspace();
 
+    /// Takes ownership of an open dataspace id (e.g. from H5Dget_space)
+    static Dataspace adopt(hid_t id);
+
     hid_t id() const
     {
         return dataspace_id_;
     }
 
+    /// Current extent of each dimension
+    Dimension dims() const;
+
+    /// Selects the block spanned by ranges, a {begin, end} pair per
+    /// dimension, as the part of the dataspace read or written
+    void select(const IndexRange& ranges);
+
 private:
+    Dataspace() : dataspace_id_(-1) {}
+
     hid_t dataspace_id_;
 };
 
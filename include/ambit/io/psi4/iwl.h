@@ -32,6 +32,7 @@
 
 #include "file.h"
 
+#include <ambit/blocked_tensor.h>
 #include <ambit/tensor.h>
 
 namespace ambit
@@ -101,6 +102,21 @@ struct IWL : public File
 
     static void read_two(IWL& io, Tensor& tensor);
 
+    /**
+    * Reads the block of the two-electron integrals that ranges select (a
+    * {begin, end} pair of orbitals per index) into tensor, whose
+    * dimensions are those of the block. Only the block is ever held.
+    */
+    static void read_two(IWL& io, Tensor& tensor, const IndexRange& ranges);
+
+    /**
+    * Reads the two-electron integrals into every block of tensor, routing
+    * each integral and its permutations to the blocks whose MO spaces hold
+    * them. The MOs are read as spatial orbitals, whatever the spin of the
+    * spaces. Only the blocks are ever held.
+    */
+    static void read_two(IWL& io, BlockedTensor& tensor);
+
 private:
     /// psi3/4 compatible label structure.
     std::vector<short int> labels_;
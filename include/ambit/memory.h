@@ -0,0 +1,82 @@
+/*
+ * @BEGIN LICENSE
+ *
+ * ambit: C++ library for the implementation of tensor product calculations
+ *        through a clean, concise user interface.
+ *
+ * Copyright (c) 2014-2017 Ambit developers.
+ *
+ * The copyrights for code used from other parties are included in
+ * the corresponding files.
+ *
+ * This file is part of ambit.
+ *
+ * Ambit is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * Ambit is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License along
+ * with ambit; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * @END LICENSE
+ */
+
+#ifndef AMBIT_MEMORY_H
+#define AMBIT_MEMORY_H
+
+#include "tensor.h"
+
+namespace ambit
+{
+
+// => Memory Accounting <=
+//
+// Every tensor backend reports the storage it allocates here. In-core
+// storage (CoreTensor and the local share of DistributedTensor data) is
+// held to settings::memory_limit; disk storage is only tracked.
+namespace memory
+{
+
+/** Records an allocation made by a tensor backend.
+ *
+ * @param type the kind of storage (CoreTensor, DiskTensor or
+ *        DistributedTensor)
+ * @param bytes the number of bytes allocated
+ *
+ * Throws detail::OutOfMemoryException, without recording anything, when an
+ * in-core allocation would take the in-core total past
+ * settings::memory_limit.
+ */
+void allocate(TensorType type, size_t bytes);
+
+/// Records that a backend released bytes previously recorded by allocate.
+void release(TensorType type, size_t bytes);
+
+/// Bytes currently held by tensors of the given type.
+size_t current(TensorType type);
+
+/// High-water mark of current(type) since the start (or the last
+/// reset_peak).
+size_t peak(TensorType type);
+
+/// Bytes currently held in core, over all tensor types.
+size_t current_in_core();
+
+/// High-water mark of current_in_core().
+size_t peak_in_core();
+
+/// Restarts the high-water marks from the current usage.
+void reset_peak();
+
+/// Prints current and peak usage for every tensor type.
+void report();
+}
+}
+
+#endif // AMBIT_MEMORY_H
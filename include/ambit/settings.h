@@ -34,9 +34,20 @@
 #ifndef AMBIT_SETTINGS_H
 #define AMBIT_SETTINGS_H
 
+#include <cstddef>
+#include <string>
+
 namespace ambit
 {
 
+// => Contraction Ordering Policies <=
+enum ContractionPolicy
+{
+    MinimumFlops,       // <= Fewest FLOPs, counting permutation traffic
+    MinimumMemory,      // <= Smallest largest pairwise contraction
+    FlopsUnderMemoryCap // <= Fewest FLOPs within settings::memory_limit
+};
+
 // => Settings Namespace <=
 namespace settings
 {
@@ -53,7 +64,14 @@ extern int rank;
 /// Print debug information? true, or false
 extern bool debug;
 
-/// Memory usage limit. Default is 1GB.
+/** Memory usage limit in bytes. Default is the physical memory of the
+ * machine (unlimited if that cannot be determined); set a lower value to
+ * opt into a tighter cap.
+ *
+ * In-core tensor storage (including contraction scratch space) beyond this
+ * limit throws detail::OutOfMemoryException. Out-of-core operations size
+ * their tiles to the memory left under it. See ambit/memory.h.
+ */
 extern size_t memory_limit;
 
 /// Distributed capable?
@@ -61,6 +79,53 @@ extern const bool distributed_capable;
 
 /// Enable timers
 extern bool timers;
+
+/** When not empty, the timers are also written as JSON to this file when
+ * they are reported, with nanosecond totals, call counts and min/max/mean
+ * times per timer. Default is empty.
+ */
+extern std::string timer_json_file;
+
+/** When not empty, every timer call is recorded as an event and the events
+ * are written to this file in Chrome trace format (chrome://tracing,
+ * Perfetto) when the timers are reported. Default is empty.
+ */
+extern std::string timer_trace_file;
+
+/** When not empty, every contraction and permutation is logged, and the
+ * log is written to this file as JSON lines when the timers are reported.
+ * The log grows with each operation, so leave this empty for long runs.
+ * Default is empty.
+ */
+extern std::string contraction_log_file;
+
+/** Largest number of tensors in a contraction whose evaluation order is
+ * found by exhaustive search. The search time grows as 3^n and its memory as
+ * 2^n, so values above 20 are treated as 20; bigger contractions are ordered
+ * greedily. Default is 12.
+ */
+extern int contraction_search_limit;
+
+/// Objective used to order multi-tensor contractions. Default is
+/// MinimumFlops.
+extern ContractionPolicy contraction_policy;
+
+/** Number of tiles a disk tensor slice keeps in flight: the tiles after
+ * the one being processed are read ahead, and written tiles are flushed
+ * behind, by a background I/O thread. 1 disables the overlap. Default is 2.
+ */
+extern int disk_queue_depth;
+
+/** Disk tensors of at most this many bytes are memory-mapped when built, so
+ * that in-core kernels work on the file in place through the page cache.
+ * Default is 0 (never).
+ */
+extern size_t disk_mmap_limit;
+
+/** Pack the chunks of saved tensors (byte shuffle and LZ compression) when
+ * that makes them smaller. Default is false.
+ */
+extern bool compress_tensor_files;
 }
 }
 
@@ -346,6 +346,25 @@ class Tensor
     void permute(const Tensor &A, const Indices &Cinds, const Indices &Ainds,
                  double alpha = 1.0, double beta = 0.0);
 
+    /**
+     * Perform the permutation sum:
+     *  C(Cinds) = sum_t alphas[t] * As[t](Ainds[t]) + beta * C(Cinds)
+     *
+     * Core tensors are updated in a single pass over C, e.g.,
+     *  C2("ijab") = A2("ijab") - A2("jiab") - A2("ijba") + A2("jiba");
+     * reads and writes C2 once instead of once per term.
+     *
+     * Parameters:
+     *  @param As The source tensors
+     *  @param Cinds The indices of tensor C, e.g., "ijab"
+     *  @param Ainds The indices of each source tensor
+     *  @param alphas The scale applied to each source tensor
+     *  @param beta The scale applied to the tensor C, e.g., 1.0
+     **/
+    void permute(const vector<Tensor> &As, const Indices &Cinds,
+                 const vector<Indices> &Ainds, const vector<double> &alphas,
+                 double beta = 0.0);
+
     /**
      * Perform the contraction:
      *  C(Cinds) = alpha * A(Ainds) * B(Binds) + beta * C(Cinds)
@@ -557,6 +576,10 @@ class Tensor
 /**
  * This function saves a tensor to a binary file on disk
  *
+ * The data is written in checksummed chunks, packed when
+ * settings::compress_tensor_files is set. Files written by earlier versions
+ * can still be loaded.
+ *
  * @param t a tensor
  * @param filename the name of the binary file
  * @param overwrite overwrite an existing file?
@@ -583,22 +606,45 @@ void load(Tensor &t, const std::string &filename);
 Tensor load_tensor(const std::string &filename);
 
 /**
- * This function saves a tensor to an output file stream
+ * This function loads the block of a tensor saved with save() that ranges
+ * select, reading only the parts of the file that hold it. If the tensor
+ * passed in is empty, a CoreTensor of the dimensions of the block is built;
+ * otherwise its dimensions must be those of the block.
+ *
+ * @param t a tensor
+ * @param filename the name of the binary file
+ * @param ranges a {begin, end} range of each index of the saved tensor
+ *
+ */
+void load(Tensor &t, const std::string &filename, const IndexRange &ranges);
+
+/**
+ * This function loads the block of a tensor saved with save() that ranges
+ * select and returns it as a tensor.
+ *
+ * @param filename the name of the binary file
+ * @param ranges a {begin, end} range of each index of the saved tensor
+ * @return a tensor
+ */
+Tensor load_tensor(const std::string &filename, const IndexRange &ranges);
+
+/**
+ * This function saves a tensor to an output stream
  *
  * @param t a tensor
- * @param out the output file stream
+ * @param out the output stream (e.g. a binary std::ofstream)
  *
  */
-void write_tensor_to_file(Tensor t, std::ofstream &out);
+void write_tensor_to_file(Tensor t, std::ostream &out);
 
 /**
- * This function loads a tensor from an input file stream
+ * This function loads a tensor from an input stream
  *
  * @param t a tensor
- * @param in the input file stream
+ * @param in the input stream (e.g. a binary std::ifstream)
  *
  */
-void read_tensor_from_file(Tensor &t, std::ifstream &in);
+void read_tensor_from_file(Tensor &t, std::istream &in);
 
 class LabeledTensor
 {
@@ -661,6 +707,13 @@ class LabeledTensor
   private:
     void set(const LabeledTensor &to);
 
+    // T = sum of sign * rhs terms + beta * T, in one pass when possible
+    void add(const LabeledTensorAddition &rhs, double sign, double beta);
+
+    // T (+/-)= A * (B1 + B2 + ...), summing the addends first when possible
+    void distribute(const LabeledTensorDistribution &rhs, bool zero_result,
+                    bool add);
+
     Tensor T_;
     Indices indices_;
     double factor_;
@@ -671,6 +724,43 @@ inline LabeledTensor operator*(double factor, const LabeledTensor &ti)
     return LabeledTensor(ti.T(), ti.indices(), factor * ti.factor());
 }
 
+/** A pairwise evaluation order for a multi-tensor contraction.
+ *
+ * The first nleaves() nodes are the terms of the contraction, in the order
+ * they were multiplied. Every following node contracts two earlier nodes
+ * into an intermediate; nodes appear in evaluation order and the last one
+ * produces the result. Any tree shape is allowed, not only left-deep chains.
+ */
+struct ContractionTree
+{
+    struct Node
+    {
+        /// Children of a contraction node, or -1 for a term
+        int left;
+        int right;
+        /// Indices of the term or of the intermediate it produces
+        Indices indices;
+    };
+
+    vector<Node> nodes;
+
+    /// FLOPs (2 m n k per GEMM) summed over all pairwise contractions
+    double flops;
+    /// Elements moved by the permutations the pairwise contractions need
+    double traffic;
+    /// FLOPs plus a per-element charge for the permutation traffic
+    double cpu_cost;
+    /// Largest number of elements held by a single pairwise contraction
+    /// (both operands and the result)
+    double memory_cost;
+
+    size_t nleaves() const { return (nodes.size() + 1) / 2; }
+    bool is_leaf(size_t node) const { return nodes[node].left < 0; }
+
+    /// Parenthesized order, e.g. "((0 * 1) * (2 * 3))"
+    string str() const;
+};
+
 class LabeledTensorContraction
 {
 
@@ -698,9 +788,31 @@ class LabeledTensorContraction
     // conversion operator
     operator double() const;
 
+    /** Cost of contracting the terms left to right in the order perm.
+     *
+     * The result is taken to carry every index found in a single term.
+     *
+     * @return the cpu_cost and memory_cost of the ContractionTree
+     */
     pair<double, double>
     compute_contraction_cost(const vector<size_t> &perm) const;
 
+    /** Chooses the order in which to evaluate this contraction.
+     *
+     * Contractions of up to settings::contraction_search_limit tensors are
+     * ordered by an exhaustive dynamic-programming search over subsets;
+     * larger ones greedily contract the cheapest pair first.
+     *
+     * @param result the indices of the tensor receiving the contraction
+     * @param optimize if false, the terms are contracted left to right
+     * @param policy what makes one order better than another
+     * @return the best pairwise contraction tree found
+     */
+    ContractionTree
+    contraction_tree(const Indices &result, bool optimize = true,
+                     ContractionPolicy policy = settings::contraction_policy)
+        const;
+
   private:
     vector<LabeledTensor> tensors_;
 };
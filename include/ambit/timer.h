@@ -36,6 +36,8 @@
 
 #include "common_types.h"
 
+#include <iosfwd>
+
 namespace ambit
 {
 namespace timer
@@ -47,10 +49,102 @@ void initialize();
 // TODO: Should be hidden from public interface
 void finalize();
 
+// Prints the timer trees of every thread, merged by timer path. Must not
+// be called while other threads are timing.
 void report();
 
+// Writes the timer trees of every thread, merged by timer path, as JSON.
+// Times are in nanoseconds.
+void write_json(std::ostream &out);
+
+// Writes the timer events recorded while settings::timer_trace_file was set
+// in Chrome trace event format, one track per thread.
+void write_trace(std::ostream &out);
+
+// The interned id of the timer called name. Timers pushed by id skip the
+// name lookup, so hot code looks its ids up once, e.g. in a function-local
+// static.
+size_t timer_id(const string &name);
+
+// Timers may be pushed and popped from any thread. Each thread keeps its own
+// tree, so timers pushed by a worker thread start at the top level rather
+// than under the timer running on the thread that spawned it.
 void timer_push(const string &name);
+void timer_push(size_t id);
 void timer_pop();
+
+// Add to the floating point operations and bytes moved by the innermost
+// running timer of the calling thread. report() derives the GFLOP/s, GB/s
+// and arithmetic intensity of each timer from them.
+void add_flops(double flops);
+void add_bytes(double bytes);
+
+// A contraction or permutation, as logged while settings::contraction_log_file
+// is set or debug printing is on
+struct ContractionRecord
+{
+    // "labeled contract", "Tensor::contract", "Tensor::permute" or
+    // "Tensor::permute_sum", and "contract", "permute" or "permute_sum" for
+    // the core kernels they run
+    string operation;
+    // The operation with the names and indices of its tensors,
+    // e.g. "C[i,j] = A[i,k] * B[k,j]"
+    string expression;
+    // Dimensions of the result, then of each operand
+    vector<Dimension> dims;
+    // Factors of C = alpha * (...) + beta * C; alpha is 1 for sums of terms,
+    // which carry one factor each
+    double alpha = 1.0;
+    double beta = 0.0;
+
+    // Whether the core kernel permuted C, A or B into GEMM order
+    bool permC = false;
+    bool permA = false;
+    bool permB = false;
+    // Shape of the GEMMs the contraction was mapped to, batch of them
+    size_t m = 0;
+    size_t n = 0;
+    size_t k = 0;
+    size_t batch = 0;
+
+    double seconds = 0.0;
+    double flops = 0.0;
+    double bytes = 0.0;
+
+    double gflops() const
+    {
+        return seconds > 0.0 ? flops / seconds * 1.0e-9 : 0.0;
+    }
+};
+
+// Whether contractions and permutations are being logged (or printed)
+bool contraction_logging();
+
+// Adds a record to the contraction log if settings::contraction_log_file is
+// set, and prints it when debugging
+void log_contraction(const ContractionRecord &record);
+
+// The records logged so far, in the order they finished
+vector<ContractionRecord> contraction_log();
+void clear_contraction_log();
+
+// Writes the contraction log as JSON lines, one record per line
+void write_contraction_log(std::ostream &out);
+
+// Times the scope it lives in, if timers are on when it is created.
+class TimerScope
+{
+  public:
+    explicit TimerScope(const string &name);
+    explicit TimerScope(size_t id);
+    ~TimerScope();
+
+    TimerScope(const TimerScope &) = delete;
+    TimerScope &operator=(const TimerScope &) = delete;
+
+  private:
+    bool active_;
+};
 }
 }
 
@@ -27,24 +27,301 @@
  * @END LICENSE
  */
 
+#include <fcntl.h>
 #include <sys/stat.h>
+#include <unistd.h>
 
 #include <algorithm>
+#include <cerrno>
 #include <cmath>
 #include <cstring>
+#include <exception>
 #include <fstream>
+#include <functional>
 #include <iostream>
 #include <numeric>
 #include <set>
+#include <sstream>
 #include <stdexcept>
 #include <string>
 
 #include <ambit/blocked_tensor.h>
+#include <tensor/contraction_cost.h>
+#include <tensor/file/tensor_file.h>
 #include <tensor/indices.h>
 
+#if defined(_OPENMP)
+#include <omp.h>
+#endif
+
 namespace ambit
 {
 
+namespace
+{
+
+// The block contractions that accumulate into one result block
+struct BlockContractionGroup
+{
+    Tensor result;
+    std::vector<LabeledTensorContraction> products;
+    double flops = 0.0;
+};
+
+// First bytes of a block-indexed BlockedTensor file
+const char blocked_file_magic[8] = {'A', 'M', 'B', 'I', 'T', 'B', 'L', 'K'};
+
+// Current version of the block-indexed format
+constexpr uint32_t blocked_file_version = 1;
+
+// Alignment of the blocks in the file, in bytes
+constexpr uint64_t blocked_file_alignment = 4096;
+
+// Entry of the table of contents of a block-indexed file
+struct BlockFileEntry
+{
+    std::string label;
+    Dimension dims;
+    // Position and size of the block's tensor record
+    uint64_t offset = 0;
+    uint64_t bytes = 0;
+};
+
+uint64_t align_block(uint64_t offset)
+{
+    return (offset + blocked_file_alignment - 1) / blocked_file_alignment *
+           blocked_file_alignment;
+}
+
+void put_u64(std::ostream &out, uint64_t value)
+{
+    out.write(reinterpret_cast<const char *>(&value), sizeof(value));
+}
+
+uint64_t get_u64(std::istream &in)
+{
+    uint64_t value = 0;
+    in.read(reinterpret_cast<char *>(&value), sizeof(value));
+    if (!in)
+        throw std::runtime_error("BlockedTensor file is truncated.");
+    return value;
+}
+
+// Header of a block-indexed file: magic, version, name and the table of
+// contents. Its size does not depend on the offsets.
+std::string blocked_file_header(const std::string &name,
+                                const std::vector<BlockFileEntry> &toc)
+{
+    std::ostringstream out;
+    out.write(blocked_file_magic, sizeof(blocked_file_magic));
+    put_u64(out, blocked_file_version);
+    put_u64(out, name.size());
+    out.write(name.data(), name.size());
+    put_u64(out, toc.size());
+    for (const BlockFileEntry &entry : toc)
+    {
+        put_u64(out, entry.label.size());
+        out.write(entry.label.data(), entry.label.size());
+        put_u64(out, entry.dims.size());
+        for (size_t dim : entry.dims)
+            put_u64(out, dim);
+        put_u64(out, entry.offset);
+        put_u64(out, entry.bytes);
+    }
+    return out.str();
+}
+
+// Is the stream at the start of a block-indexed file? (position unchanged)
+bool at_blocked_file_header(std::istream &in)
+{
+    char magic[sizeof(blocked_file_magic)];
+    std::streampos position = in.tellg();
+    in.read(magic, sizeof(magic));
+    bool found = in.gcount() == sizeof(magic) &&
+                 std::memcmp(magic, blocked_file_magic, sizeof(magic)) == 0;
+    in.clear();
+    in.seekg(position);
+    return found;
+}
+
+std::vector<BlockFileEntry> read_blocked_file_header(std::istream &in,
+                                                     std::string &name)
+{
+    char magic[sizeof(blocked_file_magic)];
+    in.read(magic, sizeof(magic));
+    uint64_t version = get_u64(in);
+    if (version > blocked_file_version)
+        throw std::runtime_error("BlockedTensor file format version " +
+                                 std::to_string(version) +
+                                 " is newer than this library.");
+    name.resize(get_u64(in));
+    in.read(&name[0], name.size());
+    std::vector<BlockFileEntry> toc(get_u64(in));
+    for (BlockFileEntry &entry : toc)
+    {
+        entry.label.resize(get_u64(in));
+        in.read(&entry.label[0], entry.label.size());
+        entry.dims.resize(get_u64(in));
+        for (size_t &dim : entry.dims)
+            dim = get_u64(in);
+        entry.offset = get_u64(in);
+        entry.bytes = get_u64(in);
+    }
+    return toc;
+}
+
+// Writes all n bytes at offset, resuming short writes
+void pwrite_all(int fd, const char *data, size_t n, uint64_t offset,
+                const std::string &filename)
+{
+    while (n > 0)
+    {
+        ssize_t written = ::pwrite(fd, data, n, static_cast<off_t>(offset));
+        if (written < 0 && errno == EINTR)
+            continue;
+        if (written <= 0)
+            throw std::runtime_error("Error when writing " + filename);
+        data += written;
+        offset += written;
+        n -= written;
+    }
+}
+
+/**
+ * An output stream buffer over the bytes of a file from base on, written
+ * with pwrite, so that several threads can stream records into their own
+ * regions of one file. Positions are relative to base. Writes of at least
+ * the buffer size go straight to the file.
+ */
+class FileRegionBuffer : public std::streambuf
+{
+  public:
+    FileRegionBuffer(int fd, uint64_t base, const std::string &filename)
+        : fd_(fd), base_(base), filename_(filename), buffer_(64 * 1024)
+    {
+        setp(buffer_.data(), buffer_.data() + buffer_.size());
+    }
+
+  protected:
+    int_type overflow(int_type c) override
+    {
+        flush();
+        if (!traits_type::eq_int_type(c, traits_type::eof()))
+        {
+            *pptr() = traits_type::to_char_type(c);
+            pbump(1);
+        }
+        return traits_type::not_eof(c);
+    }
+
+    std::streamsize xsputn(const char *data, std::streamsize n) override
+    {
+        if (n > epptr() - pptr())
+        {
+            flush();
+            if (n >= static_cast<std::streamsize>(buffer_.size()))
+            {
+                pwrite_all(fd_, data, n, base_ + position_, filename_);
+                position_ += n;
+                return n;
+            }
+        }
+        std::memcpy(pptr(), data, n);
+        pbump(static_cast<int>(n));
+        return n;
+    }
+
+    int sync() override
+    {
+        flush();
+        return 0;
+    }
+
+    pos_type seekoff(off_type off, std::ios_base::seekdir dir,
+                     std::ios_base::openmode which) override
+    {
+        if (dir == std::ios_base::beg)
+            return seekpos(off, which);
+        if (dir == std::ios_base::cur && off == 0)
+            return pos_type(position_ + (pptr() - pbase()));
+        return pos_type(off_type(-1));
+    }
+
+    pos_type seekpos(pos_type pos, std::ios_base::openmode) override
+    {
+        flush();
+        position_ = static_cast<uint64_t>(static_cast<off_type>(pos));
+        return pos;
+    }
+
+  private:
+    // Writes out the buffered bytes, which start at position_
+    void flush()
+    {
+        size_t n = pptr() - pbase();
+        if (n > 0)
+            pwrite_all(fd_, pbase(), n, base_ + position_, filename_);
+        position_ += n;
+        setp(buffer_.data(), buffer_.data() + buffer_.size());
+    }
+
+    int fd_;
+    uint64_t base_;
+    const std::string &filename_;
+    std::vector<char> buffer_;
+    uint64_t position_ = 0;
+};
+
+// Blocks are saved and loaded by several threads unless debug printing is
+// on, or there are fewer blocks than threads, in which case each block uses
+// every thread for its chunks.
+bool blocks_in_parallel(size_t nblocks)
+{
+#if defined(_OPENMP)
+    return !settings::debug &&
+           nblocks >= static_cast<size_t>(omp_get_max_threads());
+#else
+    (void)nblocks;
+    return false;
+#endif
+}
+
+// Reads the blocks of a file written before blocks were indexed
+void read_unindexed_blocks(BlockedTensor &bt, std::istream &in)
+{
+    // read the name
+    std::string name;
+    size_t size = 0;
+    in.read(reinterpret_cast<char *>(&size), sizeof(size_t));
+    name.resize(size);
+    in.read(&name[0], size);
+
+    // read the number of blocks
+    size_t num_blocks = 0;
+    in.read(reinterpret_cast<char *>(&num_blocks), sizeof(size_t));
+
+    // read the block labels
+    std::vector<std::string> block_labels;
+    for (size_t b = 0; b < num_blocks; b++)
+    {
+        std::string block;
+        size_t block_label_size = 0;
+        in.read(reinterpret_cast<char *>(&block_label_size), sizeof(size_t));
+        block.resize(block_label_size);
+        in.read(&block[0], block_label_size);
+        block_labels.push_back(block);
+    }
+
+    // read tensor from file
+    for (const std::string &block : block_labels)
+    {
+        Tensor t;
+        read_tensor_from_file(t, in);
+        bt.set_block(block, t);
+    }
+}
+}
+
 // Static members of BlockedTensor
 std::vector<MOSpace> BlockedTensor::mo_spaces_;
 std::map<std::string, size_t> BlockedTensor::name_to_mo_space_;
@@ -756,35 +1033,67 @@ void save(BlockedTensor bt, const std::string &filename, bool overwrite)
             throw std::runtime_error(error);
         }
     }
-    // create the file
-    std::ofstream out(filename.c_str(), std::ios_base::binary);
-
     auto block_labels = bt.block_labels();
+    std::vector<BlockFileEntry> toc(block_labels.size());
+    std::vector<Tensor> blocks;
+    for (size_t b = 0; b < block_labels.size(); b++)
+    {
+        blocks.push_back(bt.block(block_labels[b]));
+        toc[b].label = block_labels[b];
+        toc[b].dims = blocks[b].dims();
+    }
 
-    // write the name
-    auto name = bt.name();
-    size_t size = name.size();
-    out.write(reinterpret_cast<char *>(&size), sizeof(size_t));
-    out.write(&name[0], size);
-
-    // write the number of blocks
-    size_t num_blocks = block_labels.size();
-    out.write(reinterpret_cast<char *>(&num_blocks), sizeof(size_t));
+    // create the file
+    int fd = ::open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        throw std::runtime_error("Unable to create " + filename);
 
-    // write the block labels
-    for (const std::string &block : block_labels)
+    // Each block gets an aligned region as large as its record can be and
+    // is streamed into it with pwrite; the table of contents goes in last,
+    // in the space left for it at the start. Packed records leave the end
+    // of their region as a hole.
+    uint64_t next = align_block(blocked_file_header(bt.name(), toc).size());
+    for (size_t b = 0; b < blocks.size(); b++)
     {
-        size_t block_label_size = block.size();
-        out.write(reinterpret_cast<char *>(&block_label_size), sizeof(size_t));
-        out.write(&block[0], block_label_size);
+        toc[b].offset = next;
+        next = align_block(
+            next + tensor_record_bound(blocks[b].name(), toc[b].dims));
     }
-
-    // write the blocks
-    for (const std::string &block : block_labels)
+    std::exception_ptr error;
+#pragma omp parallel for schedule(dynamic, 1) if (blocks_in_parallel(blocks.size()))
+    for (size_t b = 0; b < blocks.size(); b++)
+    {
+        try
+        {
+            FileRegionBuffer region(fd, toc[b].offset, filename);
+            std::ostream record(&region);
+            write_tensor_to_file(blocks[b], record);
+            toc[b].bytes = static_cast<uint64_t>(record.tellp());
+            if (!record.flush())
+                throw std::runtime_error("Error when writing " + filename);
+        }
+        catch (...)
+        {
+#pragma omp critical(ambit_blocked_save_error)
+            if (!error)
+                error = std::current_exception();
+        }
+    }
+    try
     {
-        auto t = bt.block(block);
-        write_tensor_to_file(t, out);
+        if (!error)
+        {
+            std::string header = blocked_file_header(bt.name(), toc);
+            pwrite_all(fd, header.data(), header.size(), 0, filename);
+        }
+    }
+    catch (...)
+    {
+        error = std::current_exception();
     }
+    ::close(fd);
+    if (error)
+        std::rethrow_exception(error);
 }
 
 void load(BlockedTensor &bt, const std::string &filename)
@@ -796,40 +1105,69 @@ void load(BlockedTensor &bt, const std::string &filename)
         std::string error = "File " + filename + " does not exist.";
         throw std::runtime_error(error);
     }
-
-    // read the name
+    if (!at_blocked_file_header(in))
+    {
+        read_unindexed_blocks(bt, in);
+        return;
+    }
     std::string name;
-    size_t size = 0;
-    in.read(reinterpret_cast<char *>(&size), sizeof(size_t));
-    name.resize(size);
-    in.read(&name[0], size);
+    std::vector<BlockFileEntry> toc = read_blocked_file_header(in, name);
+    in.close();
 
-    // read the number of blocks
-    size_t num_blocks = 0;
-    in.read(reinterpret_cast<char *>(&num_blocks), sizeof(size_t));
+    // Every thread reads its blocks through its own stream
+    std::vector<Tensor> blocks(toc.size());
+    std::exception_ptr error;
+#pragma omp parallel for schedule(dynamic, 1) if (blocks_in_parallel(toc.size()))
+    for (size_t b = 0; b < toc.size(); b++)
+    {
+        try
+        {
+            std::ifstream block_in(filename.c_str(), std::ios_base::binary);
+            block_in.seekg(static_cast<std::streamoff>(toc[b].offset));
+            read_tensor_from_file(blocks[b], block_in);
+        }
+        catch (...)
+        {
+#pragma omp critical(ambit_blocked_load_error)
+            if (!error)
+                error = std::current_exception();
+        }
+    }
+    if (error)
+        std::rethrow_exception(error);
 
-    // read the block labels
-    std::vector<std::string> block_labels;
-    for (size_t b = 0; b < num_blocks; b++)
+    for (size_t b = 0; b < toc.size(); b++)
+        bt.set_block(toc[b].label, blocks[b]);
+}
+
+Tensor load_block(const std::string &filename, const std::string &block)
+{
+    // check if file exists or not
+    std::ifstream in(filename.c_str(), std::ios_base::binary);
+    if (!in.good())
     {
-        std::string block;
-        size_t block_label_size = 0;
-        in.read(reinterpret_cast<char *>(&block_label_size), sizeof(size_t));
-        block.resize(block_label_size);
-        in.read(&block[0], block_label_size);
-        block_labels.push_back(block);
+        std::string error = "File " + filename + " does not exist.";
+        throw std::runtime_error(error);
     }
 
-    // read tensor from file
-    for (const std::string &block : block_labels)
+    Tensor t;
+    if (!at_blocked_file_header(in))
     {
-        Tensor t;
+        // No index: the blocks before it have to be read through
+        BlockedTensor bt;
+        read_unindexed_blocks(bt, in);
+        return bt.block(block);
+    }
+    std::string name;
+    for (const BlockFileEntry &entry : read_blocked_file_header(in, name))
+    {
+        if (entry.label != block)
+            continue;
+        in.seekg(static_cast<std::streamoff>(entry.offset));
         read_tensor_from_file(t, in);
-        bt.set_block(block, t);
+        return t;
     }
-
-    // 4. close the file
-    in.close();
+    throw std::runtime_error("Block " + block + " is not in " + filename);
 }
 
 BlockedTensor load_blocked_tensor(const std::string &filename)
@@ -1183,7 +1521,9 @@ void LabeledBlockedTensor::contract_pair(
         }
     }
 
-    // Setup and perform contractions
+    // Gather the block contractions, grouped by the result block they
+    // accumulate into. Different groups write disjoint data.
+    std::map<std::vector<size_t>, BlockContractionGroup> groups;
     for (const std::vector<size_t> &uik : unique_indices_keys)
     {
         std::vector<size_t> result_key;
@@ -1213,8 +1553,13 @@ void LabeledBlockedTensor::contract_pair(
 
         if (do_contract)
         {
-            LabeledTensor result(BT().block(result_key), indices(), factor());
+            BlockContractionGroup &group = groups[result_key];
+            if (group.products.empty())
+                group.result = BT().block(result_key);
 
+            // Every unique index appears in some term, so the product of
+            // their ranges measures the work of this contraction.
+            std::vector<double> ranges(uik.size(), 1.0);
             LabeledTensorContraction prod;
             for (size_t n = 0; n < nterms; ++n)
             {
@@ -1226,12 +1571,83 @@ void LabeledBlockedTensor::contract_pair(
                 }
                 const LabeledTensor term(lbt.BT().block(term_key),
                                          lbt.indices(), lbt.factor());
+                for (size_t i = 0; i < term.numdim(); ++i)
+                {
+                    ranges[index_map[term.indices()[i]]] =
+                        static_cast<double>(term.T().dim(i));
+                }
                 prod *= term;
             }
+            group.products.push_back(prod);
+            group.flops += 2.0 * std::accumulate(ranges.begin(), ranges.end(),
+                                                 1.0,
+                                                 std::multiplies<double>());
+        }
+    }
+
+    // Largest groups first
+    std::vector<const BlockContractionGroup *> order;
+    double total_flops = 0.0;
+    for (const auto &key_group : groups)
+    {
+        order.push_back(&key_group.second);
+        total_flops += key_group.second.flops;
+    }
+    std::stable_sort(order.begin(), order.end(),
+                     [](const BlockContractionGroup *a,
+                        const BlockContractionGroup *b) {
+                         return a->flops > b->flops;
+                     });
 
+    auto run_group = [&](const BlockContractionGroup &group) {
+        LabeledTensor result(group.result, indices(), factor());
+        for (const LabeledTensorContraction &prod : group.products)
+        {
             result.contract(prod, false, add, false);
         }
+    };
+
+    // A group worth at least one thread's share of the work runs on its own
+    // so that BLAS and the permutes can use every thread. The remaining
+    // groups are handed out dynamically, largest first, and each runs single
+    // threaded. Debug printing is not thread safe, so it keeps everything
+    // serial.
+    size_t nlarge = order.size();
+#if defined(_OPENMP)
+    size_t nthreads = static_cast<size_t>(omp_get_max_threads());
+    if (nthreads > 1 and not settings::debug)
+    {
+        nlarge = 0;
+        while (nlarge < order.size() &&
+               order[nlarge]->flops * nthreads >= total_flops)
+        {
+            ++nlarge;
+        }
+    }
+#endif
+
+    for (size_t g = 0; g < nlarge; ++g)
+    {
+        run_group(*order[g]);
+    }
+
+    std::exception_ptr error;
+#pragma omp parallel for schedule(dynamic, 1)
+    for (size_t g = nlarge; g < order.size(); ++g)
+    {
+        try
+        {
+            run_group(*order[g]);
+        }
+        catch (...)
+        {
+#pragma omp critical(ambit_contract_pair_error)
+            if (!error)
+                error = std::current_exception();
+        }
     }
+    if (error)
+        std::rethrow_exception(error);
 }
 
 void LabeledBlockedTensor::set(const LabeledBlockedTensor &to)
@@ -1374,7 +1790,10 @@ void LabeledBlockedTensor::contract(
             std::pair<double, double> cpu_memory_cost =
                 rhs.compute_contraction_cost(perm, unique_indices_keys,
                                              index_map, full_contraction);
-            if (cpu_memory_cost.first < best_cpu_memory_cost.first)
+            if (better_contraction_cost(
+                    cpu_memory_cost.first, cpu_memory_cost.second,
+                    best_cpu_memory_cost.first, best_cpu_memory_cost.second,
+                    settings::contraction_policy))
             {
                 best_perm = perm;
                 best_cpu_memory_cost = cpu_memory_cost;
@@ -1564,7 +1983,10 @@ void LabeledBlockedTensor::contract_batched(
             std::pair<double, double> cpu_memory_cost =
                 rhs.compute_contraction_cost(perm, unique_indices_keys,
                                              index_map, full_contraction);
-            if (cpu_memory_cost.first < best_cpu_memory_cost.first)
+            if (better_contraction_cost(
+                    cpu_memory_cost.first, cpu_memory_cost.second,
+                    best_cpu_memory_cost.first, best_cpu_memory_cost.second,
+                    settings::contraction_policy))
             {
                 best_perm = perm;
                 best_cpu_memory_cost = cpu_memory_cost;
@@ -32,3 +32,80 @@
 //
 
 #include <ambit/io/hdf5/dataset.h>
+#include <ambit/io/hdf5/group.h>
+
+#include <algorithm>
+
+namespace ambit {
+
+namespace io {
+
+namespace hdf5 {
+
+Dimension chunk_dims(const Dimension& dims, size_t element_size, size_t target_bytes)
+{
+    Dimension chunk(dims.begin(), dims.end());
+    for (size_t& dim : chunk)
+        dim = std::max(dim, size_t(1)); // chunks may not be empty
+
+    auto bytes = [&]() {
+        size_t n = element_size;
+        for (size_t dim : chunk)
+            n *= dim;
+        return n;
+    };
+    while (bytes() > target_bytes) {
+        auto largest = std::max_element(chunk.begin(), chunk.end());
+        if (*largest == 1)
+            break;
+        *largest = (*largest + 1) / 2;
+    }
+    return chunk;
+}
+
+void write(const Location& location, BlockedTensor data, Filter filter)
+{
+    Group group(location, data.name());
+    for (const string& label : data.block_labels()) {
+        Tensor block = data.block(label);
+        Dataspace space(block);
+        if (filter == kFilterNone) {
+            Dataset<double> set(group, label, space);
+            set.write(block);
+        }
+        else {
+            Dataset<double> set(group, label, space,
+                                chunk_dims(block.dims(), sizeof(double)), filter);
+            set.write(block);
+        }
+    }
+}
+
+void read(const Location& location, const string& name, BlockedTensor& data)
+{
+    if (!location.has_link(name)) {
+        throw std::runtime_error("Unable to find group " + name);
+    }
+
+    Group group(location, name);
+    data.set_name(name);
+    for (size_t n = 0; n < group.size(); ++n) {
+        ssize_t size = H5Lget_name_by_idx(group.id(), ".", H5_INDEX_NAME,
+                                          H5_ITER_INC, n, nullptr, 0, H5P_DEFAULT);
+        if (size < 0) {
+            throw std::runtime_error("Unable to list group " + name);
+        }
+        string label(static_cast<size_t>(size) + 1, '\0');
+        H5Lget_name_by_idx(group.id(), ".", H5_INDEX_NAME, H5_ITER_INC, n,
+                           &label[0], label.size(), H5P_DEFAULT);
+        label.resize(static_cast<size_t>(size));
+
+        data.set_block(label, Dataset<double>::read(group, label));
+    }
+}
+
+} // namespace hdf5
+
+} // namespace io
+
+} // namespace ambit
@@ -82,6 +82,12 @@ Dataspace::Dataspace(const Dimension& current_dims, const Dimension& maximum_dim
     }
 }
 
+Dataspace::Dataspace(Dataspace&& other)
+    : dataspace_id_(other.dataspace_id_)
+{
+    other.dataspace_id_ = -1;
+}
+
 Dataspace::~Dataspace()
 {
     if (dataspace_id_ >= 0)
@@ -89,6 +95,52 @@ Dataspace::~Dataspace()
     dataspace_id_ = -1;
 }
 
+Dataspace Dataspace::adopt(hid_t id)
+{
+    if (id < 0) {
+        throw std::runtime_error("Unable to get dataspace.");
+    }
+
+    Dataspace space;
+    space.dataspace_id_ = id;
+    return space;
+}
+
+Dimension Dataspace::dims() const
+{
+    int rank = H5Sget_simple_extent_ndims(dataspace_id_);
+    if (rank < 0) {
+        throw std::runtime_error("Unable to query dataspace rank.");
+    }
+
+    vector<hsize_t> cdims(rank);
+    H5Sget_simple_extent_dims(dataspace_id_, cdims.data(), nullptr);
+    return Dimension(cdims.begin(), cdims.end());
+}
+
+void Dataspace::select(const IndexRange& ranges)
+{
+    Dimension extent = dims();
+    if (ranges.size() != extent.size()) {
+        throw std::runtime_error("Hyperslab rank does not match the dataspace.");
+    }
+
+    vector<hsize_t> start, count;
+    for (size_t m = 0; m < ranges.size(); ++m) {
+        if (ranges[m].size() != 2 || ranges[m][0] > ranges[m][1] ||
+            ranges[m][1] > extent[m]) {
+            throw std::runtime_error("Hyperslab is out of the dataspace bounds.");
+        }
+        start.push_back(ranges[m][0]);
+        count.push_back(ranges[m][1] - ranges[m][0]);
+    }
+
+    if (H5Sselect_hyperslab(dataspace_id_, H5S_SELECT_SET, start.data(),
+                            nullptr, count.data(), nullptr) < 0) {
+        throw std::runtime_error("Unable to select hyperslab.");
+    }
+}
+
 } // namespace hdf5
 
 } // namespace io
@@ -28,6 +28,10 @@
  */
 
 #include <ambit/io/psi4/iwl.h>
+
+#include <algorithm>
+#include <array>
+#include <cstring>
 #include <stdexcept>
 
 namespace ambit
@@ -132,13 +136,185 @@ void IWL::read_one(File& io, const std::string& label, Tensor& tensor)
 }
 
 namespace {
-size_t position(size_t dim, short int p, short int q, short int r, short int s)
+
+/// Rows and columns of the tiles of the (pq|rs) matrix mirrored at once
+constexpr size_t mirror_tile = 32;
+
+/// Position of the canonical permutation (p >= q, r >= s, pq >= rs) of
+/// the integral (pq|rs)
+size_t canonical_position(size_t dim, size_t p, size_t q, size_t r, size_t s)
+{
+    if (p < q)
+        std::swap(p, q);
+    if (r < s)
+        std::swap(r, s);
+    if (p * dim + q < r * dim + s) {
+        std::swap(p, r);
+        std::swap(q, s);
+    }
+    return ((p * dim + q) * dim + r) * dim + s;
+}
+
+/**
+ * Fills in all 8 permutations of the integrals stored at their canonical
+ * positions in g, a dim^4 tensor seen as the matrix (pq|rs) of dim^2 rows:
+ *  1. (rs|pq) = (pq|rs): the lower triangle of the matrix is mirrored onto
+ *     the upper one, a tile at a time;
+ *  2. (pq|sr) = (pq|rs) for p >= q: the same within each row;
+ *  3. (qp|rs) = (pq|rs) for p < q: whole rows are copied.
+ * Every pass streams through g, with rows or tiles spread over threads.
+ */
+void symmetrize(double* g, size_t dim)
+{
+    size_t dim2 = dim * dim;
+
+#pragma omp parallel for schedule(dynamic, 1)
+    for (size_t I = 0; I < dim2; I += mirror_tile) {
+        size_t iend = std::min(I + mirror_tile, dim2);
+        for (size_t J = I; J < dim2; J += mirror_tile) {
+            size_t jend = std::min(J + mirror_tile, dim2);
+            for (size_t i = I; i < iend; ++i) {
+                for (size_t j = std::max(J, i + 1); j < jend; ++j)
+                    g[i * dim2 + j] = g[j * dim2 + i];
+            }
+        }
+    }
+
+#pragma omp parallel for schedule(static)
+    for (size_t pq = 0; pq < dim2; ++pq) {
+        if (pq / dim < pq % dim)
+            continue;
+        double* row = g + pq * dim2;
+        for (size_t r = 0; r < dim; ++r) {
+            for (size_t s = r + 1; s < dim; ++s)
+                row[r * dim + s] = row[s * dim + r];
+        }
+    }
+
+#pragma omp parallel for schedule(static)
+    for (size_t pq = 0; pq < dim2; ++pq) {
+        size_t p = pq / dim, q = pq % dim;
+        if (p < q)
+            std::memcpy(g + pq * dim2, g + (q * dim + p) * dim2,
+                        dim2 * sizeof(double));
+    }
+}
+}
+
+namespace {
+
+/// Marks an orbital that a target does not hold along some index
+constexpr size_t no_index = ~size_t(0);
+
+/**
+ * A block of the integrals: position[k][x] is the offset of orbital x along
+ * index k of the block (its position times the stride of the index), or
+ * no_index if the block does not hold x there.
+ */
+struct IntegralBlock
+{
+    double* data;
+    std::array<std::vector<size_t>, 4> position;
+
+    IntegralBlock(Tensor tensor,
+                  const std::array<std::vector<size_t>, 4>& orbitals)
+    {
+        if (tensor.type() != CoreTensor)
+            throw std::runtime_error("integral blocks must be CoreTensors");
+        for (size_t k = 0; k < 4; ++k) {
+            if (tensor.dim(k) != orbitals[k].size())
+                throw std::runtime_error(
+                        "tensor dimensions do not match the orbitals read");
+        }
+
+        std::vector<double>& values = tensor.data();
+        std::fill(values.begin(), values.end(), 0.0);
+        data = values.data();
+
+        size_t stride = 1;
+        for (int k = 3; k >= 0; --k) {
+            for (size_t x = 0; x < orbitals[k].size(); ++x) {
+                size_t orbital = orbitals[k][x];
+                if (orbital >= position[k].size())
+                    position[k].resize(orbital + 1, no_index);
+                position[k][orbital] = x * stride;
+            }
+            stride *= orbitals[k].size();
+        }
+    }
+
+    /// Stores (pq|rs) if the block holds it
+    void store(size_t p, size_t q, size_t r, size_t s, double value) const
+    {
+        if (p >= position[0].size() || q >= position[1].size() ||
+            r >= position[2].size() || s >= position[3].size())
+            return;
+        size_t P = position[0][p], Q = position[1][q], R = position[2][r],
+               S = position[3][s];
+        if (P != no_index && Q != no_index && R != no_index && S != no_index)
+            data[P + Q + R + S] = value;
+    }
+};
+
+/// Reads every integral of io into the blocks that hold any of its 8
+/// permutations
+void read_blocks(IWL& io, const std::vector<IntegralBlock>& blocks)
 {
-    //    return ((p * dim + q) * dim + r) * dim + s;
-    return p * dim * dim * dim + q * dim * dim + r * dim + s;
+    do {
+        for (int i = 0; i < io.nintegral; ++i) {
+            size_t p = io.p[i], q = io.q[i], r = io.r[i], s = io.s[i];
+            double value = io.values[i];
+            for (const IntegralBlock& block : blocks) {
+                block.store(p, q, r, s, value);
+                block.store(p, q, s, r, value);
+                block.store(q, p, r, s, value);
+                block.store(q, p, s, r, value);
+                block.store(r, s, p, q, value);
+                block.store(r, s, q, p, value);
+                block.store(s, r, p, q, value);
+                block.store(s, r, q, p, value);
+            }
+        }
+
+        if (io.last_buffer)
+            break;
+        io.fetch();
+    } while (1);
 }
 }
 
+void IWL::read_two(IWL& io, Tensor& tensor, const IndexRange& ranges)
+{
+    if (tensor.rank() != 4 || ranges.size() != 4)
+        throw std::runtime_error("tensor and ranges must be rank 4");
+
+    std::array<std::vector<size_t>, 4> orbitals;
+    for (size_t k = 0; k < 4; ++k) {
+        if (ranges[k].size() != 2 || ranges[k][0] > ranges[k][1])
+            throw std::runtime_error("ranges must be {begin, end} pairs");
+        for (size_t x = ranges[k][0]; x < ranges[k][1]; ++x)
+            orbitals[k].push_back(x);
+    }
+
+    read_blocks(io, {IntegralBlock(tensor, orbitals)});
+}
+
+void IWL::read_two(IWL& io, BlockedTensor& tensor)
+{
+    std::vector<IntegralBlock> blocks;
+    for (auto& key_tensor : tensor.blocks()) {
+        if (key_tensor.first.size() != 4)
+            throw std::runtime_error("blocked tensor must be rank 4");
+
+        std::array<std::vector<size_t>, 4> orbitals;
+        for (size_t k = 0; k < 4; ++k)
+            orbitals[k] = BlockedTensor::mo_space(key_tensor.first[k]).mos();
+        blocks.emplace_back(key_tensor.second, orbitals);
+    }
+
+    read_blocks(io, blocks);
+}
+
 void IWL::read_two(IWL& io, Tensor& tensor)
 {
     // ensure the tensor object is only 4D.
@@ -152,39 +328,26 @@ void IWL::read_two(IWL& io, Tensor& tensor)
                     "tensor must have equivalent length indices");
     }
 
-    // psi stores 1 of the 8 possible permutations
+    // psi stores 1 of the 8 possible permutations. Each integral is written
+    // once, at its canonical position, and the other 7 are filled in by
+    // symmetrize() rather than with 8 random writes per integral.
+    // Integrals missing from the file (below the cutoff) are zero.
 
     std::vector<double>& values = tensor.data();
+    std::fill(values.begin(), values.end(), 0.0);
 
-    size_t count = 0;
     do {
-        size_t c = 0;
-
         for (int i = 0; i < io.nintegral; ++i) {
-            short int p, q, r, s;
-            p = io.p[i];
-            q = io.q[i];
-            r = io.r[i];
-            s = io.s[i];
-
-            values[position(dim, p, q, r, s)] = io.values[i];
-            values[position(dim, p, q, s, r)] = io.values[i];
-            values[position(dim, q, p, r, s)] = io.values[i];
-            values[position(dim, q, p, s, r)] = io.values[i];
-            values[position(dim, r, s, p, q)] = io.values[i];
-            values[position(dim, r, s, q, p)] = io.values[i];
-            values[position(dim, s, r, p, q)] = io.values[i];
-            values[position(dim, s, r, q, p)] = io.values[i];
+            values[canonical_position(dim, io.p[i], io.q[i], io.r[i],
+                                      io.s[i])] = io.values[i];
         }
 
-        count += c;
-
-        values.resize(c);
-
         if (io.last_buffer)
             break;
         io.fetch();
     } while (1);
+
+    symmetrize(values.data(), dim);
 }
 }
 }
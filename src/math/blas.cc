@@ -51,6 +51,7 @@
 // => BLAS level 2/3 <=
 #define F_DGBMV FC_GLOBAL(dgbmv, DGBMV)
 #define F_DGEMM FC_GLOBAL(dgemm, DGEMM)
+#define F_DGEMM_BATCH_STRIDED FC_GLOBAL(dgemm_batch_strided, DGEMM_BATCH_STRIDED)
 #define F_DGEMV FC_GLOBAL(dgemv, DGEMV)
 #define F_DGER FC_GLOBAL(dger, DGER)
 #define F_DSBMV FC_GLOBAL(dsbmv, DSBMV)
@@ -105,6 +106,12 @@ extern void F_DGBMV(char *, int *, int *, int *, int *, double *, double *,
                     int *, double *, int *, double *, double *, int *);
 extern void F_DGEMM(char *, char *, int *, int *, int *, double *, double *,
                     int *, double *, int *, double *, double *, int *);
+#if defined(HAVE_DGEMM_BATCH_STRIDED)
+extern void F_DGEMM_BATCH_STRIDED(char *, char *, int *, int *, int *,
+                                  double *, double *, int *, int *, double *,
+                                  int *, int *, double *, double *, int *,
+                                  int *, int *);
+#endif
 extern void F_DGEMV(char *, int *, int *, double *, double *, int *, double *,
                     int *, double *, double *, int *);
 extern void F_DGER(int *, int *, double *, double *, int *, double *, int *,
@@ -141,6 +148,14 @@ extern void F_DTRSM(char *, char *, char *, char *, int *, int *, double *,
                     double *, int *, double *, int *);
 extern void F_DTRSV(char *, char *, char *, int *, double *, int *, double *,
                     int *);
+
+// => Threading of the BLAS library <=
+#if defined(HAVE_MKL_SET_NUM_THREADS_LOCAL)
+extern int mkl_set_num_threads_local(int nthreads);
+#elif defined(HAVE_OPENBLAS_SET_NUM_THREADS)
+extern int openblas_get_num_threads(void);
+extern void openblas_set_num_threads(int nthreads);
+#endif
 }
 
 namespace ambit
@@ -667,6 +682,72 @@ void C_DGEMM(char transa, char transb, int m, int n, int k, double alpha,
               &ldc);
 }
 
+/**
+ * Strided-batch variant of C_DGEMM. For each p in [0, batch)
+ *
+ *  C_p = alpha * op(A_p) * op(B_p) + beta * C_p
+ *
+ * where A_p = a + p * stridea, and likewise for B_p and C_p. All other
+ * arguments have the same (row-major) meaning as in C_DGEMM.
+ *
+ * When the linked BLAS provides dgemm_batch_strided the whole batch is
+ * handed to it; otherwise the batch is distributed over OpenMP threads with
+ * one DGEMM per slice. MKL and OpenBLAS are held to one thread of their own
+ * meanwhile, so that each slice does not start a team of BLAS threads;
+ * other threaded BLAS libraries must be linked in their sequential build.
+ **/
+void C_DGEMM_BATCH(char transa, char transb, int m, int n, int k,
+                   double alpha, double *a, int lda, size_t stridea, double *b,
+                   int ldb, size_t strideb, double beta, double *c, int ldc,
+                   size_t stridec, size_t batch)
+{
+    if (m == 0 || n == 0 || k == 0 || batch == 0)
+        return;
+
+#if defined(HAVE_DGEMM_BATCH_STRIDED)
+    if (stridea <= INT_MAX && strideb <= INT_MAX && stridec <= INT_MAX &&
+        batch <= INT_MAX)
+    {
+        int sa = stridea;
+        int sb = strideb;
+        int sc = stridec;
+        int nbatch = batch;
+        ::F_DGEMM_BATCH_STRIDED(&transb, &transa, &n, &m, &k, &alpha, b, &ldb,
+                                &sb, a, &lda, &sa, &beta, c, &ldc, &sc,
+                                &nbatch);
+        return;
+    }
+#endif
+
+#if defined(_OPENMP) && defined(HAVE_OPENBLAS_SET_NUM_THREADS)
+    // The OpenBLAS setting is global, so it is changed around the region
+    int blas_threads = ::openblas_get_num_threads();
+    ::openblas_set_num_threads(1);
+#endif
+
+#pragma omp parallel
+    {
+#if defined(_OPENMP) && defined(HAVE_MKL_SET_NUM_THREADS_LOCAL)
+        // The MKL setting is per thread, so each one sets its own
+        int blas_threads = ::mkl_set_num_threads_local(1);
+#endif
+#pragma omp for schedule(static)
+        for (size_t p = 0; p < batch; ++p)
+        {
+            ::F_DGEMM(&transb, &transa, &n, &m, &k, &alpha, b + p * strideb,
+                      &ldb, a + p * stridea, &lda, &beta, c + p * stridec,
+                      &ldc);
+        }
+#if defined(_OPENMP) && defined(HAVE_MKL_SET_NUM_THREADS_LOCAL)
+        ::mkl_set_num_threads_local(blas_threads);
+#endif
+    }
+
+#if defined(_OPENMP) && defined(HAVE_OPENBLAS_SET_NUM_THREADS)
+    ::openblas_set_num_threads(blas_threads);
+#endif
+}
+
 /**
  *  Purpose
  *  =======
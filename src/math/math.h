@@ -30,6 +30,8 @@
 #if !defined(TENSOR_MATH_H)
 #define TENSOR_MATH_H
 
+#include <cstddef>
+
 namespace ambit
 {
 
@@ -85,6 +87,10 @@ void C_DTRSM(char side, char uplo, char transa, char diag, int m, int n,
 void C_DGEMM(char transa, char transb, int m, int n, int k, double alpha,
              double *a, int lda, double *b, int ldb, double beta, double *c,
              int ldc);
+void C_DGEMM_BATCH(char transa, char transb, int m, int n, int k,
+                   double alpha, double *a, int lda, size_t stridea, double *b,
+                   int ldb, size_t strideb, double beta, double *c, int ldc,
+                   size_t stridec, size_t batch);
 void C_DSYMM(char side, char uplo, int m, int n, double alpha, double *a,
              int lda, double *b, int ldb, double beta, double *c, int ldc);
 void C_DTRMM(char side, char uplo, char transa, char diag, int m, int n,
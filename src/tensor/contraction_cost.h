@@ -0,0 +1,83 @@
+/*
+ * @BEGIN LICENSE
+ *
+ * ambit: C++ library for the implementation of tensor product calculations
+ *        through a clean, concise user interface.
+ *
+ * Copyright (c) 2014-2017 Ambit developers.
+ *
+ * The copyrights for code used from other parties are included in
+ * the corresponding files.
+ *
+ * This file is part of ambit.
+ *
+ * Ambit is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * Ambit is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License along
+ * with ambit; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * @END LICENSE
+ */
+
+#if !defined(TENSOR_CONTRACTION_COST_H)
+#define TENSOR_CONTRACTION_COST_H
+
+#include <ambit/settings.h>
+
+namespace ambit
+{
+
+/// Charge, in FLOPs, for each element moved by a permutation. A permuted
+/// element is read and written once and is bound by memory bandwidth, so it
+/// costs about as much time as a few multiply-adds.
+constexpr double permute_flops_per_element = 4.0;
+
+/** Decides between two candidate contraction orders.
+ *
+ * @param cpu cost (FLOPs plus permutation charge) of the candidate
+ * @param memory largest number of elements the candidate holds at once
+ * @param best_cpu, best_memory costs of the best order so far
+ * @return true if the candidate is better under policy.
+ *
+ * FlopsUnderMemoryCap prefers orders whose memory fits in
+ * settings::memory_limit; among orders that all exceed it, the one needing
+ * the least memory wins.
+ */
+inline bool better_contraction_cost(double cpu, double memory,
+                                    double best_cpu, double best_memory,
+                                    ContractionPolicy policy)
+{
+    switch (policy)
+    {
+    case MinimumMemory:
+        return memory < best_memory ||
+               (memory == best_memory && cpu < best_cpu);
+    case FlopsUnderMemoryCap:
+    {
+        double cap = static_cast<double>(settings::memory_limit) /
+                     static_cast<double>(sizeof(double));
+        bool fits = memory <= cap;
+        bool best_fits = best_memory <= cap;
+        if (fits != best_fits)
+            return fits;
+        if (!fits)
+            return memory < best_memory ||
+                   (memory == best_memory && cpu < best_cpu);
+        return cpu < best_cpu || (cpu == best_cpu && memory < best_memory);
+    }
+    case MinimumFlops:
+    default:
+        return cpu < best_cpu || (cpu == best_cpu && memory < best_memory);
+    }
+}
+}
+
+#endif
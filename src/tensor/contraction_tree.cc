@@ -0,0 +1,521 @@
+/*
+ * @BEGIN LICENSE
+ *
+ * ambit: C++ library for the implementation of tensor product calculations
+ *        through a clean, concise user interface.
+ *
+ * Copyright (c) 2014-2017 Ambit developers.
+ *
+ * The copyrights for code used from other parties are included in
+ * the corresponding files.
+ *
+ * This file is part of ambit.
+ *
+ * Ambit is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * Ambit is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License along
+ * with ambit; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * @END LICENSE
+ */
+
+#include <ambit/tensor.h>
+
+#include "contraction_cost.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <numeric>
+#include <stdexcept>
+#include <string>
+
+namespace ambit
+{
+
+namespace
+{
+
+typedef uint64_t IndexMask;
+
+// Most terms ordered by exhaustive search, whatever
+// settings::contraction_search_limit says: the search keeps 2^n subsets
+constexpr int max_search_terms = 20;
+
+// Indices as numbers into an IndexSpace
+typedef vector<int> Order;
+
+// Distinct indices of a contraction, numbered so that sets of them fit in
+// an IndexMask.
+class IndexSpace
+{
+  public:
+    bool add(const string &label, size_t dim)
+    {
+        if (id(label) >= 0)
+            return true;
+        if (labels_.size() == 64)
+            return false;
+        labels_.push_back(label);
+        dims_.push_back(static_cast<double>(dim));
+        return true;
+    }
+
+    int id(const string &label) const
+    {
+        auto it = std::find(labels_.begin(), labels_.end(), label);
+        return it == labels_.end() ? -1 : static_cast<int>(it - labels_.begin());
+    }
+
+    // Numbers of the known labels in indices
+    Order order(const Indices &indices) const
+    {
+        Order result;
+        for (const string &label : indices)
+            if (id(label) >= 0)
+                result.push_back(id(label));
+        return result;
+    }
+
+    Indices labels(const Order &order) const
+    {
+        Indices result;
+        for (int i : order)
+            result.push_back(labels_[i]);
+        return result;
+    }
+
+    // Number of elements spanned by the indices in m
+    double size(IndexMask m) const
+    {
+        double value = 1.0;
+        while (m != 0)
+        {
+            value *= dims_[__builtin_ctzll(m)];
+            m &= m - 1;
+        }
+        return value;
+    }
+
+  private:
+    Indices labels_;
+    vector<double> dims_;
+};
+
+IndexMask mask_of(const Order &order)
+{
+    IndexMask m = 0;
+    for (int i : order)
+        m |= IndexMask(1) << i;
+    return m;
+}
+
+bool in(IndexMask m, int i) { return (m & (IndexMask(1) << i)) != 0; }
+
+// Order of the intermediate of left and right carrying keep: shared
+// indices first, then those of left, then those of right.
+Order join_order(const Order &left, const Order &right, IndexMask keep)
+{
+    IndexMask lmask = mask_of(left);
+    IndexMask rmask = mask_of(right);
+    Order result;
+    for (int i : left)
+        if (in(rmask & keep, i))
+            result.push_back(i);
+    for (int i : left)
+        if (in(~rmask & keep, i))
+            result.push_back(i);
+    for (int i : right)
+        if (in(~lmask & keep, i))
+            result.push_back(i);
+    return result;
+}
+
+// Whether order is the concatenation head + (a + b or b + a)
+bool blocked_as(const Order &order, const Order &head, const Order &a,
+                const Order &b)
+{
+    if (order.size() != head.size() + a.size() + b.size())
+        return false;
+    if (!std::equal(head.begin(), head.end(), order.begin()))
+        return false;
+    auto rest = order.begin() + head.size();
+    if (std::equal(a.begin(), a.end(), rest) &&
+        std::equal(b.begin(), b.end(), rest + a.size()))
+        return true;
+    return std::equal(b.begin(), b.end(), rest) &&
+           std::equal(a.begin(), a.end(), rest + b.size());
+}
+
+struct StepCost
+{
+    double flops;
+    // Elements moved by permutations
+    double traffic;
+    // Elements held by both operands and the result
+    double memory;
+
+    double cpu() const { return flops + permute_flops_per_element * traffic; }
+};
+
+// Cost of C = L * R. An operand is permuted unless it already is a
+// Hadamard block followed by its fixed and contracted blocks (either way
+// round) in the order GEMM needs.
+StepCost step_cost(const IndexSpace &space, const Order &L, const Order &R,
+                   const Order &C)
+{
+    IndexMask lmask = mask_of(L);
+    IndexMask rmask = mask_of(R);
+    IndexMask cmask = mask_of(C);
+
+    Order hadamard, lfixed, rfixed, contracted;
+    for (int i : C)
+    {
+        if (in(lmask & rmask, i))
+            hadamard.push_back(i);
+        else if (in(lmask, i))
+            lfixed.push_back(i);
+        else
+            rfixed.push_back(i);
+    }
+    for (int i : L)
+        if (in(rmask & ~cmask, i))
+            contracted.push_back(i);
+
+    StepCost cost;
+    cost.flops = 2.0 * space.size(lmask | rmask);
+    cost.traffic = 0.0;
+    if (!blocked_as(L, hadamard, lfixed, contracted))
+        cost.traffic += space.size(lmask);
+    if (!blocked_as(R, hadamard, rfixed, contracted))
+        cost.traffic += space.size(rmask);
+    // The result is permuted into place and, when accumulating, out of it
+    if (!blocked_as(C, hadamard, lfixed, rfixed))
+        cost.traffic += 2.0 * space.size(cmask);
+    cost.memory = space.size(lmask) + space.size(rmask) + space.size(cmask);
+    return cost;
+}
+
+// A subset of the terms, evaluated to a single intermediate
+struct Group
+{
+    // Terms in the group, as bits
+    uint64_t terms;
+    // Indices of the intermediate
+    Order order;
+    // Node of the tree producing the group
+    int node;
+};
+
+class ContractionSearch
+{
+  public:
+    // With a null result, the last contraction produces its indices in the
+    // same order as any intermediate.
+    ContractionSearch(const vector<LabeledTensor> &tensors,
+                      const Indices *result, ContractionTree &tree)
+        : tree_(tree), has_result_(result != nullptr)
+    {
+        tree_.flops = tree_.traffic = 0.0;
+        tree_.cpu_cost = tree_.memory_cost = 0.0;
+
+        for (const LabeledTensor &ti : tensors)
+        {
+            for (size_t i = 0; i < ti.indices().size(); ++i)
+                if (!space_.add(ti.indices()[i], ti.T().dim(i)))
+                    throw std::runtime_error("Contractions with more than 64 "
+                                             "distinct indices are not "
+                                             "supported.");
+        }
+        for (const LabeledTensor &ti : tensors)
+        {
+            terms_.push_back(space_.order(ti.indices()));
+            term_masks_.push_back(mask_of(terms_.back()));
+
+            ContractionTree::Node leaf;
+            leaf.left = leaf.right = -1;
+            leaf.indices = ti.indices();
+            tree_.nodes.push_back(leaf);
+        }
+        all_terms_ = (terms_.size() == 64)
+                         ? ~uint64_t(0)
+                         : (uint64_t(1) << terms_.size()) - 1;
+
+        if (has_result_)
+        {
+            result_ = space_.order(*result);
+            result_mask_ = mask_of(result_);
+        }
+        else
+        {
+            // Take the result to carry every index found in a single term
+            result_mask_ = 0;
+            IndexMask seen = 0;
+            for (IndexMask m : term_masks_)
+            {
+                result_mask_ = (result_mask_ & ~m) | (m & ~seen);
+                seen |= m;
+            }
+        }
+    }
+
+    size_t nterms() const { return terms_.size(); }
+
+    Group leaf(size_t t) const
+    {
+        Group group;
+        group.terms = uint64_t(1) << t;
+        group.order = terms_[t];
+        group.node = static_cast<int>(t);
+        return group;
+    }
+
+    // Indices of the intermediate of the terms in group that are needed by
+    // the other terms or by the result
+    IndexMask kept(uint64_t group) const
+    {
+        IndexMask inside = 0, outside = result_mask_;
+        for (size_t t = 0; t < terms_.size(); t++)
+        {
+            if ((group >> t) & 1)
+                inside |= term_masks_[t];
+            else
+                outside |= term_masks_[t];
+        }
+        return inside & outside;
+    }
+
+    // Indices of the contraction of two groups
+    Order joined_order(uint64_t terms, const Order &left,
+                       const Order &right) const
+    {
+        if (terms == all_terms_ && has_result_)
+            return result_;
+        return join_order(left, right, kept(terms));
+    }
+
+    StepCost cost(const Order &left, const Order &right,
+                  const Order &joined) const
+    {
+        return step_cost(space_, left, right, joined);
+    }
+
+    // Appends the contraction of two groups to the tree
+    Group join(const Group &left, const Group &right)
+    {
+        Group joined;
+        joined.terms = left.terms | right.terms;
+        joined.order = joined_order(joined.terms, left.order, right.order);
+
+        StepCost step = cost(left.order, right.order, joined.order);
+        tree_.flops += step.flops;
+        tree_.traffic += step.traffic;
+        tree_.cpu_cost += step.cpu();
+        tree_.memory_cost = std::max(tree_.memory_cost, step.memory);
+
+        ContractionTree::Node node;
+        node.left = left.node;
+        node.right = right.node;
+        node.indices = space_.labels(joined.order);
+        tree_.nodes.push_back(node);
+        joined.node = static_cast<int>(tree_.nodes.size()) - 1;
+        return joined;
+    }
+
+    // Contracts the terms in the given order, left to right
+    void chain(const vector<size_t> &perm)
+    {
+        Group group = leaf(perm[0]);
+        for (size_t i = 1; i < perm.size(); i++)
+            group = join(group, leaf(perm[i]));
+    }
+
+    // Repeatedly contracts the cheapest pair of groups
+    void greedy(ContractionPolicy policy)
+    {
+        vector<Group> groups;
+        for (size_t t = 0; t < nterms(); t++)
+            groups.push_back(leaf(t));
+
+        while (groups.size() > 1)
+        {
+            size_t best_i = 0, best_j = 1;
+            double best_cpu = std::numeric_limits<double>::max();
+            double best_memory = std::numeric_limits<double>::max();
+            double best_size = std::numeric_limits<double>::max();
+            for (size_t i = 0; i < groups.size(); i++)
+            {
+                for (size_t j = i + 1; j < groups.size(); j++)
+                {
+                    const Order &L = groups[i].order;
+                    const Order &R = groups[j].order;
+                    Order joined =
+                        joined_order(groups[i].terms | groups[j].terms, L, R);
+                    StepCost step = cost(L, R, joined);
+                    // Ties go to the pair leaving the smaller intermediate
+                    double size = space_.size(mask_of(joined));
+                    bool better =
+                        better_contraction_cost(step.cpu(), step.memory,
+                                                best_cpu, best_memory, policy);
+                    bool worse =
+                        better_contraction_cost(best_cpu, best_memory,
+                                                step.cpu(), step.memory, policy);
+                    if (better || (!worse && size < best_size))
+                    {
+                        best_i = i;
+                        best_j = j;
+                        best_cpu = step.cpu();
+                        best_memory = step.memory;
+                        best_size = size;
+                    }
+                }
+            }
+            groups[best_i] = join(groups[best_i], groups[best_j]);
+            groups.erase(groups.begin() + best_j);
+        }
+    }
+
+    // Finds the best tree by dynamic programming over subsets of terms,
+    // then emits it. Each subset keeps only its best split (and the index
+    // order that split produces).
+    void optimal(ContractionPolicy policy)
+    {
+        size_t nsets = size_t(1) << nterms();
+
+        vector<double> cpu(nsets, 0.0);
+        vector<double> memory(nsets, 0.0);
+        vector<uint64_t> split(nsets, 0);
+        vector<Order> order(nsets);
+
+        for (uint64_t set = 1; set < nsets; set++)
+        {
+            if ((set & (set - 1)) == 0)
+            {
+                order[set] = terms_[__builtin_ctzll(set)];
+                continue;
+            }
+
+            cpu[set] = std::numeric_limits<double>::max();
+            memory[set] = std::numeric_limits<double>::max();
+            // Every split is visited once: the left part holds the lowest
+            // term
+            uint64_t lowbit = set & (~set + 1);
+            for (uint64_t left = (set - 1) & set; left != 0;
+                 left = (left - 1) & set)
+            {
+                if ((left & lowbit) == 0)
+                    continue;
+                uint64_t right = set ^ left;
+                Order joined = joined_order(set, order[left], order[right]);
+                StepCost step = cost(order[left], order[right], joined);
+                double c = cpu[left] + cpu[right] + step.cpu();
+                double m = std::max({memory[left], memory[right], step.memory});
+                if (better_contraction_cost(c, m, cpu[set], memory[set],
+                                            policy))
+                {
+                    cpu[set] = c;
+                    memory[set] = m;
+                    split[set] = left;
+                    order[set] = joined;
+                }
+            }
+        }
+
+        std::function<Group(uint64_t)> emit = [&](uint64_t set) -> Group {
+            if ((set & (set - 1)) == 0)
+                return leaf(__builtin_ctzll(set));
+            Group left = emit(split[set]);
+            Group right = emit(set ^ split[set]);
+            return join(left, right);
+        };
+        emit(nsets - 1);
+    }
+
+  private:
+    ContractionTree &tree_;
+    IndexSpace space_;
+    vector<Order> terms_;
+    vector<IndexMask> term_masks_;
+    uint64_t all_terms_;
+    bool has_result_;
+    Order result_;
+    IndexMask result_mask_;
+};
+
+void append_node(const ContractionTree &tree, size_t node, string &out)
+{
+    if (tree.is_leaf(node))
+    {
+        out += std::to_string(node);
+        return;
+    }
+    out += "(";
+    append_node(tree, tree.nodes[node].left, out);
+    out += " * ";
+    append_node(tree, tree.nodes[node].right, out);
+    out += ")";
+}
+
+void check_term_count(size_t nterms)
+{
+    if (nterms < 2)
+        throw std::runtime_error(
+            "A contraction needs at least two tensors to be ordered.");
+    if (nterms > 64)
+        throw std::runtime_error(
+            "Contractions of more than 64 tensors are not supported.");
+}
+} // namespace
+
+string ContractionTree::str() const
+{
+    string out;
+    if (!nodes.empty())
+        append_node(*this, nodes.size() - 1, out);
+    return out;
+}
+
+ContractionTree
+LabeledTensorContraction::contraction_tree(const Indices &result,
+                                           bool optimize,
+                                           ContractionPolicy policy) const
+{
+    check_term_count(tensors_.size());
+
+    ContractionTree tree;
+    ContractionSearch search(tensors_, &result, tree);
+    if (!optimize)
+    {
+        vector<size_t> perm(tensors_.size());
+        std::iota(perm.begin(), perm.end(), 0);
+        search.chain(perm);
+    }
+    else if (static_cast<int>(tensors_.size()) <=
+             std::min(settings::contraction_search_limit, max_search_terms))
+        search.optimal(policy);
+    else
+        search.greedy(policy);
+
+    return tree;
+}
+
+pair<double, double> LabeledTensorContraction::compute_contraction_cost(
+    const vector<size_t> &perm) const
+{
+    check_term_count(tensors_.size());
+
+    ContractionTree tree;
+    ContractionSearch search(tensors_, nullptr, tree);
+    search.chain(perm);
+    return std::make_pair(tree.cpu_cost, tree.memory_cost);
+}
+}
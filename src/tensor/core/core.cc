@@ -31,15 +31,22 @@
 #include <numeric>
 
 #include "core.h"
+#include "scratch.h"
+#include "transpose.h"
+#include "tensor/disk/disk.h"
 #include "math/math.h"
 #include "tensor/indices.h"
 #include <algorithm>
+#include <ambit/memory.h>
 #include <ambit/print.h>
 #include <ambit/timer.h>
+#include <chrono>
 #include <cmath>
 #include <limits>
+#include <mutex>
 #include <stdexcept>
 #include <string.h>
+#include <unordered_map>
 
 //#include <boost/timer/timer.hpp>
 
@@ -49,7 +56,27 @@ namespace ambit
 CoreTensorImpl::CoreTensorImpl(const string &name, const Dimension &dims)
     : TensorImpl(CoreTensor, name, dims)
 {
-    data_.resize(numel(), 0L);
+    track_storage(numel() * sizeof(double));
+    try
+    {
+        data_.resize(numel(), 0L);
+    }
+    catch (...)
+    {
+        track_storage(0);
+        throw;
+    }
+}
+
+CoreTensorImpl::~CoreTensorImpl() { track_storage(0); }
+
+void CoreTensorImpl::track_storage(size_t bytes)
+{
+    if (bytes > tracked_bytes_)
+        memory::allocate(CoreTensor, bytes - tracked_bytes_);
+    else if (bytes < tracked_bytes_)
+        memory::release(CoreTensor, tracked_bytes_ - bytes);
+    tracked_bytes_ = bytes;
 }
 
 void CoreTensorImpl::reshape(const Dimension &dims)
@@ -66,6 +93,7 @@ void CoreTensorImpl::resize(const Dimension &dims, bool trim)
     // capacity to numel (or greater).
     if (numel() > data_.size())
     {
+        track_storage(std::max(numel(), data_.capacity()) * sizeof(double));
         data_.reserve(numel());
     }
     else if ((numel() < data_.size()) and trim)
@@ -173,30 +201,287 @@ std::string describe_contraction(ConstTensorImplPtr C, const Indices &Cinds,
     return buffer.str();
 }
 
-} // anonymous namespace
+// Per-slice GEMM work (2mnk) below which a Hadamard batch is distributed
+// over P rather than handed to a threaded BLAS one slice at a time.
+constexpr double batched_gemm_flop_threshold = 2.0 * 128 * 128 * 128;
 
-void CoreTensorImpl::contract(ConstTensorImplPtr A, ConstTensorImplPtr B,
-                              const Indices &Cinds, const Indices &Ainds,
-                              const Indices &Binds, double alpha, double beta)
+/// x = beta * x for a unit-stride vector, without reading x when beta is
+/// zero (x may then be uninitialized scratch)
+void scale_slice(size_t n, double beta, double *x)
 {
-    shared_ptr<TensorImpl> A2;
-    shared_ptr<TensorImpl> B2;
-    shared_ptr<TensorImpl> C2;
-    contract(A, B, Cinds, Ainds, Binds, A2, B2, C2, alpha, beta);
+    if (beta == 0.0)
+        std::fill(x, x + n, 0.0);
+    else
+        C_DSCAL(n, beta, x, 1);
 }
 
-void CoreTensorImpl::contract(ConstTensorImplPtr A, ConstTensorImplPtr B,
-                              const Indices &Cinds, const Indices &Ainds,
-                              const Indices &Binds,
-                              std::shared_ptr<TensorImpl> &A2,
-                              std::shared_ptr<TensorImpl> &B2,
-                              std::shared_ptr<TensorImpl> &C2, double alpha,
-                              double beta)
+/**
+ * Perform a single Hadamard slice of a contraction,
+ *
+ *  C = alpha * op(L) * op(R) + beta * C
+ *
+ * where op(L) is nrow x nzip and op(R) is nzip x ncol, choosing the BLAS
+ * level from the slice shape.
+ **/
+void contract_slice(char transL, char transR, size_t nrow, size_t ncol,
+                    size_t nzip, double alpha, double *Lp, size_t ldaL,
+                    double *Rp, size_t ldaR, double beta, double *C2p,
+                    size_t ldaC)
+{
+    if (nrow != 1L)
+    {
+        if (ncol != 1L)
+        {
+            if (nzip != 1L)
+            {
+                C_DGEMM(transL, transR, nrow, ncol, nzip, alpha, Lp, ldaL, Rp,
+                        ldaR, beta, C2p, ldaC);
+            }
+            else
+            {
+                for (size_t row = 0L; row < nrow; row++)
+                {
+                    scale_slice(ncol, beta, C2p + row * ldaC);
+                }
+                C_DGER(nrow, ncol, alpha, Lp, 1, Rp, 1, C2p, ldaC);
+            }
+        }
+        else
+        {
+            if (nzip != 1L)
+            {
+                if (transL == 'N')
+                {
+                    C_DGEMV('N', nrow, nzip, alpha, Lp, ldaL, Rp, 1, beta, C2p,
+                            1);
+                }
+                else
+                {
+                    C_DGEMV('T', nzip, nrow, alpha, Lp, ldaL, Rp, 1, beta, C2p,
+                            1);
+                }
+            }
+            else
+            {
+                scale_slice(nrow, beta, C2p);
+                C_DAXPY(nrow, alpha * (*Rp), Lp, 1, C2p, 1);
+            }
+        }
+    }
+    else
+    {
+        if (ncol != 1L)
+        {
+            if (nzip != 1L)
+            {
+                if (transR == 'N')
+                {
+                    C_DGEMV('T', nzip, ncol, alpha, Rp, ldaR, Lp, 1, beta, C2p,
+                            1);
+                }
+                else
+                {
+                    C_DGEMV('N', ncol, nzip, alpha, Rp, ldaR, Lp, 1, beta, C2p,
+                            1);
+                }
+            }
+            else
+            {
+                scale_slice(ncol, beta, C2p);
+                C_DAXPY(ncol, alpha * (*Lp), Rp, 1, C2p, 1);
+            }
+        }
+        else
+        {
+            if (nzip != 1L)
+            {
+                (*C2p) = (beta == 0.0 ? 0.0 : beta * (*C2p));
+                (*C2p) += alpha * C_DDOT(nzip, Lp, 1, Rp, 1);
+            }
+            else
+            {
+                (*C2p) = alpha * (*Lp) * (*Rp) +
+                         (beta == 0.0 ? 0.0 : beta * (*C2p));
+            }
+        }
+    }
+}
+
+/// Strides of a source tensor (labeled Ainds, dimensions Adims) for each
+/// index of the target ordering Cinds, as expected by permute_data
+vector<size_t> permutation_strides(const Dimension &Adims,
+                                   const Indices &Cinds, const Indices &Ainds)
+{
+    vector<size_t> order = indices::permutation_order(Cinds, Ainds);
+
+    vector<size_t> Astrides(Adims.size(), 1L);
+    for (int dim = ((int)Adims.size()) - 2; dim >= 0; dim--)
+    {
+        Astrides[dim] = Astrides[dim + 1] * Adims[dim + 1];
+    }
+
+    vector<size_t> AstridesC(order.size(), 0L);
+    for (size_t dim = 0; dim < order.size(); dim++)
+    {
+        AstridesC[dim] = Astrides[order[dim]];
+    }
+    return AstridesC;
+}
+
+/// Storage for a permuted contraction operand: the caller's tensor when a
+/// holder is supplied (allocated on first use), otherwise an uninitialized
+/// lease from the scratch arena of this thread
+double *operand_buffer(shared_ptr<TensorImpl> *holder, ScratchBuffer &scratch,
+                       const string &name, const Dimension &dims)
 {
-    ambit::timer::timer_push("pre-BLAS: internal overhead");
+    if (holder == nullptr)
+    {
+        size_t numel = 1L;
+        for (size_t dim : dims)
+            numel *= dim;
+        scratch = ScratchArena::instance().acquire(numel);
+        return scratch.data();
+    }
 
-    TensorImplPtr C = this;
+    if (!*holder)
+        *holder = std::make_shared<CoreTensorImpl>(name, dims);
+    return (*holder)->data().data();
+}
 
+/**
+ * Everything CoreTensorImpl::contract derives from the index labels and
+ * dimensions of its operands: which operands are permuted (and how), and
+ * the shape of the GEMM performed for each Hadamard slice.
+ **/
+struct ContractionPlan
+{
+    /// The labels and dimensions this plan was built for
+    Indices Cinds;
+    Indices Ainds;
+    Indices Binds;
+    Dimension Cdims;
+    Dimension Adims;
+    Dimension Bdims;
+
+    /// Permutations into GEMM order (strides of the source for each index
+    /// of the target, see permute_data)
+    bool permC;
+    bool permA;
+    bool permB;
+    Indices Cinds2;
+    Indices Ainds2;
+    Indices Binds2;
+    Dimension Cdims2;
+    Dimension Adims2;
+    Dimension Bdims2;
+    vector<size_t> C_to_C2;
+    vector<size_t> C2_to_C;
+    vector<size_t> A_to_A2;
+    vector<size_t> B_to_B2;
+
+    /// GEMM shape of each Hadamard slice (L and R are A and B, or B and A
+    /// when C is transposed)
+    size_t ABC_size;
+    char transL;
+    char transR;
+    size_t nrow;
+    size_t ncol;
+    size_t nzip;
+    size_t ldaL;
+    size_t ldaR;
+    size_t ldaC;
+    bool L_is_A;
+    size_t strideC;
+    size_t strideA;
+    size_t strideB;
+
+    bool matches(const Indices &Cinds_, const Indices &Ainds_,
+                 const Indices &Binds_, const Dimension &Cdims_,
+                 const Dimension &Adims_, const Dimension &Bdims_) const
+    {
+        return Cdims == Cdims_ && Adims == Adims_ && Bdims == Bdims_ &&
+               Cinds == Cinds_ && Ainds == Ainds_ && Binds == Binds_;
+    }
+};
+
+/**
+ * Process-wide cache of contraction plans keyed on the index labels and
+ * dimensions of the operands. When it grows past max_plans it is simply
+ * emptied; iterative codes repopulate their working set on the next pass.
+ **/
+class ContractionPlanCache
+{
+  public:
+    static constexpr size_t max_plans = 4096;
+
+    static size_t hash(const Indices &Cinds, const Indices &Ainds,
+                       const Indices &Binds, const Dimension &Cdims,
+                       const Dimension &Adims, const Dimension &Bdims)
+    {
+        size_t seed = 0L;
+        auto combine = [&seed](size_t value) {
+            seed ^= value + 0x9e3779b97f4a7c15UL + (seed << 6) + (seed >> 2);
+        };
+        std::hash<string> hash_string;
+        for (const Indices *inds : {&Cinds, &Ainds, &Binds})
+        {
+            combine(inds->size());
+            for (const string &index : *inds)
+                combine(hash_string(index));
+        }
+        for (const Dimension *dims : {&Cdims, &Adims, &Bdims})
+        {
+            for (size_t dim : *dims)
+                combine(dim);
+        }
+        return seed;
+    }
+
+    shared_ptr<const ContractionPlan>
+    find(size_t key, const Indices &Cinds, const Indices &Ainds,
+         const Indices &Binds, const Dimension &Cdims, const Dimension &Adims,
+         const Dimension &Bdims)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto range = plans_.equal_range(key);
+        for (auto it = range.first; it != range.second; ++it)
+        {
+            if (it->second->matches(Cinds, Ainds, Binds, Cdims, Adims, Bdims))
+                return it->second;
+        }
+        return nullptr;
+    }
+
+    void insert(size_t key, shared_ptr<const ContractionPlan> plan)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (plans_.size() >= max_plans)
+            plans_.clear();
+        plans_.emplace(key, plan);
+    }
+
+  private:
+    std::mutex mutex_;
+    std::unordered_multimap<size_t, shared_ptr<const ContractionPlan>> plans_;
+};
+
+ContractionPlanCache &contraction_plan_cache()
+{
+    static ContractionPlanCache cache;
+    return cache;
+}
+
+/**
+ * Performs the index analysis of a contraction: classifies every index as
+ * Hadamard (P), left (i), right (j) or contracted (k), decides which of the
+ * operands must be permuted into GEMM order, and derives the GEMM shape.
+ **/
+shared_ptr<const ContractionPlan>
+build_contraction_plan(ConstTensorImplPtr C, ConstTensorImplPtr A,
+                       ConstTensorImplPtr B, const Indices &Cinds,
+                       const Indices &Ainds, const Indices &Binds,
+                       double alpha, double beta)
+{
     // => Permutation Logic <= //
 
     // Determine unique indices
@@ -490,789 +775,497 @@ void CoreTensorImpl::contract(ConstTensorImplPtr A, ConstTensorImplPtr B,
         Binds2 = Binds;
     }
 
-    // So what exactly happened?
-    /**
-    printf("==> Core Contraction <==\n\n");
-    printf("Original: C[");
-    for (size_t ind = 0l; ind < Cinds.size(); ind++) {
-        printf("%s", Cinds[ind].c_str());
+    // => GEMM Indexing <= //
+
+    char transL;
+    char transR;
+    size_t nrow;
+    size_t ncol;
+    size_t ldaL;
+    size_t ldaR;
+    bool L_is_A;
+
+    if (C_transpose)
+    {
+        L_is_A = false;
+        nrow = BC_size;
+        ncol = AC_size;
+        transL = (B_transpose ? 'N' : 'T');
+        transR = (A_transpose ? 'N' : 'T');
+        ldaL = (B_transpose ? AB_size : BC_size);
+        ldaR = (A_transpose ? AC_size : AB_size);
     }
-    printf("] = A[");
-    for (size_t ind = 0l; ind < Ainds.size(); ind++) {
-        printf("%s", Ainds[ind].c_str());
+    else
+    {
+        L_is_A = true;
+        nrow = AC_size;
+        ncol = BC_size;
+        transL = (A_transpose ? 'T' : 'N');
+        transR = (B_transpose ? 'T' : 'N');
+        ldaL = (A_transpose ? AC_size : AB_size);
+        ldaR = (B_transpose ? AB_size : BC_size);
     }
-    printf("] * B[");
-    for (size_t ind = 0l; ind < Binds.size(); ind++) {
-        printf("%s", Binds[ind].c_str());
+
+    size_t nzip = AB_size;
+    size_t ldaC = (C_transpose ? AC_size : BC_size);
+
+    // => Finalize the Plan <= //
+
+    auto plan = std::make_shared<ContractionPlan>();
+    plan->Cinds = Cinds;
+    plan->Ainds = Ainds;
+    plan->Binds = Binds;
+    plan->Cdims = C->dims();
+    plan->Adims = A->dims();
+    plan->Bdims = B->dims();
+
+    plan->permC = permC;
+    plan->permA = permA;
+    plan->permB = permB;
+    plan->Cinds2 = Cinds2;
+    plan->Ainds2 = Ainds2;
+    plan->Binds2 = Binds2;
+    if (permC)
+    {
+        plan->Cdims2 = indices::permuted_dimension(C->dims(), Cinds2, Cinds);
+        plan->C_to_C2 = permutation_strides(C->dims(), Cinds2, Cinds);
+        plan->C2_to_C = permutation_strides(plan->Cdims2, Cinds, Cinds2);
     }
-    printf("]\n");
-    printf("New:      C[");
-    for (size_t ind = 0l; ind < Cinds2.size(); ind++) {
-        printf("%s", Cinds2[ind].c_str());
+    if (permA)
+    {
+        plan->Adims2 = indices::permuted_dimension(A->dims(), Ainds2, Ainds);
+        plan->A_to_A2 = permutation_strides(A->dims(), Ainds2, Ainds);
     }
-    printf("] = A[");
-    for (size_t ind = 0l; ind < Ainds2.size(); ind++) {
-        printf("%s", Ainds2[ind].c_str());
+    if (permB)
+    {
+        plan->Bdims2 = indices::permuted_dimension(B->dims(), Binds2, Binds);
+        plan->B_to_B2 = permutation_strides(B->dims(), Binds2, Binds);
     }
-    printf("] * B[");
-    for (size_t ind = 0l; ind < Binds2.size(); ind++) {
-        printf("%s", Binds2[ind].c_str());
+
+    plan->ABC_size = ABC_size;
+    plan->transL = transL;
+    plan->transR = transR;
+    plan->nrow = nrow;
+    plan->ncol = ncol;
+    plan->nzip = nzip;
+    plan->ldaL = ldaL;
+    plan->ldaR = ldaR;
+    plan->ldaC = ldaC;
+    plan->L_is_A = L_is_A;
+    plan->strideC = AC_size * BC_size;
+    plan->strideA = AB_size * AC_size;
+    plan->strideB = AB_size * BC_size;
+
+    return plan;
+}
+
+} // anonymous namespace
+
+void CoreTensorImpl::contract(ConstTensorImplPtr A, ConstTensorImplPtr B,
+                              const Indices &Cinds, const Indices &Ainds,
+                              const Indices &Binds, double alpha, double beta)
+{
+    // Operands on disk are streamed through core in tiles, unless mapped
+    if (!direct_data(A) || !direct_data(B))
+    {
+        contract_tiled(this, A, B, Cinds, Ainds, Binds, alpha, beta);
+        return;
+    }
+    contract_direct(this, A, B, Cinds, Ainds, Binds, nullptr, nullptr, nullptr,
+                    alpha, beta);
+}
+
+void CoreTensorImpl::contract(ConstTensorImplPtr A, ConstTensorImplPtr B,
+                              const Indices &Cinds, const Indices &Ainds,
+                              const Indices &Binds,
+                              std::shared_ptr<TensorImpl> &A2,
+                              std::shared_ptr<TensorImpl> &B2,
+                              std::shared_ptr<TensorImpl> &C2, double alpha,
+                              double beta)
+{
+    if (!direct_data(A) || !direct_data(B))
+    {
+        contract_tiled(this, A, B, Cinds, Ainds, Binds, alpha, beta);
+        return;
     }
-    printf("]\n");
-    printf("C Permuted: %s\n", permC ? "Yes" : "No");
-    printf("A Permuted: %s\n", permA ? "Yes" : "No");
-    printf("B Permuted: %s\n", permB ? "Yes" : "No");
-    printf("\n");
-    **/
+    contract_direct(this, A, B, Cinds, Ainds, Binds, &A2, &B2, &C2, alpha,
+                    beta);
+}
+
+double *direct_data(ConstTensorImplPtr T)
+{
+    if (T->type() == CoreTensor)
+        return const_cast<CoreTensorImplPtr>(
+                   static_cast<ConstCoreTensorImplPtr>(T))
+            ->data()
+            .data();
+    if (T->type() == DiskTensor)
+        return static_cast<ConstDiskTensorImplPtr>(T)->mapping();
+    return nullptr;
+}
+
+namespace
+{
+
+/// Passes an access hint on to T if it is a mapped disk tensor
+void advise(ConstTensorImplPtr T, DiskAccess access)
+{
+    if (T->type() == DiskTensor)
+        static_cast<ConstDiskTensorImplPtr>(T)->advise(access);
+}
+
+/// Sequential if A is walked in storage order by a permutation with
+/// strides AstridesC, random otherwise
+DiskAccess permute_access(const vector<size_t> &AstridesC)
+{
+    return AstridesC.empty() || AstridesC.back() == 1L ? SequentialAccess
+                                                       : RandomAccess;
+}
+}
+
+namespace
+{
+// Interned ids of the timers of the core kernels, looked up once. Per-call
+// details (names, indices, factors) go to the contraction log instead.
+struct KernelTimers
+{
+    size_t overhead = timer::timer_id("pre-BLAS: internal overhead");
+    size_t C_allocation = timer::timer_id("pre-BLAS: internal C allocation");
+    size_t C_permutation = timer::timer_id("pre-BLAS: internal C permutation");
+    size_t A_allocation = timer::timer_id("pre-BLAS: internal A allocation");
+    size_t A_permutation = timer::timer_id("pre-BLAS: internal A permutation");
+    size_t B_allocation = timer::timer_id("pre-BLAS: internal B allocation");
+    size_t B_permutation = timer::timer_id("pre-BLAS: internal B permutation");
+    size_t blas = timer::timer_id("BLAS");
+    size_t C_unpermutation =
+        timer::timer_id("post-BLAS: internal C permutation");
+    size_t permute = timer::timer_id("permute");
+    size_t permute_sum = timer::timer_id("permute_sum");
+};
+
+const KernelTimers &kernel_timers()
+{
+    static const KernelTimers timers;
+    return timers;
+}
+
+double seconds_since(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                         start)
+        .count();
+}
 
-    ambit::timer::timer_pop();
+string labeled_name(ConstTensorImplPtr T, const Indices &inds)
+{
+    return T->name() + "[" + indices::to_string(inds) + "]";
+}
+}
+
+void contract_direct(TensorImplPtr C, ConstTensorImplPtr A,
+                     ConstTensorImplPtr B, const Indices &Cinds,
+                     const Indices &Ainds, const Indices &Binds,
+                     std::shared_ptr<TensorImpl> *A2,
+                     std::shared_ptr<TensorImpl> *B2,
+                     std::shared_ptr<TensorImpl> *C2, double alpha, double beta)
+{
+    bool log = timer::contraction_logging();
+    auto start = std::chrono::steady_clock::now();
+
+    const KernelTimers &timers = kernel_timers();
+
+    // => Look Up (or Build) the Contraction Plan <= //
+
+    shared_ptr<const ContractionPlan> plan;
+    {
+        timer::TimerScope scope(timers.overhead);
+        ContractionPlanCache &cache = contraction_plan_cache();
+        size_t key = ContractionPlanCache::hash(Cinds, Ainds, Binds, C->dims(),
+                                                A->dims(), B->dims());
+        plan = cache.find(key, Cinds, Ainds, Binds, C->dims(), A->dims(),
+                          B->dims());
+        if (!plan)
+        {
+            plan = build_contraction_plan(C, A, B, Cinds, Ainds, Binds, alpha,
+                                          beta);
+            cache.insert(key, plan);
+        }
+    }
 
     // => Alias or Allocate A, B, C <= //
     // => Permute A, B, and C if Necessary <= //
 
-    double *Cp = ((CoreTensorImplPtr)C)->data().data();
-    double *Ap = ((CoreTensorImplPtr)A)->data().data();
-    double *Bp = ((CoreTensorImplPtr)B)->data().data();
+    double *Cp = direct_data(C);
+    double *Ap = direct_data(A);
+    double *Bp = direct_data(B);
+    advise(C, plan->permC ? permute_access(plan->C_to_C2) : NormalAccess);
+    advise(A, plan->permA ? permute_access(plan->A_to_A2) : NormalAccess);
+    advise(B, plan->permB ? permute_access(plan->B_to_B2) : NormalAccess);
     double *C2p = Cp;
     double *A2p = Ap;
     double *B2p = Bp;
 
-    if (permC)
+    ScratchBuffer C2scratch;
+    ScratchBuffer A2scratch;
+    ScratchBuffer B2scratch;
+
+    if (plan->permC)
     {
-        ambit::timer::timer_push("pre-BLAS: internal C allocation");
-        if (!C2)
         {
-            Dimension Cdims2 =
-                indices::permuted_dimension(C->dims(), Cinds2, Cinds);
-            C2 = std::make_shared<CoreTensorImpl>("C2", Cdims2);
+            timer::TimerScope scope(timers.C_allocation);
+            C2p = operand_buffer(C2, C2scratch, "C2", plan->Cdims2);
         }
-        C2p = C2->data().data();
-        ambit::timer::timer_pop();
         if (beta != 0.0)
         {
-            ambit::timer::timer_push("pre-BLAS: internal C permutation");
-            C2->permute(C, Cinds2, Cinds);
-            ambit::timer::timer_pop();
+            timer::TimerScope scope(timers.C_permutation);
+            permute_data(C2p, Cp, plan->Cdims2, plan->C_to_C2, 1.0, 0.0);
+            ambit::timer::add_bytes(2.0 * sizeof(double) * C->numel());
         }
     }
-    if (permA)
+    if (plan->permA)
     {
-        ambit::timer::timer_push("pre-BLAS: internal A allocation");
-        if (!A2)
         {
-            Dimension Adims2 =
-                indices::permuted_dimension(A->dims(), Ainds2, Ainds);
-            A2 = std::make_shared<CoreTensorImpl>("A2", Adims2);
+            timer::TimerScope scope(timers.A_allocation);
+            A2p = operand_buffer(A2, A2scratch, "A2", plan->Adims2);
         }
-        A2p = A2->data().data();
-        ambit::timer::timer_pop();
-        ambit::timer::timer_push("pre-BLAS: internal A permutation");
-        A2->permute(A, Ainds2, Ainds);
-        ambit::timer::timer_pop();
+        timer::TimerScope scope(timers.A_permutation);
+        permute_data(A2p, Ap, plan->Adims2, plan->A_to_A2, 1.0, 0.0);
+        ambit::timer::add_bytes(2.0 * sizeof(double) * A->numel());
     }
-    if (permB)
+    if (plan->permB)
     {
-        ambit::timer::timer_push("pre-BLAS: internal B allocation");
-        if (!B2)
         {
-            Dimension Bdims2 =
-                indices::permuted_dimension(B->dims(), Binds2, Binds);
-            B2 = std::make_shared<CoreTensorImpl>("B2", Bdims2);
+            timer::TimerScope scope(timers.B_allocation);
+            B2p = operand_buffer(B2, B2scratch, "B2", plan->Bdims2);
         }
-        B2p = B2->data().data();
-        ambit::timer::timer_pop();
-        ambit::timer::timer_push("pre-BLAS: internal B permutation");
-        B2->permute(B, Binds2, Binds);
-        ambit::timer::timer_pop();
+        timer::TimerScope scope(timers.B_permutation);
+        permute_data(B2p, Bp, plan->Bdims2, plan->B_to_B2, 1.0, 0.0);
+        ambit::timer::add_bytes(2.0 * sizeof(double) * B->numel());
     }
 
     // => GEMM Indexing <= //
 
+    char transL = plan->transL;
+    char transR = plan->transR;
+    size_t nrow = plan->nrow;
+    size_t ncol = plan->ncol;
+    size_t nzip = plan->nzip;
+    size_t ldaL = plan->ldaL;
+    size_t ldaR = plan->ldaR;
+    size_t ldaC = plan->ldaC;
+    size_t ABC_size = plan->ABC_size;
+    size_t strideC = plan->strideC;
+
+    double *Lp = (plan->L_is_A ? A2p : B2p);
+    double *Rp = (plan->L_is_A ? B2p : A2p);
+    size_t strideL = (plan->L_is_A ? plan->strideA : plan->strideB);
+    size_t strideR = (plan->L_is_A ? plan->strideB : plan->strideA);
+
     // => GEMM <= //
 
-    ambit::timer::timer_push("BLAS");
-    for (size_t P = 0L; P < ABC_size; P++)
     {
-
-        char transL;
-        char transR;
-        size_t nrow;
-        size_t ncol;
-        double *Lp;
-        double *Rp;
-        size_t ldaL;
-        size_t ldaR;
-
-        if (C_transpose)
+        timer::TimerScope scope(timers.blas);
+        // Each slice reads L, R and C (unless beta is zero) and writes C
+        ambit::timer::add_flops(2.0 * nrow * ncol * nzip * ABC_size);
+        ambit::timer::add_bytes(sizeof(double) * ABC_size *
+                                (nrow * nzip + nzip * ncol +
+                                 (beta == 0.0 ? 1.0 : 2.0) * nrow * ncol));
+        if (ABC_size == 1L)
         {
-            Lp = B2p;
-            Rp = A2p;
-            nrow = BC_size;
-            ncol = AC_size;
-            transL = (B_transpose ? 'N' : 'T');
-            transR = (A_transpose ? 'N' : 'T');
-            ldaL = (B_transpose ? AB_size : BC_size);
-            ldaR = (A_transpose ? AC_size : AB_size);
+            contract_slice(transL, transR, nrow, ncol, nzip, alpha, Lp, ldaL,
+                           Rp, ldaR, beta, C2p, ldaC);
         }
-        else
+        else if (nrow != 1L && ncol != 1L && nzip != 1L &&
+                 2.0 * nrow * ncol * nzip < batched_gemm_flop_threshold)
         {
-            Lp = A2p;
-            Rp = B2p;
-            nrow = AC_size;
-            ncol = BC_size;
-            transL = (A_transpose ? 'T' : 'N');
-            transR = (B_transpose ? 'T' : 'N');
-            ldaL = (A_transpose ? AC_size : AB_size);
-            ldaR = (B_transpose ? AB_size : BC_size);
+            // Many small GEMMs: hand the whole Hadamard batch to the
+            // strided-batch driver (vendor batch or OpenMP over P)
+            C_DGEMM_BATCH(transL, transR, nrow, ncol, nzip, alpha, Lp, ldaL,
+                          strideL, Rp, ldaR, strideR, beta, C2p, ldaC, strideC,
+                          ABC_size);
         }
-
-        size_t nzip = AB_size;
-        size_t ldaC = (C_transpose ? AC_size : BC_size);
-
-        if (nrow != 1L)
+        else if (nrow != 1L && ncol != 1L && nzip != 1L)
         {
-            if (ncol != 1L)
+            // Few large GEMMs: run them in order and let BLAS thread each one
+            for (size_t P = 0L; P < ABC_size; P++)
             {
-                if (nzip != 1L)
-                {
-                    C_DGEMM(transL, transR, nrow, ncol, nzip, alpha, Lp, ldaL,
-                            Rp, ldaR, beta, C2p, ldaC);
-                }
-                else
-                {
-                    for (size_t row = 0L; row < nrow; row++)
-                    {
-                        C_DSCAL(ncol, beta, C2p + row * ldaC, 1);
-                    }
-                    C_DGER(nrow, ncol, alpha, Lp, 1, Rp, 1, C2p, ldaC);
-                }
-            }
-            else
-            {
-                if (nzip != 1L)
-                {
-                    if (transL == 'N')
-                    {
-                        C_DGEMV('N', nrow, nzip, alpha, Lp, ldaL, Rp, 1, beta,
-                                C2p, 1);
-                    }
-                    else
-                    {
-                        C_DGEMV('T', nzip, nrow, alpha, Lp, ldaL, Rp, 1, beta,
-                                C2p, 1);
-                    }
-                }
-                else
-                {
-                    C_DSCAL(nrow, beta, C2p, 1);
-                    C_DAXPY(nrow, alpha * (*Rp), Lp, 1, C2p, 1);
-                }
+                C_DGEMM(transL, transR, nrow, ncol, nzip, alpha,
+                        Lp + P * strideL, ldaL, Rp + P * strideR, ldaR, beta,
+                        C2p + P * strideC, ldaC);
             }
         }
         else
         {
-            if (ncol != 1L)
-            {
-                if (nzip != 1L)
-                {
-                    if (transR == 'N')
-                    {
-                        C_DGEMV('T', nzip, ncol, alpha, Rp, ldaR, Lp, 1, beta,
-                                C2p, 1);
-                    }
-                    else
-                    {
-                        C_DGEMV('N', ncol, nzip, alpha, Rp, ldaR, Lp, 1, beta,
-                                C2p, 1);
-                    }
-                }
-                else
-                {
-                    C_DSCAL(ncol, beta, C2p, 1);
-                    C_DAXPY(ncol, alpha * (*Lp), Rp, 1, C2p, 1);
-                }
-            }
-            else
+            // Level 1/2 slices are bandwidth bound and too small to thread
+            // internally, so distribute the Hadamard index instead
+#pragma omp parallel for schedule(static)
+            for (size_t P = 0L; P < ABC_size; P++)
             {
-                if (nzip != 1L)
-                {
-                    (*C2p) *= beta;
-                    (*C2p) += alpha * C_DDOT(nzip, Lp, 1, Rp, 1);
-                }
-                else
-                {
-                    (*C2p) = alpha * (*Lp) * (*Rp) + beta * (*C2p);
-                }
+                contract_slice(transL, transR, nrow, ncol, nzip, alpha,
+                               Lp + P * strideL, ldaL, Rp + P * strideR, ldaR,
+                               beta, C2p + P * strideC, ldaC);
             }
         }
-
-        C2p += AC_size * BC_size;
-        A2p += AB_size * AC_size;
-        B2p += AB_size * BC_size;
     }
-    ambit::timer::timer_pop();
 
     // => Permute C if Necessary <= //
 
-    if (permC)
+    if (plan->permC)
     {
-        ambit::timer::timer_push("post-BLAS: internal C permutation");
-        C->permute(C2.get(), Cinds, Cinds2);
-        ambit::timer::timer_pop();
+        timer::TimerScope scope(timers.C_unpermutation);
+        permute_data(Cp, C2p, C->dims(), plan->C2_to_C, 1.0, 0.0);
+        ambit::timer::add_bytes(2.0 * sizeof(double) * C->numel());
+    }
+
+    if (log)
+    {
+        timer::ContractionRecord record;
+        record.operation = "contract";
+        record.expression = labeled_name(C, Cinds) + " = " +
+                            labeled_name(A, Ainds) + " * " +
+                            labeled_name(B, Binds);
+        record.dims = {C->dims(), A->dims(), B->dims()};
+        record.alpha = alpha;
+        record.beta = beta;
+        record.permC = plan->permC;
+        record.permA = plan->permA;
+        record.permB = plan->permB;
+        record.m = nrow;
+        record.n = ncol;
+        record.k = nzip;
+        record.batch = ABC_size;
+        record.seconds = seconds_since(start);
+        record.flops = 2.0 * nrow * ncol * nzip * ABC_size;
+        record.bytes = sizeof(double) * (A->numel() + B->numel() +
+                                         (beta == 0.0 ? 1.0 : 2.0) * C->numel());
+        timer::log_contraction(record);
     }
 }
 
 void CoreTensorImpl::permute(ConstTensorImplPtr A, const Indices &CindsS,
                              const Indices &AindsS, double alpha, double beta)
 {
-    ambit::timer::timer_push("P: " + std::to_string(beta) + " " + A->name() +
-                             "[" + indices::to_string(CindsS) +
-                             "] = " + std::to_string(alpha) + " " + A->name() +
-                             "[" + indices::to_string(AindsS) + "]");
+    if (!direct_data(A))
+    {
+        permute_tiled(this, A, CindsS, AindsS, alpha, beta);
+        return;
+    }
+    permute_direct(this, A, CindsS, AindsS, alpha, beta);
+}
+void permute_direct(TensorImplPtr C, ConstTensorImplPtr A,
+                    const Indices &CindsS, const Indices &AindsS, double alpha,
+                    double beta)
+{
+    timer::TimerScope scope(kernel_timers().permute);
+    bool log = timer::contraction_logging();
+    auto start = std::chrono::steady_clock::now();
 
     // => Convert to indices of A <= //
 
     vector<size_t> Ainds = indices::permutation_order(CindsS, AindsS);
-    for (size_t dim = 0; dim < rank(); dim++)
+    for (size_t dim = 0; dim < C->rank(); dim++)
     {
-        if (dims()[dim] != A->dims()[Ainds[dim]])
+        if (C->dims()[dim] != A->dims()[Ainds[dim]])
             throw std::runtime_error(
                 "Permuted tensors do not have same dimensions");
     }
 
     /// Data pointers
-    double *Cp = data().data();
-    double *Ap = ((const CoreTensorImplPtr)A)->data().data();
-
-    /// Beta scale
-    scale(beta);
+    double *Cp = direct_data(C);
+    const double *Ap = direct_data(A);
 
     // => Index Logic <= //
 
-    /// Determine the number of united fast indices and memcpy size
-    /// C_ij = A_ji would have no fast dimensions and a fast size of 1
-    /// C_ijk = A_jik would have k as a fast dimension, and a fast size of
-    /// dim(k)
-    /// C_ijkl = A_jikl would have k and l as fast dimensions, and a fast size
-    /// of dim(k) * dim(l)
-    int fast_dims = 0;
-    size_t fast_size = 1L;
-    for (int dim = ((int)rank()) - 1; dim >= 0; dim--)
-    {
-        if (dim == ((int)Ainds[dim]))
-        {
-            fast_dims++;
-            fast_size *= dims()[dim];
-        }
-        else
-        {
-            break;
-        }
-    }
-
-    /// Determine the total number of memcpy operations
-    int slow_dims = rank() - fast_dims;
-
-    /// Fully sorted case or (equivalently) rank-0 or rank-1 tensors
-    if (slow_dims == 0)
-    {
-        //::memcpy(Cp,Ap,sizeof(double)*fast_size);
-        C_DAXPY(fast_size, alpha, Ap, 1, Cp, 1);
-        ambit::timer::timer_pop();
-        return;
-    }
+    /// Strides of tensor A in the ordering of tensor C
+    vector<size_t> AstridesC = permutation_strides(A->dims(), CindsS, AindsS);
+    advise(C, SequentialAccess);
+    advise(A, permute_access(AstridesC));
 
-    /// Number of collapsed indices in permutation traverse
-    size_t slow_size = 1L;
-    for (int dim = 0; dim < slow_dims; dim++)
-    {
-        slow_size *= dims()[dim];
-    }
+    // => Permute Operation <= //
 
-    /// Strides of slow indices of tensor A in its own ordering
-    vector<size_t> Astrides(slow_dims, 0L);
-    if (slow_dims != 0)
-        Astrides[slow_dims - 1] = fast_size;
-    for (int dim = slow_dims - 2; dim >= 0; dim--)
-    {
-        Astrides[dim] = Astrides[dim + 1] * A->dims()[dim + 1];
-    }
+    /// Beta is applied by permute_data: C is only written when it is zero,
+    /// and scaled in a pass of its own unless it is one
+    permute_data(Cp, Ap, C->dims(), AstridesC, alpha, beta);
+    double flops = (beta == 0.0 ? 1.0 : (beta == 1.0 ? 2.0 : 3.0)) * C->numel();
+    double bytes = (beta == 0.0 ? 2.0 : (beta == 1.0 ? 3.0 : 5.0)) *
+                   sizeof(double) * C->numel();
+    ambit::timer::add_flops(flops);
+    ambit::timer::add_bytes(bytes);
 
-    /// Strides of slow indices of tensor A in the ordering of tensor C
-    vector<size_t> AstridesC(slow_dims, 0L);
-    for (int dim = 0; dim < slow_dims; dim++)
+    if (log)
     {
-        AstridesC[dim] = Astrides[Ainds[dim]];
+        timer::ContractionRecord record;
+        record.operation = "permute";
+        record.expression =
+            labeled_name(C, CindsS) + " = " + labeled_name(A, AindsS);
+        record.dims = {C->dims(), A->dims()};
+        record.alpha = alpha;
+        record.beta = beta;
+        record.seconds = seconds_since(start);
+        record.flops = flops;
+        record.bytes = bytes;
+        timer::log_contraction(record);
     }
-
-    /// Strides of slow indices of tensor C in its own ordering
-    vector<size_t> Cstrides(slow_dims, 0L);
-    if (slow_dims != 0)
-        Cstrides[slow_dims - 1] = fast_size;
-    for (int dim = slow_dims - 2; dim >= 0; dim--)
+}
+void CoreTensorImpl::permute_sum(const vector<ConstTensorImplPtr> &As,
+                                 const Indices &Cinds,
+                                 const vector<Indices> &Ainds,
+                                 const vector<double> &alphas, double beta)
+{
+    bool all_core = true;
+    for (ConstTensorImplPtr A : As)
+        all_core &= A->type() == CoreTensor;
+    if (As.size() < 2 || !all_core)
     {
-        Cstrides[dim] = Cstrides[dim + 1] * dims()[dim + 1];
+        TensorImpl::permute_sum(As, Cinds, Ainds, alphas, beta);
+        return;
     }
 
-    /// Handle to dimensions of C
-    const Dimension &Csizes = dims();
-
-    // => Permute Operation <= //
+    timer::TimerScope scope(kernel_timers().permute_sum);
+    bool log = timer::contraction_logging();
+    auto start = std::chrono::steady_clock::now();
 
-    if (fast_size == 1L)
+    vector<const double *> Aps;
+    vector<vector<size_t>> AstridesC;
+    for (size_t t = 0; t < As.size(); t++)
     {
-        if (slow_dims == 2)
-        {
-#pragma omp parallel for
-            for (size_t Cind0 = 0L; Cind0 < Csizes[0]; Cind0++)
-            {
-                double *Ctp = Cp + Cind0 * Cstrides[0];
-                for (size_t Cind1 = 0L; Cind1 < Csizes[1]; Cind1++)
-                {
-                    double *Atp =
-                        Ap + Cind0 * AstridesC[0] + Cind1 * AstridesC[1];
-                    //::memcpy(Ctp,Atp,sizeof(double)*fast_size);
-                    (*Ctp) += alpha * (*Atp);
-                    Ctp += fast_size;
-                }
-            }
-        }
-        else if (slow_dims == 3)
-        {
-#pragma omp parallel for
-            for (size_t Cind0 = 0L; Cind0 < Csizes[0]; Cind0++)
-            {
-                double *Ctp = Cp + Cind0 * Cstrides[0];
-                for (size_t Cind1 = 0L; Cind1 < Csizes[1]; Cind1++)
-                {
-                    for (size_t Cind2 = 0L; Cind2 < Csizes[2]; Cind2++)
-                    {
-                        double *Atp = Ap + Cind0 * AstridesC[0] +
-                                      Cind1 * AstridesC[1] +
-                                      Cind2 * AstridesC[2];
-                        //::memcpy(Ctp,Atp,sizeof(double)*fast_size);
-                        (*Ctp) += alpha * (*Atp);
-                        Ctp += fast_size;
-                    }
-                }
-            }
-        }
-        else if (slow_dims == 4)
-        {
-#pragma omp parallel for
-            for (size_t Cind0 = 0L; Cind0 < Csizes[0]; Cind0++)
-            {
-                double *Ctp = Cp + Cind0 * Cstrides[0];
-                for (size_t Cind1 = 0L; Cind1 < Csizes[1]; Cind1++)
-                {
-                    for (size_t Cind2 = 0L; Cind2 < Csizes[2]; Cind2++)
-                    {
-                        for (size_t Cind3 = 0L; Cind3 < Csizes[3]; Cind3++)
-                        {
-                            double *Atp = Ap + Cind0 * AstridesC[0] +
-                                          Cind1 * AstridesC[1] +
-                                          Cind2 * AstridesC[2] +
-                                          Cind3 * AstridesC[3];
-                            //::memcpy(Ctp,Atp,sizeof(double)*fast_size);
-                            (*Ctp) += alpha * (*Atp);
-                            Ctp += fast_size;
-                        }
-                    }
-                }
-            }
-        }
-        else if (slow_dims == 5)
+        vector<size_t> Aorder = indices::permutation_order(Cinds, Ainds[t]);
+        for (size_t dim = 0; dim < rank(); dim++)
         {
-#pragma omp parallel for
-            for (size_t Cind0 = 0L; Cind0 < Csizes[0]; Cind0++)
-            {
-                double *Ctp = Cp + Cind0 * Cstrides[0];
-                for (size_t Cind1 = 0L; Cind1 < Csizes[1]; Cind1++)
-                {
-                    for (size_t Cind2 = 0L; Cind2 < Csizes[2]; Cind2++)
-                    {
-                        for (size_t Cind3 = 0L; Cind3 < Csizes[3]; Cind3++)
-                        {
-                            for (size_t Cind4 = 0L; Cind4 < Csizes[4]; Cind4++)
-                            {
-                                double *Atp = Ap + Cind0 * AstridesC[0] +
-                                              Cind1 * AstridesC[1] +
-                                              Cind2 * AstridesC[2] +
-                                              Cind3 * AstridesC[3] +
-                                              Cind4 * AstridesC[4];
-                                //::memcpy(Ctp,Atp,sizeof(double)*fast_size);
-                                (*Ctp) += alpha * (*Atp);
-                                Ctp += fast_size;
-                            }
-                        }
-                    }
-                }
-            }
-        }
-        else if (slow_dims == 6)
-        {
-#pragma omp parallel for
-            for (size_t Cind0 = 0L; Cind0 < Csizes[0]; Cind0++)
-            {
-                double *Ctp = Cp + Cind0 * Cstrides[0];
-                for (size_t Cind1 = 0L; Cind1 < Csizes[1]; Cind1++)
-                {
-                    for (size_t Cind2 = 0L; Cind2 < Csizes[2]; Cind2++)
-                    {
-                        for (size_t Cind3 = 0L; Cind3 < Csizes[3]; Cind3++)
-                        {
-                            for (size_t Cind4 = 0L; Cind4 < Csizes[4]; Cind4++)
-                            {
-                                for (size_t Cind5 = 0L; Cind5 < Csizes[5];
-                                     Cind5++)
-                                {
-                                    double *Atp = Ap + Cind0 * AstridesC[0] +
-                                                  Cind1 * AstridesC[1] +
-                                                  Cind2 * AstridesC[2] +
-                                                  Cind3 * AstridesC[3] +
-                                                  Cind4 * AstridesC[4] +
-                                                  Cind5 * AstridesC[5];
-                                    //::memcpy(Ctp,Atp,sizeof(double)*fast_size);
-                                    (*Ctp) += alpha * (*Atp);
-                                    Ctp += fast_size;
-                                }
-                            }
-                        }
-                    }
-                }
-            }
-        }
-        else if (slow_dims == 7)
-        {
-#pragma omp parallel for
-            for (size_t Cind0 = 0L; Cind0 < Csizes[0]; Cind0++)
-            {
-                double *Ctp = Cp + Cind0 * Cstrides[0];
-                for (size_t Cind1 = 0L; Cind1 < Csizes[1]; Cind1++)
-                {
-                    for (size_t Cind2 = 0L; Cind2 < Csizes[2]; Cind2++)
-                    {
-                        for (size_t Cind3 = 0L; Cind3 < Csizes[3]; Cind3++)
-                        {
-                            for (size_t Cind4 = 0L; Cind4 < Csizes[4]; Cind4++)
-                            {
-                                for (size_t Cind5 = 0L; Cind5 < Csizes[5];
-                                     Cind5++)
-                                {
-                                    for (size_t Cind6 = 0L; Cind6 < Csizes[6];
-                                         Cind6++)
-                                    {
-                                        double *Atp = Ap +
-                                                      Cind0 * AstridesC[0] +
-                                                      Cind1 * AstridesC[1] +
-                                                      Cind2 * AstridesC[2] +
-                                                      Cind3 * AstridesC[3] +
-                                                      Cind4 * AstridesC[4] +
-                                                      Cind5 * AstridesC[5] +
-                                                      Cind6 * AstridesC[6];
-                                        //::memcpy(Ctp,Atp,sizeof(double)*fast_size);
-                                        (*Ctp) += alpha * (*Atp);
-                                        Ctp += fast_size;
-                                    }
-                                }
-                            }
-                        }
-                    }
-                }
-            }
-        }
-        else if (slow_dims == 8)
-        {
-#pragma omp parallel for
-            for (size_t Cind0 = 0L; Cind0 < Csizes[0]; Cind0++)
-            {
-                double *Ctp = Cp + Cind0 * Cstrides[0];
-                for (size_t Cind1 = 0L; Cind1 < Csizes[1]; Cind1++)
-                {
-                    for (size_t Cind2 = 0L; Cind2 < Csizes[2]; Cind2++)
-                    {
-                        for (size_t Cind3 = 0L; Cind3 < Csizes[3]; Cind3++)
-                        {
-                            for (size_t Cind4 = 0L; Cind4 < Csizes[4]; Cind4++)
-                            {
-                                for (size_t Cind5 = 0L; Cind5 < Csizes[5];
-                                     Cind5++)
-                                {
-                                    for (size_t Cind6 = 0L; Cind6 < Csizes[6];
-                                         Cind6++)
-                                    {
-                                        for (size_t Cind7 = 0L;
-                                             Cind7 < Csizes[7]; Cind7++)
-                                        {
-                                            double *Atp = Ap +
-                                                          Cind0 * AstridesC[0] +
-                                                          Cind1 * AstridesC[1] +
-                                                          Cind2 * AstridesC[2] +
-                                                          Cind3 * AstridesC[3] +
-                                                          Cind4 * AstridesC[4] +
-                                                          Cind5 * AstridesC[5] +
-                                                          Cind6 * AstridesC[6] +
-                                                          Cind7 * AstridesC[7];
-                                            //::memcpy(Ctp,Atp,sizeof(double)*fast_size);
-                                            (*Ctp) += alpha * (*Atp);
-                                            Ctp += fast_size;
-                                        }
-                                    }
-                                }
-                            }
-                        }
-                    }
-                }
-            }
-        }
-        else
-        {
-#pragma omp parallel for
-            for (size_t ind = 0L; ind < slow_size; ind++)
-            {
-                double *Ctp = Cp + ind * fast_size;
-                double *Atp = Ap;
-                size_t num = ind;
-                for (int dim = slow_dims - 1; dim >= 0; dim--)
-                {
-                    size_t val = num % Csizes[dim]; // value of the dim-th index
-                    num /= Csizes[dim];
-                    Atp += val * AstridesC[dim];
-                }
-                //::memcpy(Ctp,Atp,sizeof(double)*fast_size);
-                (*Ctp) += alpha * (*Atp);
-            }
+            if (dims()[dim] != As[t]->dims()[Aorder[dim]])
+                throw std::runtime_error(
+                    "Permuted tensors do not have same dimensions");
         }
+        Aps.push_back(((const CoreTensorImplPtr)As[t])->data().data());
+        AstridesC.push_back(
+            permutation_strides(As[t]->dims(), Cinds, Ainds[t]));
     }
-    else
+
+    permute_sum_data(data().data(), Aps, dims(), AstridesC, alphas, beta);
+    double flops = 2.0 * As.size() * numel();
+    double bytes =
+        sizeof(double) * numel() * (As.size() + (beta == 0.0 ? 1.0 : 2.0));
+    ambit::timer::add_flops(flops);
+    ambit::timer::add_bytes(bytes);
+
+    if (log)
     {
-        if (slow_dims == 2)
+        timer::ContractionRecord record;
+        record.operation = "permute_sum";
+        record.expression = labeled_name(this, Cinds) + " =";
+        record.dims.push_back(dims());
+        for (size_t t = 0; t < As.size(); t++)
         {
-#pragma omp parallel for
-            for (size_t Cind0 = 0L; Cind0 < Csizes[0]; Cind0++)
-            {
-                double *Ctp = Cp + Cind0 * Cstrides[0];
-                for (size_t Cind1 = 0L; Cind1 < Csizes[1]; Cind1++)
-                {
-                    double *Atp =
-                        Ap + Cind0 * AstridesC[0] + Cind1 * AstridesC[1];
-                    //::memcpy(Ctp,Atp,sizeof(double)*fast_size);
-                    C_DAXPY(fast_size, alpha, Atp, 1, Ctp, 1);
-                    Ctp += fast_size;
-                }
-            }
-        }
-        else if (slow_dims == 3)
-        {
-#pragma omp parallel for
-            for (size_t Cind0 = 0L; Cind0 < Csizes[0]; Cind0++)
-            {
-                double *Ctp = Cp + Cind0 * Cstrides[0];
-                for (size_t Cind1 = 0L; Cind1 < Csizes[1]; Cind1++)
-                {
-                    for (size_t Cind2 = 0L; Cind2 < Csizes[2]; Cind2++)
-                    {
-                        double *Atp = Ap + Cind0 * AstridesC[0] +
-                                      Cind1 * AstridesC[1] +
-                                      Cind2 * AstridesC[2];
-                        //::memcpy(Ctp,Atp,sizeof(double)*fast_size);
-                        C_DAXPY(fast_size, alpha, Atp, 1, Ctp, 1);
-                        Ctp += fast_size;
-                    }
-                }
-            }
-        }
-        else if (slow_dims == 4)
-        {
-#pragma omp parallel for
-            for (size_t Cind0 = 0L; Cind0 < Csizes[0]; Cind0++)
-            {
-                double *Ctp = Cp + Cind0 * Cstrides[0];
-                for (size_t Cind1 = 0L; Cind1 < Csizes[1]; Cind1++)
-                {
-                    for (size_t Cind2 = 0L; Cind2 < Csizes[2]; Cind2++)
-                    {
-                        for (size_t Cind3 = 0L; Cind3 < Csizes[3]; Cind3++)
-                        {
-                            double *Atp = Ap + Cind0 * AstridesC[0] +
-                                          Cind1 * AstridesC[1] +
-                                          Cind2 * AstridesC[2] +
-                                          Cind3 * AstridesC[3];
-                            //::memcpy(Ctp,Atp,sizeof(double)*fast_size);
-                            C_DAXPY(fast_size, alpha, Atp, 1, Ctp, 1);
-                            Ctp += fast_size;
-                        }
-                    }
-                }
-            }
-        }
-        else if (slow_dims == 5)
-        {
-#pragma omp parallel for
-            for (size_t Cind0 = 0L; Cind0 < Csizes[0]; Cind0++)
-            {
-                double *Ctp = Cp + Cind0 * Cstrides[0];
-                for (size_t Cind1 = 0L; Cind1 < Csizes[1]; Cind1++)
-                {
-                    for (size_t Cind2 = 0L; Cind2 < Csizes[2]; Cind2++)
-                    {
-                        for (size_t Cind3 = 0L; Cind3 < Csizes[3]; Cind3++)
-                        {
-                            for (size_t Cind4 = 0L; Cind4 < Csizes[4]; Cind4++)
-                            {
-                                double *Atp = Ap + Cind0 * AstridesC[0] +
-                                              Cind1 * AstridesC[1] +
-                                              Cind2 * AstridesC[2] +
-                                              Cind3 * AstridesC[3] +
-                                              Cind4 * AstridesC[4];
-                                //::memcpy(Ctp,Atp,sizeof(double)*fast_size);
-                                C_DAXPY(fast_size, alpha, Atp, 1, Ctp, 1);
-                                Ctp += fast_size;
-                            }
-                        }
-                    }
-                }
-            }
-        }
-        else if (slow_dims == 6)
-        {
-#pragma omp parallel for
-            for (size_t Cind0 = 0L; Cind0 < Csizes[0]; Cind0++)
-            {
-                double *Ctp = Cp + Cind0 * Cstrides[0];
-                for (size_t Cind1 = 0L; Cind1 < Csizes[1]; Cind1++)
-                {
-                    for (size_t Cind2 = 0L; Cind2 < Csizes[2]; Cind2++)
-                    {
-                        for (size_t Cind3 = 0L; Cind3 < Csizes[3]; Cind3++)
-                        {
-                            for (size_t Cind4 = 0L; Cind4 < Csizes[4]; Cind4++)
-                            {
-                                for (size_t Cind5 = 0L; Cind5 < Csizes[5];
-                                     Cind5++)
-                                {
-                                    double *Atp = Ap + Cind0 * AstridesC[0] +
-                                                  Cind1 * AstridesC[1] +
-                                                  Cind2 * AstridesC[2] +
-                                                  Cind3 * AstridesC[3] +
-                                                  Cind4 * AstridesC[4] +
-                                                  Cind5 * AstridesC[5];
-                                    //::memcpy(Ctp,Atp,sizeof(double)*fast_size);
-                                    C_DAXPY(fast_size, alpha, Atp, 1, Ctp, 1);
-                                    Ctp += fast_size;
-                                }
-                            }
-                        }
-                    }
-                }
-            }
-        }
-        else if (slow_dims == 7)
-        {
-#pragma omp parallel for
-            for (size_t Cind0 = 0L; Cind0 < Csizes[0]; Cind0++)
-            {
-                double *Ctp = Cp + Cind0 * Cstrides[0];
-                for (size_t Cind1 = 0L; Cind1 < Csizes[1]; Cind1++)
-                {
-                    for (size_t Cind2 = 0L; Cind2 < Csizes[2]; Cind2++)
-                    {
-                        for (size_t Cind3 = 0L; Cind3 < Csizes[3]; Cind3++)
-                        {
-                            for (size_t Cind4 = 0L; Cind4 < Csizes[4]; Cind4++)
-                            {
-                                for (size_t Cind5 = 0L; Cind5 < Csizes[5];
-                                     Cind5++)
-                                {
-                                    for (size_t Cind6 = 0L; Cind6 < Csizes[6];
-                                         Cind6++)
-                                    {
-                                        double *Atp = Ap +
-                                                      Cind0 * AstridesC[0] +
-                                                      Cind1 * AstridesC[1] +
-                                                      Cind2 * AstridesC[2] +
-                                                      Cind3 * AstridesC[3] +
-                                                      Cind4 * AstridesC[4] +
-                                                      Cind5 * AstridesC[5] +
-                                                      Cind6 * AstridesC[6];
-                                        //::memcpy(Ctp,Atp,sizeof(double)*fast_size);
-                                        C_DAXPY(fast_size, alpha, Atp, 1, Ctp,
-                                                1);
-                                        Ctp += fast_size;
-                                    }
-                                }
-                            }
-                        }
-                    }
-                }
-            }
-        }
-        else if (slow_dims == 8)
-        {
-#pragma omp parallel for
-            for (size_t Cind0 = 0L; Cind0 < Csizes[0]; Cind0++)
-            {
-                double *Ctp = Cp + Cind0 * Cstrides[0];
-                for (size_t Cind1 = 0L; Cind1 < Csizes[1]; Cind1++)
-                {
-                    for (size_t Cind2 = 0L; Cind2 < Csizes[2]; Cind2++)
-                    {
-                        for (size_t Cind3 = 0L; Cind3 < Csizes[3]; Cind3++)
-                        {
-                            for (size_t Cind4 = 0L; Cind4 < Csizes[4]; Cind4++)
-                            {
-                                for (size_t Cind5 = 0L; Cind5 < Csizes[5];
-                                     Cind5++)
-                                {
-                                    for (size_t Cind6 = 0L; Cind6 < Csizes[6];
-                                         Cind6++)
-                                    {
-                                        for (size_t Cind7 = 0L;
-                                             Cind7 < Csizes[7]; Cind7++)
-                                        {
-                                            double *Atp = Ap +
-                                                          Cind0 * AstridesC[0] +
-                                                          Cind1 * AstridesC[1] +
-                                                          Cind2 * AstridesC[2] +
-                                                          Cind3 * AstridesC[3] +
-                                                          Cind4 * AstridesC[4] +
-                                                          Cind5 * AstridesC[5] +
-                                                          Cind6 * AstridesC[6] +
-                                                          Cind7 * AstridesC[7];
-                                            //::memcpy(Ctp,Atp,sizeof(double)*fast_size);
-                                            C_DAXPY(fast_size, alpha, Atp, 1,
-                                                    Ctp, 1);
-                                            Ctp += fast_size;
-                                        }
-                                    }
-                                }
-                            }
-                        }
-                    }
-                }
-            }
-        }
-        else
-        {
-#pragma omp parallel for
-            for (size_t ind = 0L; ind < slow_size; ind++)
-            {
-                double *Ctp = Cp + ind * fast_size;
-                double *Atp = Ap;
-                size_t num = ind;
-                for (int dim = slow_dims - 1; dim >= 0; dim--)
-                {
-                    size_t val = num % Csizes[dim]; // value of the dim-th index
-                    num /= Csizes[dim];
-                    Atp += val * AstridesC[dim];
-                }
-                //::memcpy(Ctp,Atp,sizeof(double)*fast_size);
-                C_DAXPY(fast_size, alpha, Atp, 1, Ctp, 1);
-            }
+            record.expression +=
+                string(t == 0 ? " " : " + ") + labeled_name(As[t], Ainds[t]);
+            record.dims.push_back(As[t]->dims());
         }
+        record.beta = beta;
+        record.seconds = seconds_since(start);
+        record.flops = flops;
+        record.bytes = bytes;
+        timer::log_contraction(record);
     }
-
-    ambit::timer::timer_pop();
 }
 void CoreTensorImpl::gemm(ConstTensorImplPtr A, ConstTensorImplPtr B,
                           bool transA, bool transB, size_t nrow, size_t ncol,
@@ -1286,6 +1279,10 @@ void CoreTensorImpl::gemm(ConstTensorImplPtr A, ConstTensorImplPtr B,
 
     C_DGEMM((transA ? 'T' : 'N'), (transB ? 'T' : 'N'), nrow, ncol, nzip, alpha,
             Ap + offA, ldaA, Bp + offB, ldaB, beta, Cp + offC, ldaC);
+    ambit::timer::add_flops(2.0 * nrow * ncol * nzip);
+    ambit::timer::add_bytes(sizeof(double) *
+                            (nrow * nzip + nzip * ncol +
+                             (beta == 0.0 ? 1.0 : 2.0) * nrow * ncol));
 }
 
 map<string, TensorImplPtr> CoreTensorImpl::syev(EigenvalueOrder order) const
@@ -39,6 +39,12 @@ class CoreTensorImpl : public TensorImpl
 {
   public:
     CoreTensorImpl(const string &name, const Dimension &dims);
+    ~CoreTensorImpl();
+
+    // The storage is recorded with the memory accountant, so copies would
+    // release it twice.
+    CoreTensorImpl(const CoreTensorImpl &) = delete;
+    CoreTensorImpl &operator=(const CoreTensorImpl &) = delete;
 
     // Changes the internal dims_ object but does not change memory
     // allocation. This is an expert function. Used to change
@@ -86,6 +92,10 @@ class CoreTensorImpl : public TensorImpl
     void permute(ConstTensorImplPtr A, const Indices &Cinds,
                  const Indices &Ainds, double alpha = 1.0, double beta = 0.0);
 
+    void permute_sum(const vector<ConstTensorImplPtr> &As,
+                     const Indices &Cinds, const vector<Indices> &Ainds,
+                     const vector<double> &alphas, double beta = 0.0);
+
     void contract(ConstTensorImplPtr A, ConstTensorImplPtr B,
                   const Indices &Cinds, const Indices &Ainds,
                   const Indices &Binds, double alpha = 1.0, double beta = 0.0);
@@ -121,11 +131,34 @@ class CoreTensorImpl : public TensorImpl
                       &func) const;
 
   private:
+    // Brings the bytes recorded with the memory accountant to bytes.
+    void track_storage(size_t bytes);
+
     vector<double> data_;
+    // Bytes of data_ currently recorded with the memory accountant.
+    size_t tracked_bytes_ = 0;
 };
 
 typedef CoreTensorImpl *CoreTensorImplPtr;
 typedef const CoreTensorImpl *ConstCoreTensorImplPtr;
+
+// Storage of T that the core kernels can work on in place: the data of a
+// core tensor or the mapping of a memory-mapped disk tensor. Null otherwise.
+double *direct_data(ConstTensorImplPtr T);
+
+// The kernels of CoreTensorImpl::permute and contract, for any C, A and B
+// that have direct_data. Null A2/B2/C2 holders mean the permuted operands
+// live in the scratch arena for the duration of the call instead of in
+// caller-owned tensors.
+void permute_direct(TensorImplPtr C, ConstTensorImplPtr A, const Indices &Cinds,
+                    const Indices &Ainds, double alpha, double beta);
+void contract_direct(TensorImplPtr C, ConstTensorImplPtr A,
+                     ConstTensorImplPtr B, const Indices &Cinds,
+                     const Indices &Ainds, const Indices &Binds,
+                     std::shared_ptr<TensorImpl> *A2,
+                     std::shared_ptr<TensorImpl> *B2,
+                     std::shared_ptr<TensorImpl> *C2, double alpha,
+                     double beta);
 } // namespace ambit
 
 #endif
@@ -0,0 +1,164 @@
+/*
+ * @BEGIN LICENSE
+ *
+ * ambit: C++ library for the implementation of tensor product calculations
+ *        through a clean, concise user interface.
+ *
+ * Copyright (c) 2014-2017 Ambit developers.
+ *
+ * The copyrights for code used from other parties are included in
+ * the corresponding files.
+ *
+ * This file is part of ambit.
+ *
+ * Ambit is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * Ambit is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with ambit; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * @END LICENSE
+ */
+
+
+#include "scratch.h"
+#include "tensor/tensorimpl.h"
+
+#include <ambit/memory.h>
+#include <ambit/settings.h>
+
+#include <atomic>
+#include <cstdlib>
+
+namespace ambit
+{
+
+namespace
+{
+
+/// Alignment (in bytes) of every scratch buffer
+constexpr size_t scratch_alignment = 64;
+
+/// Idle buffers kept per thread before the oldest is freed
+constexpr size_t max_idle_blocks = 16;
+
+/// Bytes held by the arenas of all threads
+std::atomic<size_t> arena_bytes(0);
+
+void free_block(double *data, size_t capacity)
+{
+    free(data);
+    arena_bytes -= capacity * sizeof(double);
+    memory::release(CoreTensor, capacity * sizeof(double));
+}
+} // namespace
+
+ScratchBuffer::ScratchBuffer(ScratchBuffer &&other)
+    : arena_(other.arena_), data_(other.data_), capacity_(other.capacity_)
+{
+    other.arena_ = nullptr;
+    other.data_ = nullptr;
+    other.capacity_ = 0;
+}
+
+ScratchBuffer &ScratchBuffer::operator=(ScratchBuffer &&other)
+{
+    if (this != &other)
+    {
+        release();
+        arena_ = other.arena_;
+        data_ = other.data_;
+        capacity_ = other.capacity_;
+        other.arena_ = nullptr;
+        other.data_ = nullptr;
+        other.capacity_ = 0;
+    }
+    return *this;
+}
+
+void ScratchBuffer::release()
+{
+    if (arena_ != nullptr && data_ != nullptr)
+        arena_->release(data_, capacity_);
+    arena_ = nullptr;
+    data_ = nullptr;
+    capacity_ = 0;
+}
+
+ScratchArena &ScratchArena::instance()
+{
+    static thread_local ScratchArena arena;
+    return arena;
+}
+
+size_t ScratchArena::total_bytes() { return arena_bytes.load(); }
+
+ScratchArena::~ScratchArena() { trim(); }
+
+ScratchBuffer ScratchArena::acquire(size_t n)
+{
+    if (n == 0)
+        return ScratchBuffer();
+
+    // Smallest idle buffer that fits without wasting more than half of it
+    size_t best = idle_.size();
+    for (size_t ind = 0; ind < idle_.size(); ind++)
+    {
+        size_t capacity = idle_[ind].capacity;
+        if (capacity >= n && capacity / 2 <= n &&
+            (best == idle_.size() || capacity < idle_[best].capacity))
+            best = ind;
+    }
+    if (best != idle_.size())
+    {
+        Block block = idle_[best];
+        idle_.erase(idle_.begin() + best);
+        return ScratchBuffer(this, block.data, block.capacity);
+    }
+
+    size_t bytes = n * sizeof(double);
+    if (memory::current_in_core() + bytes > settings::memory_limit)
+        trim();
+    memory::allocate(CoreTensor, bytes);
+
+    void *ptr = nullptr;
+    if (posix_memalign(&ptr, scratch_alignment, bytes) != 0)
+    {
+        memory::release(CoreTensor, bytes);
+        throw detail::OutOfMemoryException();
+    }
+    arena_bytes += bytes;
+
+    return ScratchBuffer(this, static_cast<double *>(ptr), n);
+}
+
+void ScratchArena::trim()
+{
+    for (const Block &block : idle_)
+        free_block(block.data, block.capacity);
+    idle_.clear();
+}
+
+void ScratchArena::release(double *data, size_t capacity)
+{
+    if (memory::current_in_core() > settings::memory_limit)
+    {
+        free_block(data, capacity);
+        return;
+    }
+
+    if (idle_.size() == max_idle_blocks)
+    {
+        free_block(idle_.front().data, idle_.front().capacity);
+        idle_.erase(idle_.begin());
+    }
+    idle_.push_back({data, capacity});
+}
+}
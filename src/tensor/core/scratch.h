@@ -0,0 +1,119 @@
+/*
+ * @BEGIN LICENSE
+ *
+ * ambit: C++ library for the implementation of tensor product calculations
+ *        through a clean, concise user interface.
+ *
+ * Copyright (c) 2014-2017 Ambit developers.
+ *
+ * The copyrights for code used from other parties are included in
+ * the corresponding files.
+ *
+ * This file is part of ambit.
+ *
+ * Ambit is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * Ambit is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with ambit; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * @END LICENSE
+ */
+
+
+#if !defined(TENSOR_CORE_SCRATCH_H)
+#define TENSOR_CORE_SCRATCH_H
+
+#include <cstddef>
+#include <vector>
+
+namespace ambit
+{
+
+class ScratchArena;
+
+/**
+ * A lease on an uninitialized, 64-byte aligned block of doubles handed out
+ * by a ScratchArena. The block goes back to its arena when the lease is
+ * destroyed; leases must be released on the thread that acquired them.
+ */
+class ScratchBuffer
+{
+  public:
+    ScratchBuffer() : arena_(nullptr), data_(nullptr), capacity_(0) {}
+    ScratchBuffer(ScratchBuffer &&other);
+    ScratchBuffer &operator=(ScratchBuffer &&other);
+    ScratchBuffer(const ScratchBuffer &) = delete;
+    ScratchBuffer &operator=(const ScratchBuffer &) = delete;
+    ~ScratchBuffer() { release(); }
+
+    double *data() const { return data_; }
+    size_t capacity() const { return capacity_; }
+
+    void release();
+
+  private:
+    friend class ScratchArena;
+    ScratchBuffer(ScratchArena *arena, double *data, size_t capacity)
+        : arena_(arena), data_(data), capacity_(capacity)
+    {
+    }
+
+    ScratchArena *arena_;
+    double *data_;
+    size_t capacity_;
+};
+
+/**
+ * Per-thread pool of scratch buffers for the temporaries of core tensor
+ * operations (e.g. the permuted operands of a contraction).
+ *
+ * Released buffers are kept and handed out again to later requests that
+ * fit, so repeated operations neither call malloc nor touch fresh pages.
+ * Every buffer is recorded with the memory accountant as CoreTensor
+ * storage, and idle buffers are freed whenever the in-core total would
+ * exceed settings::memory_limit.
+ */
+class ScratchArena
+{
+  public:
+    /// The arena of the calling thread
+    static ScratchArena &instance();
+
+    /// Bytes currently held (leased or idle) by the arenas of all threads
+    static size_t total_bytes();
+
+    ~ScratchArena();
+
+    /// Lease a buffer of at least n doubles. Contents are uninitialized.
+    ScratchBuffer acquire(size_t n);
+
+    /// Free all idle buffers of this arena
+    void trim();
+
+  private:
+    friend class ScratchBuffer;
+
+    ScratchArena() = default;
+
+    void release(double *data, size_t capacity);
+
+    struct Block
+    {
+        double *data;
+        size_t capacity;
+    };
+
+    /// Buffers not currently leased
+    std::vector<Block> idle_;
+};
+}
+
+#endif
@@ -0,0 +1,737 @@
+/*
+ * @BEGIN LICENSE
+ *
+ * ambit: C++ library for the implementation of tensor product calculations
+ *        through a clean, concise user interface.
+ *
+ * Copyright (c) 2014-2017 Ambit developers.
+ *
+ * The copyrights for code used from other parties are included in
+ * the corresponding files.
+ *
+ * This file is part of ambit.
+ *
+ * Ambit is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * Ambit is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with ambit; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * @END LICENSE
+ */
+
+
+#include "transpose.h"
+#include "tensor/macros.h"
+
+#include <algorithm>
+
+#if defined(__AVX512F__) || defined(__AVX__)
+#include <immintrin.h>
+#endif
+
+namespace ambit
+{
+
+namespace
+{
+
+/// Edge length (in doubles) of the square tiles swapped by the transpose
+constexpr size_t transpose_tile = 32;
+
+/// Length (in doubles) of the pieces a single long run is split into
+constexpr size_t run_chunk = 8192;
+
+/// Upper bound on the number of pieces the outer indices are split into
+constexpr size_t max_outer_blocks = 1024;
+
+struct PermuteDim
+{
+    size_t n;
+    size_t Cstride;
+    size_t Astride;
+};
+
+/// Walks the offsets into C and A of a set of indices in row-major order.
+class Odometer
+{
+  public:
+    Odometer(const vector<PermuteDim> &dims, size_t start)
+        : dims_(dims), index_(dims.size(), 0L), Coffset_(0L), Aoffset_(0L)
+    {
+        for (int d = ((int)dims_.size()) - 1; d >= 0; d--)
+        {
+            index_[d] = start % dims_[d].n;
+            start /= dims_[d].n;
+            Coffset_ += index_[d] * dims_[d].Cstride;
+            Aoffset_ += index_[d] * dims_[d].Astride;
+        }
+    }
+
+    void next()
+    {
+        for (int d = ((int)dims_.size()) - 1; d >= 0; d--)
+        {
+            index_[d]++;
+            Coffset_ += dims_[d].Cstride;
+            Aoffset_ += dims_[d].Astride;
+            if (index_[d] < dims_[d].n)
+                return;
+            index_[d] = 0L;
+            Coffset_ -= dims_[d].n * dims_[d].Cstride;
+            Aoffset_ -= dims_[d].n * dims_[d].Astride;
+        }
+    }
+
+    size_t Coffset() const { return Coffset_; }
+    size_t Aoffset() const { return Aoffset_; }
+
+  private:
+    const vector<PermuteDim> &dims_;
+    vector<size_t> index_;
+    size_t Coffset_;
+    size_t Aoffset_;
+};
+
+size_t total_size(const vector<PermuteDim> &dims)
+{
+    size_t size = 1L;
+    for (const PermuteDim &dim : dims)
+        size *= dim.n;
+    return size;
+}
+
+/// c += value when accumulating, c = value otherwise (c is never read)
+template <bool Accumulate> inline void update(double &c, double value)
+{
+    if (Accumulate)
+        c += value;
+    else
+        c = value;
+}
+
+template <bool Accumulate>
+inline void axpy_run(size_t n, double alpha, const double *A, double *C)
+{
+    VECTORIZED_LOOP
+    for (size_t i = 0L; i < n; i++)
+        update<Accumulate>(C[i], alpha * A[i]);
+}
+
+// => Register micro-kernels <= //
+//
+// Each computes C[i * ldc + j] (+)= alpha * A[j * lda + i] for a square
+// block of width micro_size: rows of A are loaded, transposed in registers
+// and stored (or accumulated) into rows of C.
+
+#if defined(__AVX512F__)
+
+#define AMBIT_TRANSPOSE_MICRO_KERNEL
+constexpr size_t micro_size = 8;
+
+template <bool Accumulate>
+inline void transpose_micro(double alpha, const double *A, size_t lda,
+                            double *C, size_t ldc)
+{
+    __m512d r0 = _mm512_loadu_pd(A + 0 * lda);
+    __m512d r1 = _mm512_loadu_pd(A + 1 * lda);
+    __m512d r2 = _mm512_loadu_pd(A + 2 * lda);
+    __m512d r3 = _mm512_loadu_pd(A + 3 * lda);
+    __m512d r4 = _mm512_loadu_pd(A + 4 * lda);
+    __m512d r5 = _mm512_loadu_pd(A + 5 * lda);
+    __m512d r6 = _mm512_loadu_pd(A + 6 * lda);
+    __m512d r7 = _mm512_loadu_pd(A + 7 * lda);
+
+    // Interleave pairs of rows: 128-bit lanes now hold (r_even, r_odd)
+    __m512d t0 = _mm512_unpacklo_pd(r0, r1);
+    __m512d t1 = _mm512_unpackhi_pd(r0, r1);
+    __m512d t2 = _mm512_unpacklo_pd(r2, r3);
+    __m512d t3 = _mm512_unpackhi_pd(r2, r3);
+    __m512d t4 = _mm512_unpacklo_pd(r4, r5);
+    __m512d t5 = _mm512_unpackhi_pd(r4, r5);
+    __m512d t6 = _mm512_unpacklo_pd(r6, r7);
+    __m512d t7 = _mm512_unpackhi_pd(r6, r7);
+
+    // Gather the even/odd lanes of each group of four rows
+    __m512d u0 = _mm512_shuffle_f64x2(t0, t2, 0x88); // columns 0, 4
+    __m512d u1 = _mm512_shuffle_f64x2(t0, t2, 0xDD); // columns 2, 6
+    __m512d u2 = _mm512_shuffle_f64x2(t1, t3, 0x88); // columns 1, 5
+    __m512d u3 = _mm512_shuffle_f64x2(t1, t3, 0xDD); // columns 3, 7
+    __m512d u4 = _mm512_shuffle_f64x2(t4, t6, 0x88);
+    __m512d u5 = _mm512_shuffle_f64x2(t4, t6, 0xDD);
+    __m512d u6 = _mm512_shuffle_f64x2(t5, t7, 0x88);
+    __m512d u7 = _mm512_shuffle_f64x2(t5, t7, 0xDD);
+
+    __m512d c[8];
+    c[0] = _mm512_shuffle_f64x2(u0, u4, 0x88);
+    c[4] = _mm512_shuffle_f64x2(u0, u4, 0xDD);
+    c[2] = _mm512_shuffle_f64x2(u1, u5, 0x88);
+    c[6] = _mm512_shuffle_f64x2(u1, u5, 0xDD);
+    c[1] = _mm512_shuffle_f64x2(u2, u6, 0x88);
+    c[5] = _mm512_shuffle_f64x2(u2, u6, 0xDD);
+    c[3] = _mm512_shuffle_f64x2(u3, u7, 0x88);
+    c[7] = _mm512_shuffle_f64x2(u3, u7, 0xDD);
+
+    __m512d valpha = _mm512_set1_pd(alpha);
+    for (size_t i = 0L; i < 8L; i++)
+    {
+        double *Cp = C + i * ldc;
+        if (Accumulate)
+            _mm512_storeu_pd(
+                Cp, _mm512_fmadd_pd(valpha, c[i], _mm512_loadu_pd(Cp)));
+        else
+            _mm512_storeu_pd(Cp, _mm512_mul_pd(valpha, c[i]));
+    }
+}
+
+#elif defined(__AVX__)
+
+#define AMBIT_TRANSPOSE_MICRO_KERNEL
+constexpr size_t micro_size = 4;
+
+template <bool Accumulate>
+inline void transpose_micro(double alpha, const double *A, size_t lda,
+                            double *C, size_t ldc)
+{
+    __m256d r0 = _mm256_loadu_pd(A + 0 * lda);
+    __m256d r1 = _mm256_loadu_pd(A + 1 * lda);
+    __m256d r2 = _mm256_loadu_pd(A + 2 * lda);
+    __m256d r3 = _mm256_loadu_pd(A + 3 * lda);
+
+    __m256d t0 = _mm256_unpacklo_pd(r0, r1);
+    __m256d t1 = _mm256_unpackhi_pd(r0, r1);
+    __m256d t2 = _mm256_unpacklo_pd(r2, r3);
+    __m256d t3 = _mm256_unpackhi_pd(r2, r3);
+
+    __m256d c[4];
+    c[0] = _mm256_permute2f128_pd(t0, t2, 0x20);
+    c[1] = _mm256_permute2f128_pd(t1, t3, 0x20);
+    c[2] = _mm256_permute2f128_pd(t0, t2, 0x31);
+    c[3] = _mm256_permute2f128_pd(t1, t3, 0x31);
+
+    __m256d valpha = _mm256_set1_pd(alpha);
+    for (size_t i = 0L; i < 4L; i++)
+    {
+        double *Cp = C + i * ldc;
+        if (!Accumulate)
+            _mm256_storeu_pd(Cp, _mm256_mul_pd(valpha, c[i]));
+        else
+#if defined(__FMA__)
+            _mm256_storeu_pd(
+                Cp, _mm256_fmadd_pd(valpha, c[i], _mm256_loadu_pd(Cp)));
+#else
+            _mm256_storeu_pd(Cp, _mm256_add_pd(_mm256_loadu_pd(Cp),
+                                               _mm256_mul_pd(valpha, c[i])));
+#endif
+    }
+}
+
+#endif
+
+/// C[i * ldc + j] (+)= alpha * A[j * lda + i] for 0 <= i < m, 0 <= j < n
+template <bool Accumulate>
+void transpose_tile_kernel(size_t m, size_t n, double alpha, const double *A,
+                           size_t lda, double *C, size_t ldc)
+{
+    size_t i = 0L;
+#if defined(AMBIT_TRANSPOSE_MICRO_KERNEL)
+    for (; i + micro_size <= m; i += micro_size)
+    {
+        size_t j = 0L;
+        for (; j + micro_size <= n; j += micro_size)
+        {
+            transpose_micro<Accumulate>(alpha, A + j * lda + i, lda,
+                                        C + i * ldc + j, ldc);
+        }
+        for (size_t ii = i; ii < i + micro_size; ii++)
+        {
+            for (size_t jj = j; jj < n; jj++)
+            {
+                update<Accumulate>(C[ii * ldc + jj], alpha * A[jj * lda + ii]);
+            }
+        }
+    }
+#endif
+    for (; i < m; i++)
+    {
+        for (size_t j = 0L; j < n; j++)
+        {
+            update<Accumulate>(C[i * ldc + j], alpha * A[j * lda + i]);
+        }
+    }
+}
+
+/// The fast index of C is also the fast index of A: stream unit-stride runs
+template <bool Accumulate>
+void permute_runs(double *Cp, const double *Ap,
+                  const vector<PermuteDim> &outer, size_t run,
+                  double alpha)
+{
+    size_t outer_size = total_size(outer);
+    if (outer_size == 1L)
+    {
+        size_t nchunks = (run + run_chunk - 1L) / run_chunk;
+#pragma omp parallel for schedule(static)
+        for (size_t chunk = 0L; chunk < nchunks; chunk++)
+        {
+            size_t offset = chunk * run_chunk;
+            axpy_run<Accumulate>(std::min(run_chunk, run - offset), alpha, Ap + offset,
+                     Cp + offset);
+        }
+        return;
+    }
+
+    size_t nblocks = std::min(outer_size, max_outer_blocks);
+
+#pragma omp parallel for schedule(static)
+    for (size_t block = 0L; block < nblocks; block++)
+    {
+        size_t start = block * outer_size / nblocks;
+        size_t stop = (block + 1L) * outer_size / nblocks;
+        Odometer odometer(outer, start);
+        for (size_t ind = start; ind < stop; ind++)
+        {
+            axpy_run<Accumulate>(run, alpha, Ap + odometer.Aoffset(),
+                     Cp + odometer.Coffset());
+            odometer.next();
+        }
+    }
+}
+
+/// The fast indices of C and A differ: swap them tile by tile
+template <bool Accumulate>
+void permute_transpose(double *Cp, const double *Ap,
+                       const vector<PermuteDim> &outer, const PermuteDim &row,
+                       const PermuteDim &col, double alpha)
+{
+    size_t ldc = row.Cstride;
+    size_t lda = col.Astride;
+
+    size_t outer_size = total_size(outer);
+    size_t row_tiles = (row.n + transpose_tile - 1L) / transpose_tile;
+    size_t nblocks = std::min(outer_size, max_outer_blocks);
+    size_t nitems = nblocks * row_tiles;
+
+#pragma omp parallel for schedule(static)
+    for (size_t item = 0L; item < nitems; item++)
+    {
+        size_t block = item / row_tiles;
+        size_t i0 = (item % row_tiles) * transpose_tile;
+        size_t m = std::min(transpose_tile, row.n - i0);
+
+        size_t start = block * outer_size / nblocks;
+        size_t stop = (block + 1L) * outer_size / nblocks;
+        Odometer odometer(outer, start);
+        for (size_t ind = start; ind < stop; ind++)
+        {
+            const double *Atp = Ap + odometer.Aoffset() + i0;
+            double *Ctp = Cp + odometer.Coffset() + i0 * ldc;
+            for (size_t j0 = 0L; j0 < col.n; j0 += transpose_tile)
+            {
+                size_t n = std::min(transpose_tile, col.n - j0);
+                transpose_tile_kernel<Accumulate>(m, n, alpha, Atp + j0 * lda,
+                                                  lda, Ctp + j0, ldc);
+            }
+            odometer.next();
+        }
+    }
+}
+
+template <bool Accumulate>
+void permute_dispatch(double *Cp, const double *Ap, vector<PermuteDim> &fused,
+                      double alpha)
+{
+    /// Rank-0 or all unit indices
+    if (fused.empty())
+    {
+        update<Accumulate>(*Cp, alpha * (*Ap));
+        return;
+    }
+
+    PermuteDim col = fused.back();
+    fused.pop_back();
+
+    if (col.Astride == 1L)
+    {
+        permute_runs<Accumulate>(Cp, Ap, fused, col.n, alpha);
+        return;
+    }
+
+    for (size_t dim = 0L; dim < fused.size(); dim++)
+    {
+        if (fused[dim].Astride == 1L)
+        {
+            PermuteDim row = fused[dim];
+            fused.erase(fused.begin() + dim);
+            permute_transpose<Accumulate>(Cp, Ap, fused, row, col, alpha);
+            return;
+        }
+    }
+
+    /// No unit stride in A (not reachable for dense row-major data)
+    fused.push_back(col);
+    permute_runs<Accumulate>(Cp, Ap, fused, 1L, alpha);
+}
+
+// => N-ary permutation sums <= //
+
+struct SumDim
+{
+    size_t n;
+    size_t Cstride;
+    vector<size_t> Astrides;
+};
+
+/// Edge length of the tiles of C for a tile spanning ntile indices, chosen
+/// so that a tile holds a few thousand doubles
+size_t sum_tile_edge(size_t ntile)
+{
+    if (ntile == 1L)
+        return run_chunk;
+    if (ntile == 2L)
+        return 64L;
+    if (ntile == 3L)
+        return 16L;
+    return 8L;
+}
+
+/// Walks the offsets into C and every term of a set of indices in
+/// row-major order.
+class SumOdometer
+{
+  public:
+    SumOdometer(const vector<SumDim> &dims, const vector<size_t> &which,
+                size_t nterms, size_t start)
+        : dims_(dims), which_(which), index_(which.size(), 0L), Coffset_(0L),
+          Aoffsets_(nterms, 0L)
+    {
+        for (int d = ((int)which_.size()) - 1; d >= 0; d--)
+        {
+            const SumDim &dim = dims_[which_[d]];
+            index_[d] = start % dim.n;
+            start /= dim.n;
+            Coffset_ += index_[d] * dim.Cstride;
+            for (size_t t = 0L; t < Aoffsets_.size(); t++)
+                Aoffsets_[t] += index_[d] * dim.Astrides[t];
+        }
+    }
+
+    void next()
+    {
+        for (int d = ((int)which_.size()) - 1; d >= 0; d--)
+        {
+            const SumDim &dim = dims_[which_[d]];
+            index_[d]++;
+            Coffset_ += dim.Cstride;
+            for (size_t t = 0L; t < Aoffsets_.size(); t++)
+                Aoffsets_[t] += dim.Astrides[t];
+            if (index_[d] < dim.n)
+                return;
+            index_[d] = 0L;
+            Coffset_ -= dim.n * dim.Cstride;
+            for (size_t t = 0L; t < Aoffsets_.size(); t++)
+                Aoffsets_[t] -= dim.n * dim.Astrides[t];
+        }
+    }
+
+    size_t Coffset() const { return Coffset_; }
+    size_t Aoffset(size_t t) const { return Aoffsets_[t]; }
+
+  private:
+    const vector<SumDim> &dims_;
+    const vector<size_t> &which_;
+    vector<size_t> index_;
+    size_t Coffset_;
+    vector<size_t> Aoffsets_;
+};
+
+/// One tile of C: the indices it spans (positions in the fused dims, the
+/// fast index of C last) and its extent along each of them
+struct SumTile
+{
+    const vector<SumDim> &dims;
+    const vector<size_t> &tile_dims;
+    vector<size_t> length;
+
+    /// Calls line(Coffset, Aoffset) for every line of the tile along the
+    /// fast index of C, with the offsets relative to the tile corner in C
+    /// and term t. Tile index skip (if any) is left to the caller.
+    template <typename Line>
+    void lines(size_t t, size_t skip, Line line) const
+    {
+        size_t nd = tile_dims.size() - 1L;
+        vector<size_t> index(nd, 0L);
+        size_t Coffset = 0L, Aoffset = 0L;
+        while (true)
+        {
+            line(Coffset, Aoffset);
+            int d = ((int)nd) - 1;
+            for (; d >= 0; d--)
+            {
+                if ((size_t)d == skip)
+                    continue;
+                const SumDim &dim = dims[tile_dims[d]];
+                index[d]++;
+                Coffset += dim.Cstride;
+                Aoffset += dim.Astrides[t];
+                if (index[d] < length[d])
+                    break;
+                Coffset -= length[d] * dim.Cstride;
+                Aoffset -= length[d] * dim.Astrides[t];
+                index[d] = 0L;
+            }
+            if (d < 0)
+                return;
+        }
+    }
+};
+
+/// Adds (or, for the first term when beta is zero, writes) term t into a
+/// tile of C
+template <bool Accumulate>
+void sum_term_tile(const SumTile &tile, int unit, size_t t, double alpha,
+                   const double *Ap, double *Cp)
+{
+    size_t col = tile.tile_dims.size() - 1L;
+    size_t ncol = tile.length[col];
+    size_t Acol = tile.dims[tile.tile_dims[col]].Astrides[t];
+
+    if (unit == (int)col)
+    {
+        tile.lines(t, col, [&](size_t Coffset, size_t Aoffset) {
+            axpy_run<Accumulate>(ncol, alpha, Ap + Aoffset, Cp + Coffset);
+        });
+    }
+    else if (unit >= 0)
+    {
+        // Lines along the fast index of the term are swapped in squares
+        size_t ldc = tile.dims[tile.tile_dims[unit]].Cstride;
+        size_t nrow = tile.length[unit];
+        tile.lines(t, unit, [&](size_t Coffset, size_t Aoffset) {
+            transpose_tile_kernel<Accumulate>(nrow, ncol, alpha, Ap + Aoffset,
+                                              Acol, Cp + Coffset, ldc);
+        });
+    }
+    else
+    {
+        tile.lines(t, col, [&](size_t Coffset, size_t Aoffset) {
+            for (size_t j = 0L; j < ncol; j++)
+                update<Accumulate>(Cp[Coffset + j],
+                                   alpha * Ap[Aoffset + j * Acol]);
+        });
+    }
+}
+
+} // anonymous namespace
+
+void permute_data(double *Cp, const double *Ap, const Dimension &Cdims,
+                  const vector<size_t> &AstridesC, double alpha, double beta)
+{
+    // => Collapse the index space <= //
+
+    /// Drop unit indices, then fuse neighbouring indices of C that are
+    /// also neighbours (in the same order) in A
+    vector<PermuteDim> dims;
+    size_t Cstride = 1L;
+    for (int dim = ((int)Cdims.size()) - 1; dim >= 0; dim--)
+    {
+        if (Cdims[dim] == 0L)
+            return;
+        if (Cdims[dim] != 1L)
+            dims.push_back({Cdims[dim], Cstride, AstridesC[dim]});
+        Cstride *= Cdims[dim];
+    }
+    std::reverse(dims.begin(), dims.end());
+
+    vector<PermuteDim> fused;
+    for (const PermuteDim &dim : dims)
+    {
+        if (!fused.empty() && fused.back().Astride == dim.Astride * dim.n)
+        {
+            fused.back().n *= dim.n;
+            fused.back().Cstride = dim.Cstride;
+            fused.back().Astride = dim.Astride;
+        }
+        else
+        {
+            fused.push_back(dim);
+        }
+    }
+
+    // => Dispatch <= //
+
+    if (beta == 0.0)
+    {
+        permute_dispatch<false>(Cp, Ap, fused, alpha);
+        return;
+    }
+
+    if (beta != 1.0)
+    {
+        size_t numel = Cstride;
+#pragma omp parallel for schedule(static)
+        for (size_t ind = 0L; ind < numel; ind++)
+            Cp[ind] *= beta;
+    }
+    permute_dispatch<true>(Cp, Ap, fused, alpha);
+}
+
+void permute_sum_data(double *Cp, const vector<const double *> &Aps,
+                      const Dimension &Cdims,
+                      const vector<vector<size_t>> &AstridesC,
+                      const vector<double> &alphas, double beta)
+{
+    size_t nterms = Aps.size();
+
+    // => Collapse the index space <= //
+
+    /// As in permute_data, but indices are only fused if they are
+    /// neighbours in every term
+    vector<SumDim> dims;
+    size_t Cstride = 1L;
+    for (int dim = ((int)Cdims.size()) - 1; dim >= 0; dim--)
+    {
+        if (Cdims[dim] == 0L)
+            return;
+        if (Cdims[dim] != 1L)
+        {
+            SumDim sdim{Cdims[dim], Cstride, vector<size_t>(nterms)};
+            for (size_t t = 0L; t < nterms; t++)
+                sdim.Astrides[t] = AstridesC[t][dim];
+            dims.push_back(sdim);
+        }
+        Cstride *= Cdims[dim];
+    }
+    std::reverse(dims.begin(), dims.end());
+
+    vector<SumDim> fused;
+    for (const SumDim &dim : dims)
+    {
+        bool fusable = !fused.empty();
+        for (size_t t = 0L; fusable && t < nterms; t++)
+            fusable = fused.back().Astrides[t] == dim.Astrides[t] * dim.n;
+        if (fusable)
+        {
+            fused.back().n *= dim.n;
+            fused.back().Cstride = dim.Cstride;
+            fused.back().Astrides = dim.Astrides;
+        }
+        else
+        {
+            fused.push_back(dim);
+        }
+    }
+
+    /// Rank-0 or all unit indices
+    if (fused.empty())
+    {
+        double value = (beta == 0.0) ? 0.0 : beta * (*Cp);
+        for (size_t t = 0L; t < nterms; t++)
+            value += alphas[t] * (*Aps[t]);
+        *Cp = value;
+        return;
+    }
+
+    // => Tiling <= //
+
+    /// The tile spans the fast index of every term and, last, that of C
+    vector<size_t> tile_dims;
+    vector<int> unit(nterms, -1);
+    for (size_t t = 0L; t < nterms; t++)
+    {
+        for (size_t d = 0L; d + 1L < fused.size(); d++)
+        {
+            if (fused[d].Astrides[t] != 1L)
+                continue;
+            auto it = std::find(tile_dims.begin(), tile_dims.end(), d);
+            unit[t] = (int)(it - tile_dims.begin());
+            if (it == tile_dims.end())
+                tile_dims.push_back(d);
+        }
+    }
+    tile_dims.push_back(fused.size() - 1L);
+    for (size_t t = 0L; t < nterms; t++)
+        if (fused.back().Astrides[t] == 1L)
+            unit[t] = (int)(tile_dims.size() - 1L);
+
+    vector<size_t> outer_dims;
+    for (size_t d = 0L; d < fused.size(); d++)
+        if (std::find(tile_dims.begin(), tile_dims.end(), d) == tile_dims.end())
+            outer_dims.push_back(d);
+
+    size_t edge = sum_tile_edge(tile_dims.size());
+    vector<size_t> ntiles;
+    size_t tiles = 1L;
+    for (size_t d : tile_dims)
+    {
+        ntiles.push_back((fused[d].n + edge - 1L) / edge);
+        tiles *= ntiles.back();
+    }
+
+    size_t outer_size = 1L;
+    for (size_t d : outer_dims)
+        outer_size *= fused[d].n;
+    size_t nblocks = std::min(outer_size, max_outer_blocks);
+    size_t nitems = nblocks * tiles;
+
+    // => Sum <= //
+
+#pragma omp parallel for schedule(static)
+    for (size_t item = 0L; item < nitems; item++)
+    {
+        size_t block = item / tiles;
+
+        /// Corner and extent of the tile
+        SumTile tile{fused, tile_dims, vector<size_t>(tile_dims.size())};
+        size_t Ccorner = 0L;
+        vector<size_t> Acorner(nterms, 0L);
+        size_t rest = item % tiles;
+        for (int k = ((int)tile_dims.size()) - 1; k >= 0; k--)
+        {
+            const SumDim &dim = fused[tile_dims[k]];
+            size_t start = (rest % ntiles[k]) * edge;
+            rest /= ntiles[k];
+            tile.length[k] = std::min(edge, dim.n - start);
+            Ccorner += start * dim.Cstride;
+            for (size_t t = 0L; t < nterms; t++)
+                Acorner[t] += start * dim.Astrides[t];
+        }
+
+        size_t start = block * outer_size / nblocks;
+        size_t stop = (block + 1L) * outer_size / nblocks;
+        SumOdometer odometer(fused, outer_dims, nterms, start);
+        for (size_t ind = start; ind < stop; ind++)
+        {
+            double *Ctp = Cp + odometer.Coffset() + Ccorner;
+
+            if (beta != 0.0 && beta != 1.0)
+            {
+                size_t ncol = tile.length.back();
+                tile.lines(0L, tile_dims.size() - 1L,
+                           [&](size_t Coffset, size_t) {
+                               double *line = Ctp + Coffset;
+                               for (size_t j = 0L; j < ncol; j++)
+                                   line[j] *= beta;
+                           });
+            }
+
+            for (size_t t = 0L; t < nterms; t++)
+            {
+                const double *Atp = Aps[t] + odometer.Aoffset(t) + Acorner[t];
+                if (t == 0L && beta == 0.0)
+                    sum_term_tile<false>(tile, unit[t], t, alphas[t], Atp, Ctp);
+                else
+                    sum_term_tile<true>(tile, unit[t], t, alphas[t], Atp, Ctp);
+            }
+            odometer.next();
+        }
+    }
+}
+}
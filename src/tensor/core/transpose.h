@@ -0,0 +1,86 @@
+/*
+ * @BEGIN LICENSE
+ *
+ * ambit: C++ library for the implementation of tensor product calculations
+ *        through a clean, concise user interface.
+ *
+ * Copyright (c) 2014-2017 Ambit developers.
+ *
+ * The copyrights for code used from other parties are included in
+ * the corresponding files.
+ *
+ * This file is part of ambit.
+ *
+ * Ambit is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * Ambit is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with ambit; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * @END LICENSE
+ */
+
+
+#if !defined(TENSOR_CORE_TRANSPOSE_H)
+#define TENSOR_CORE_TRANSPOSE_H
+
+#include <ambit/common_types.h>
+
+namespace ambit
+{
+
+/**
+ * Permutes a dense row-major array,
+ *
+ *  C[c_0, c_1, ..., c_n] = alpha * A[P(c_0, c_1, ..., c_n)] + beta * C[...]
+ *
+ * @param Cp        pointer to the (row-major) destination data
+ * @param Ap        pointer to the source data
+ * @param Cdims     dimensions of C
+ * @param AstridesC stride in A of each index of C, in the ordering of C
+ * @param alpha     scale applied to A
+ * @param beta      scale applied to C; if zero C is only written, so it may
+ *                  be uninitialized
+ *
+ * Runs of indices that are contiguous in both arrays are fused first, so
+ * any rank is handled. If the fastest index of C is also the fastest index
+ * of A the data is streamed in unit-stride runs; otherwise the two fast
+ * indices are swapped with a cache-blocked transpose that uses AVX-512 or
+ * AVX2 register micro-kernels when the compiler targets them.
+ */
+void permute_data(double *Cp, const double *Ap, const Dimension &Cdims,
+                  const vector<size_t> &AstridesC, double alpha, double beta);
+
+/**
+ * Sums permuted copies of several dense row-major arrays,
+ *
+ *  C[c_0, ..., c_n] = sum_t alphas[t] * A_t[P_t(c_0, ..., c_n)]
+ *                     + beta * C[c_0, ..., c_n]
+ *
+ * @param Cp        pointer to the (row-major) destination data
+ * @param Aps       pointer to the source data of each term
+ * @param Cdims     dimensions of C
+ * @param AstridesC stride in A_t of each index of C, in the ordering of C,
+ *                  for each term t
+ * @param alphas    scale applied to each term
+ * @param beta      scale applied to C; if zero C is only written
+ *
+ * C is visited once, in cache-sized tiles that span the fast index of C
+ * and the fast index of every term. Each tile is scaled and receives all
+ * the terms before the next one is touched, so the cost stays close to a
+ * single pass over memory whatever the number of terms.
+ */
+void permute_sum_data(double *Cp, const vector<const double *> &Aps,
+                      const Dimension &Cdims,
+                      const vector<vector<size_t>> &AstridesC,
+                      const vector<double> &alphas, double beta);
+}
+
+#endif
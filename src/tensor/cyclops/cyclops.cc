@@ -35,7 +35,9 @@
 
 #include "cyclops.h"
 #include "../globals.h"
+#include <ambit/memory.h>
 #include <ambit/print.h>
+#include <ambit/settings.h>
 
 #define GET_CTF_TENSOR(X)                                                      \
     const CyclopsTensorImpl *c##X =                                            \
@@ -59,6 +61,13 @@ int initialized_mpi = 0;
 namespace
 {
 
+// This process's share of a distributed tensor's storage.
+size_t local_bytes(size_t numel)
+{
+    size_t nprocess = static_cast<size_t>(settings::nprocess);
+    return (numel + nprocess - 1) / nprocess * sizeof(double);
+}
+
 std::vector<std::string> generateCyclopsLabels(const std::vector<Indices> &inds)
 {
     static const char *cyclops_index_set =
@@ -179,6 +188,8 @@ CyclopsTensorImpl::CyclopsTensorImpl(const std::string &name,
                                      const Dimension &dims)
     : TensorImpl(kDistributed, name, dims)
 {
+    memory::allocate(DistributedTensor, local_bytes(numel()));
+
     if (dims.size() == 0)
     {
         cyclops_ = new CTF_Scalar(0.0, *details::world);
@@ -197,7 +208,11 @@ CyclopsTensorImpl::CyclopsTensorImpl(const std::string &name,
     delete[] local_sym;
 }
 
-CyclopsTensorImpl::~CyclopsTensorImpl() { delete cyclops_; }
+CyclopsTensorImpl::~CyclopsTensorImpl()
+{
+    delete cyclops_;
+    memory::release(DistributedTensor, local_bytes(numel()));
+}
 
 double CyclopsTensorImpl::norm(int type) const
 {
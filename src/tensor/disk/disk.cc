@@ -27,13 +27,23 @@
  * @END LICENSE
  */
 
+
 #include "disk.h"
+#include "io_queue.h"
 #include "memory.h"
 #include "math/math.h"
+#include "tensor/core/core.h"
 #include "tensor/indices.h"
+#include <ambit/memory.h>
+#include <ambit/settings.h>
+#include <algorithm>
+#include <atomic>
+#include <map>
 #include <sstream>
 #include <string.h>
 #include <cmath>
+#include <fcntl.h>
+#include <sys/mman.h>
 #include <unistd.h>
 
 //#include <boost/timer/timer.hpp>
@@ -41,7 +51,9 @@
 namespace ambit
 {
 
-static size_t disk_next_id__ = 0L;
+// Disk tensors are built from several threads at once (e.g. the blocks of
+// concurrent blocked contractions), so their file numbers must be unique
+static std::atomic<size_t> disk_next_id__{0L};
 size_t disk_next_id() { return disk_next_id__++; }
 
 DiskTensorImpl::DiskTensorImpl(const string &name, const Dimension &dims)
@@ -57,61 +69,391 @@ DiskTensorImpl::DiskTensorImpl(const string &name, const Dimension &dims)
     ss << ".dat";
 
     filename_ = ss.str();
-    fh_ = fopen(filename_.c_str(), "wb+");
-    scale(0.0); // Prestripe
+    fd_ = open(filename_.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd_ < 0)
+        throw std::runtime_error("DiskTensorImpl: unable to open " +
+                                 filename_);
+
+    // A sparse file: the blocks are allocated as they are first written,
+    // and the holes read as zeros until then
+    if (ftruncate(fd_, numel() * sizeof(double)) != 0)
+    {
+        close(fd_);
+        remove(filename_.c_str());
+        throw std::runtime_error("DiskTensorImpl: unable to size " +
+                                 filename_);
+    }
+    memory::allocate(DiskTensor, numel() * sizeof(double));
+
+    // Empty tensors have nothing to map (and mmap refuses a length of 0)
+    if (settings::disk_mmap_limit > 0 && numel() > 0 &&
+        numel() * sizeof(double) <= settings::disk_mmap_limit)
+    {
+        try
+        {
+            map();
+        }
+        catch (...)
+        {
+            close(fd_);
+            remove(filename_.c_str());
+            memory::release(DiskTensor, numel() * sizeof(double));
+            throw;
+        }
+    }
 }
 DiskTensorImpl::~DiskTensorImpl()
 {
-    fclose(fh_);
+    unmap();
+    close(fd_);
     remove(filename_.c_str());
+    memory::release(DiskTensor, numel() * sizeof(double));
+}
+void DiskTensorImpl::read(double *buffer, size_t offset, size_t n) const
+{
+    DiskIOQueue &queue = DiskIOQueue::instance();
+    queue.wait(queue.read(fd_, buffer, {{offset, n}}));
+}
+void DiskTensorImpl::write(const double *buffer, size_t offset, size_t n)
+{
+    DiskIOQueue &queue = DiskIOQueue::instance();
+    queue.wait(queue.write(fd_, buffer, {{offset, n}}));
+}
+void DiskTensorImpl::map()
+{
+    if (mapping_ != nullptr || numel() == 0)
+        return;
+    void *address = mmap(nullptr, numel() * sizeof(double),
+                         PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+    if (address == MAP_FAILED)
+        throw std::runtime_error("DiskTensorImpl: unable to map " +
+                                 filename_);
+    mapping_ = static_cast<double *>(address);
+}
+void DiskTensorImpl::unmap()
+{
+    if (mapping_ == nullptr)
+        return;
+    munmap(mapping_, numel() * sizeof(double));
+    mapping_ = nullptr;
+}
+void DiskTensorImpl::advise(DiskAccess access) const
+{
+    if (mapping_ == nullptr)
+        return;
+    int advice = access == SequentialAccess
+                     ? MADV_SEQUENTIAL
+                     : (access == RandomAccess ? MADV_RANDOM : MADV_NORMAL);
+    // Only a hint: failure changes nothing
+    madvise(mapping_, numel() * sizeof(double), advice);
+}
+void DiskTensorImpl::zero()
+{
+    off_t bytes = numel() * sizeof(double);
+#if defined(FALLOC_FL_PUNCH_HOLE)
+    // Deallocates the blocks in place, mappings included
+    if (fallocate(fd_, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, 0, bytes) ==
+        0)
+        return;
+#endif
+    // File systems without hole punching: drop the blocks by truncation
+    if (ftruncate(fd_, 0) != 0 || ftruncate(fd_, bytes) != 0)
+        throw std::runtime_error("DiskTensorImpl: unable to zero " +
+                                 filename_);
 }
 void DiskTensorImpl::scale(double beta)
 {
-    size_t fast_size = 1L;
-    for (int ind = ((int)rank()) - 1; ind >= 0; ind--)
+    if (beta == 0.0)
     {
-        if (fast_size * dims()[ind] <= disk_buffer__)
-        {
-            fast_size *= dims()[ind];
-        }
-        else
+        zero();
+        return;
+    }
+    if (mapping_ != nullptr)
+    {
+        C_DSCAL(numel(), beta, mapping_, 1);
+        return;
+    }
+
+    size_t chunk = std::min(numel(), disk_buffer__);
+    vector<double> buffer(chunk);
+
+    for (size_t offset = 0L; offset < numel(); offset += chunk)
+    {
+        size_t n = std::min(chunk, numel() - offset);
+        read(buffer.data(), offset, n);
+        C_DSCAL(n, beta, buffer.data(), 1);
+        write(buffer.data(), offset, n);
+    }
+}
+void DiskTensorImpl::permute(ConstTensorImplPtr A, const Indices &Cinds,
+                             const Indices &Ainds, double alpha, double beta)
+{
+    if (mapping_ != nullptr && direct_data(A) != nullptr)
+        permute_direct(this, A, Cinds, Ainds, alpha, beta);
+    else
+        permute_tiled(this, A, Cinds, Ainds, alpha, beta);
+}
+void DiskTensorImpl::contract(ConstTensorImplPtr A, ConstTensorImplPtr B,
+                              const Indices &Cinds, const Indices &Ainds,
+                              const Indices &Binds, double alpha, double beta)
+{
+    if (mapping_ != nullptr && direct_data(A) != nullptr &&
+        direct_data(B) != nullptr)
+        contract_direct(this, A, B, Cinds, Ainds, Binds, nullptr, nullptr,
+                        nullptr, alpha, beta);
+    else
+        contract_tiled(this, A, B, Cinds, Ainds, Binds, alpha, beta);
+}
+void DiskTensorImpl::contract(ConstTensorImplPtr A, ConstTensorImplPtr B,
+                              const Indices &Cinds, const Indices &Ainds,
+                              const Indices &Binds,
+                              std::shared_ptr<TensorImpl> &,
+                              std::shared_ptr<TensorImpl> &,
+                              std::shared_ptr<TensorImpl> &, double alpha,
+                              double beta)
+{
+    // Permuted copies live in scratch space, so there is nothing to keep
+    contract(A, B, Cinds, Ainds, Binds, alpha, beta);
+}
+
+namespace
+{
+
+/// Smallest tile budget, in elements, whatever the memory left
+constexpr size_t min_tile_budget = 1024L;
+
+/// Elements the tiles of one out-of-core operation may occupy
+size_t tile_budget()
+{
+    size_t used = memory::current_in_core();
+    size_t left =
+        settings::memory_limit > used ? settings::memory_limit - used : 0L;
+    return std::max(left / 2L / sizeof(double), min_tile_budget);
+}
+
+/// Splits the range of every label into blocks and walks the tiles
+class TileGrid
+{
+  public:
+    TileGrid(const Indices &labels, const Dimension &dims)
+        : labels_(labels), dims_(dims), block_(dims), start_(dims.size(), 0L)
+    {
+    }
+
+    /// Elements of the largest tile of a tensor carrying indices
+    size_t numel(const Indices &indices) const
+    {
+        size_t n = 1L;
+        for (const string &index : indices)
+            n *= block_[position(index)];
+        return n;
+    }
+
+    /// Halves the block of the first label that is not down to one
+    /// element; false if there is none
+    bool shrink_leading()
+    {
+        for (size_t &block : block_)
         {
-            break;
+            if (block > 1L)
+            {
+                block = (block + 1L) / 2L;
+                return true;
+            }
         }
+        return false;
     }
 
-    size_t slow_size = numel() / fast_size;
+    /// Halves the largest block; false if every block is down to one element
+    bool shrink_largest()
+    {
+        auto it = std::max_element(block_.begin(), block_.end());
+        if (it == block_.end() || *it <= 1L)
+            return false;
+        *it = (*it + 1L) / 2L;
+        return true;
+    }
 
-    double *buffer = new double[fast_size];
-    memset(buffer, '\0', sizeof(double) * fast_size);
+    /// Ranges of the current tile in a tensor carrying indices
+    IndexRange range(const Indices &indices) const
+    {
+        IndexRange ranges;
+        for (const string &index : indices)
+        {
+            size_t k = position(index);
+            ranges.push_back(
+                {start_[k], std::min(start_[k] + block_[k], dims_[k])});
+        }
+        return ranges;
+    }
 
-    if (beta == 0.0)
+    /// Dimensions of the current tile of a tensor carrying indices
+    Dimension extents(const Indices &indices) const
     {
-        fseek(fh_, 0L, SEEK_SET);
-        for (size_t ind = 0L; ind < slow_size; ind++)
+        Dimension dims;
+        for (const string &index : indices)
         {
-            fwrite(buffer, sizeof(double), fast_size, fh_);
+            size_t k = position(index);
+            dims.push_back(std::min(block_[k], dims_[k] - start_[k]));
         }
-        fseek(fh_, 0L, SEEK_SET);
+        return dims;
     }
-    else
+
+    /// Moves labels [first, last) to their next tile; false (and back to
+    /// the first tile) after the last one
+    bool next(size_t first, size_t last)
     {
-        fseek(fh_, 0L, SEEK_SET);
-        for (size_t ind = 0L; ind < slow_size; ind++)
+        for (size_t k = last; k-- > first;)
         {
-            fread(buffer, sizeof(double), fast_size, fh_);
-            fseek(fh_, sizeof(double) * ind * fast_size, SEEK_SET);
-            C_DSCAL(fast_size, beta, buffer, 1);
-            fwrite(buffer, sizeof(double), fast_size, fh_);
-            fseek(fh_, sizeof(double) * ind * fast_size, SEEK_SET);
+            start_[k] += block_[k];
+            if (start_[k] < dims_[k])
+                return true;
+            start_[k] = 0L;
         }
+        return false;
     }
 
-    delete[] buffer;
+  private:
+    size_t position(const string &index) const
+    {
+        return std::find(labels_.begin(), labels_.end(), index) -
+               labels_.begin();
+    }
+
+    Indices labels_;
+    Dimension dims_;
+    Dimension block_;
+    vector<size_t> start_;
+};
+
+/// The whole of a tile with dimensions dims
+IndexRange whole(const Dimension &dims)
+{
+    IndexRange ranges;
+    for (size_t dim : dims)
+        ranges.push_back({0L, dim});
+    return ranges;
+}
+
+/// Loads the block ranges of T into tile, unless it is already there
+void load_tile(CoreTensorImpl *tile, IndexRange &loaded, ConstTensorImplPtr T,
+               const IndexRange &ranges, const Dimension &extents)
+{
+    if (loaded == ranges)
+        return;
+    tile->reshape(extents);
+    tile->slice(T, whole(extents), ranges, 1.0, 0.0);
+    loaded = ranges;
+}
 }
-void DiskTensorImpl::permute(ConstTensorImplPtr A, const Indices &CindsS,
-                             const Indices &AindsS, double alpha, double beta)
+
+void permute_tiled(TensorImplPtr C, ConstTensorImplPtr A, const Indices &Cinds,
+                   const Indices &Ainds, double alpha, double beta)
 {
-    // TODO
+    vector<size_t> perm = indices::permutation_order(Cinds, Ainds);
+    for (size_t dim = 0; dim < C->rank(); dim++)
+    {
+        if (C->dims()[dim] != A->dims()[perm[dim]])
+            throw std::runtime_error(
+                "Permuted tensors do not have same dimensions");
+    }
+
+    // Tiles span the trailing indices of C, so C is written in long runs
+    TileGrid grid(Cinds, C->dims());
+    size_t budget = tile_budget();
+    while (2L * grid.numel(Cinds) > budget && grid.shrink_leading())
+    {
+    }
+
+    CoreTensorImpl Atile("A tile", grid.extents(Ainds));
+    CoreTensorImpl Ctile("C tile", grid.extents(Cinds));
+    IndexRange loaded;
+    do
+    {
+        IndexRange Cranges = grid.range(Cinds);
+        Dimension Cextents = grid.extents(Cinds);
+        load_tile(&Atile, loaded, A, grid.range(Ainds), grid.extents(Ainds));
+        Ctile.reshape(Cextents);
+        if (beta != 0.0)
+            Ctile.slice(C, whole(Cextents), Cranges, 1.0, 0.0);
+        Ctile.permute(&Atile, Cinds, Ainds, alpha, beta);
+        C->slice(&Ctile, Cranges, whole(Cextents), 1.0, 0.0);
+    } while (grid.next(0L, Cinds.size()));
+}
+
+void contract_tiled(TensorImplPtr C, ConstTensorImplPtr A, ConstTensorImplPtr B,
+                    const Indices &Cinds, const Indices &Ainds,
+                    const Indices &Binds, double alpha, double beta)
+{
+    // => Labels and Their Ranges <= //
+
+    Indices labels;
+    std::map<string, size_t> ranges;
+    auto add_labels = [&](const Indices &indices, ConstTensorImplPtr T) {
+        if (indices.size() != T->rank())
+            throw std::runtime_error(
+                "Contraction indices do not match the rank of " + T->name());
+        for (size_t dim = 0; dim < indices.size(); dim++)
+        {
+            auto it = ranges.find(indices[dim]);
+            if (it == ranges.end())
+            {
+                labels.push_back(indices[dim]);
+                ranges[indices[dim]] = T->dims()[dim];
+            }
+            else if (it->second != T->dims()[dim])
+                throw std::runtime_error(
+                    "Contraction dimensions do not agree for index " +
+                    indices[dim]);
+        }
+    };
+    add_labels(Cinds, C);
+    add_labels(Ainds, A);
+    add_labels(Binds, B);
+
+    Dimension dims;
+    for (const string &label : labels)
+        dims.push_back(ranges[label]);
+
+    // => Tiles <= //
+
+    TileGrid grid(labels, dims);
+    size_t budget = tile_budget();
+    while (grid.numel(Cinds) + grid.numel(Ainds) + grid.numel(Binds) >
+               budget &&
+           grid.shrink_largest())
+    {
+    }
+
+    CoreTensorImpl Atile("A tile", grid.extents(Ainds));
+    CoreTensorImpl Btile("B tile", grid.extents(Binds));
+    CoreTensorImpl Ctile("C tile", grid.extents(Cinds));
+    IndexRange Aloaded;
+    IndexRange Bloaded;
+
+    // The labels of C come first: each tile of C is read and written once
+    // and accumulates every tile of the contracted indices in between
+    size_t nC = Cinds.size();
+    do
+    {
+        IndexRange Cranges = grid.range(Cinds);
+        Dimension Cextents = grid.extents(Cinds);
+        Ctile.reshape(Cextents);
+        if (beta == 0.0)
+            Ctile.scale(0.0);
+        else
+            Ctile.slice(C, whole(Cextents), Cranges, beta, 0.0);
+
+        do
+        {
+            load_tile(&Atile, Aloaded, A, grid.range(Ainds),
+                      grid.extents(Ainds));
+            load_tile(&Btile, Bloaded, B, grid.range(Binds),
+                      grid.extents(Binds));
+            Ctile.contract(&Atile, &Btile, Cinds, Ainds, Binds, alpha, 1.0);
+        } while (grid.next(nC, labels.size()));
+
+        C->slice(&Ctile, Cranges, whole(Cextents), 1.0, 0.0);
+    } while (grid.next(0L, nC));
 }
 }
@@ -38,6 +38,14 @@ namespace ambit
 /// 1 GiB in doubles
 static constexpr size_t disk_buffer__ = 125000000L;
 
+/// How a memory-mapped disk tensor is about to be read (see madvise)
+enum DiskAccess
+{
+    NormalAccess,
+    SequentialAccess,
+    RandomAccess
+};
+
 class DiskTensorImpl : public TensorImpl
 {
   public:
@@ -50,14 +58,72 @@ class DiskTensorImpl : public TensorImpl
                  const std::vector<std::string> &Ainds, double alpha = 1.0,
                  double beta = 0.0);
 
+    void contract(ConstTensorImplPtr A, ConstTensorImplPtr B,
+                  const Indices &Cinds, const Indices &Ainds,
+                  const Indices &Binds, double alpha = 1.0, double beta = 0.0);
+
+    void contract(ConstTensorImplPtr A, ConstTensorImplPtr B,
+                  const Indices &Cinds, const Indices &Ainds,
+                  const Indices &Binds, std::shared_ptr<TensorImpl> &A2,
+                  std::shared_ptr<TensorImpl> &B2,
+                  std::shared_ptr<TensorImpl> &C2, double alpha = 1.0,
+                  double beta = 0.0);
+
+    /// Reads n elements starting at element offset into buffer
+    void read(double *buffer, size_t offset, size_t n) const;
+    /// Writes n elements from buffer starting at element offset
+    void write(const double *buffer, size_t offset, size_t n);
+
+    /// Maps the file into memory, so that core kernels can work on it in
+    /// place (see direct_data). Tensors no larger than
+    /// settings::disk_mmap_limit are mapped when they are built.
+    void map();
+    void unmap();
+    /// The mapped elements, or null if the tensor is not mapped
+    double *mapping() const { return mapping_; }
+    /// Tells the kernel how the mapping is about to be read
+    void advise(DiskAccess access) const;
+
     std::string filename() const { return filename_; }
-    FILE *fh() const { return fh_; }
+    /// Descriptor of the backing file, for positioned I/O (see DiskIOQueue)
+    int fd() const { return fd_; }
 
   private:
+    // Deallocates the blocks of the file, which then read as zeros
+    void zero();
+
     std::string filename_;
-    FILE *fh_;
+    int fd_;
+    double *mapping_ = nullptr;
 };
 
+/**
+ * Out-of-core permutation, C[Cinds] = alpha * A[Ainds] + beta * C[Cinds],
+ * for any mix of core and disk tensors.
+ *
+ * C is visited in tiles that span its trailing indices, so that each tile
+ * is written as few long runs; the matching block of A is read into core,
+ * permuted there and written back. Tiles are sized so that both blocks fit
+ * in half of the memory left under settings::memory_limit.
+ */
+void permute_tiled(TensorImplPtr C, ConstTensorImplPtr A, const Indices &Cinds,
+                   const Indices &Ainds, double alpha, double beta);
+
+/**
+ * Out-of-core contraction,
+ * C[Cinds] = alpha * A[Ainds] * B[Binds] + beta * C[Cinds],
+ * for any mix of core and disk tensors.
+ *
+ * Every index is split into blocks so that one tile each of A, B and C fits
+ * in half of the memory left under settings::memory_limit (the other half is
+ * left to the in-core contraction of the tiles). Each tile of C is read
+ * once, accumulates the products of all the matching tiles of A and B, and
+ * is written back once.
+ */
+void contract_tiled(TensorImplPtr C, ConstTensorImplPtr A, ConstTensorImplPtr B,
+                    const Indices &Cinds, const Indices &Ainds,
+                    const Indices &Binds, double alpha, double beta);
+
 typedef DiskTensorImpl *DiskTensorImplPtr;
 typedef const DiskTensorImpl *ConstDiskTensorImplPtr;
 }
@@ -0,0 +1,172 @@
+/*
+ * @BEGIN LICENSE
+ *
+ * ambit: C++ library for the implementation of tensor product calculations
+ *        through a clean, concise user interface.
+ *
+ * Copyright (c) 2014-2017 Ambit developers.
+ *
+ * The copyrights for code used from other parties are included in
+ * the corresponding files.
+ *
+ * This file is part of ambit.
+ *
+ * Ambit is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * Ambit is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with ambit; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * @END LICENSE
+ */
+
+
+#include "io_queue.h"
+
+#include <ambit/timer.h>
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <unistd.h>
+
+namespace ambit
+{
+
+namespace
+{
+
+/// Moves n elements between the buffer and the file, resuming short
+/// transfers; false on error
+bool transfer(bool write, int fd, double *buffer, size_t offset, size_t n)
+{
+    char *data = reinterpret_cast<char *>(buffer);
+    size_t bytes = n * sizeof(double);
+    off_t position = static_cast<off_t>(offset * sizeof(double));
+    while (bytes > 0)
+    {
+        ssize_t moved = write ? ::pwrite(fd, data, bytes, position)
+                              : ::pread(fd, data, bytes, position);
+        if (moved < 0 && errno == EINTR)
+            continue;
+        if (moved == 0)
+            errno = EIO; // past the end of the file
+        if (moved <= 0)
+            return false;
+        data += moved;
+        bytes -= moved;
+        position += moved;
+    }
+    return true;
+}
+
+/// Bytes moved by the segments, counted against the timer of the thread
+/// that queues them
+double transferred_bytes(const DiskIOQueue::Segments &segments)
+{
+    double elements = 0.0;
+    for (const auto &segment : segments)
+        elements += segment.second;
+    return sizeof(double) * elements;
+}
+}
+
+DiskIOQueue &DiskIOQueue::instance()
+{
+    static DiskIOQueue queue;
+    return queue;
+}
+
+DiskIOQueue::DiskIOQueue() : thread_(&DiskIOQueue::run, this) {}
+
+DiskIOQueue::~DiskIOQueue()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    work_.notify_one();
+    thread_.join();
+}
+
+size_t DiskIOQueue::read(int fd, double *buffer, const Segments &segments)
+{
+    timer::add_bytes(transferred_bytes(segments));
+    return submit(Request{0, false, fd, buffer, segments});
+}
+
+size_t DiskIOQueue::write(int fd, const double *buffer,
+                          const Segments &segments)
+{
+    timer::add_bytes(transferred_bytes(segments));
+    return submit(Request{0, true, fd, const_cast<double *>(buffer), segments});
+}
+
+size_t DiskIOQueue::submit(Request request)
+{
+    size_t ticket;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        ticket = request.ticket = ++submitted_;
+        pending_.push_back(std::move(request));
+    }
+    work_.notify_one();
+    return ticket;
+}
+
+void DiskIOQueue::wait(size_t ticket)
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    done_.wait(lock, [&]() { return completed_ >= ticket; });
+
+    auto error = errors_.find(ticket);
+    if (error != errors_.end())
+    {
+        std::string message = error->second;
+        errors_.erase(error);
+        throw std::runtime_error(message);
+    }
+}
+
+void DiskIOQueue::run()
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true)
+    {
+        work_.wait(lock, [&]() { return stop_ || !pending_.empty(); });
+        if (pending_.empty())
+            return;
+
+        Request request = std::move(pending_.front());
+        pending_.pop_front();
+        lock.unlock();
+
+        bool ok = true;
+        double *buffer = request.buffer;
+        for (const auto &segment : request.segments)
+        {
+            ok = ok && transfer(request.write, request.fd, buffer,
+                                segment.first, segment.second);
+            buffer += segment.second;
+        }
+        std::string error =
+            ok ? std::string()
+               : std::string("DiskIOQueue: unable to ") +
+                     (request.write ? "write: " : "read: ") +
+                     std::strerror(errno);
+
+        lock.lock();
+        if (!ok)
+            errors_[request.ticket] = error;
+        completed_ = request.ticket;
+        done_.notify_all();
+    }
+}
+}
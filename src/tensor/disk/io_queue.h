@@ -0,0 +1,103 @@
+/*
+ * @BEGIN LICENSE
+ *
+ * ambit: C++ library for the implementation of tensor product calculations
+ *        through a clean, concise user interface.
+ *
+ * Copyright (c) 2014-2017 Ambit developers.
+ *
+ * The copyrights for code used from other parties are included in
+ * the corresponding files.
+ *
+ * This file is part of ambit.
+ *
+ * Ambit is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * Ambit is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with ambit; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * @END LICENSE
+ */
+
+
+#if !defined(TENSOR_DISK_IO_QUEUE_H)
+#define TENSOR_DISK_IO_QUEUE_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace ambit
+{
+
+/**
+ * Background thread that performs the positioned reads and writes of disk
+ * tensor files, so that callers can compute on one tile while the next is
+ * being transferred.
+ *
+ * A request moves a list of segments (element offset in the file, number
+ * of elements) to or from consecutive positions of a buffer. Requests run
+ * one at a time in the order they were submitted, so a read queued after a
+ * write of the same buffer sees the buffer only once the write is done.
+ * Submitting returns a ticket to wait on; I/O errors are thrown from wait.
+ */
+class DiskIOQueue
+{
+  public:
+    typedef std::vector<std::pair<size_t, size_t>> Segments;
+
+    /// The queue shared by all disk tensors
+    static DiskIOQueue &instance();
+
+    ~DiskIOQueue();
+
+    size_t read(int fd, double *buffer, const Segments &segments);
+    size_t write(int fd, const double *buffer, const Segments &segments);
+
+    /// Blocks until the request with this ticket has run. Ticket 0 is
+    /// always complete.
+    void wait(size_t ticket);
+
+  private:
+    DiskIOQueue();
+
+    struct Request
+    {
+        size_t ticket;
+        bool write;
+        int fd;
+        double *buffer;
+        Segments segments;
+    };
+
+    size_t submit(Request request);
+    void run();
+
+    std::mutex mutex_;
+    std::condition_variable work_;
+    std::condition_variable done_;
+    std::deque<Request> pending_;
+    /// Tickets of failed requests that have not been waited on
+    std::map<size_t, std::string> errors_;
+    size_t submitted_ = 0;
+    size_t completed_ = 0;
+    bool stop_ = false;
+    std::thread thread_;
+};
+}
+
+#endif
@@ -0,0 +1,218 @@
+/*
+ * @BEGIN LICENSE
+ *
+ * ambit: C++ library for the implementation of tensor product calculations
+ *        through a clean, concise user interface.
+ *
+ * Copyright (c) 2014-2017 Ambit developers.
+ *
+ * The copyrights for code used from other parties are included in
+ * the corresponding files.
+ *
+ * This file is part of ambit.
+ *
+ * Ambit is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * Ambit is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with ambit; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * @END LICENSE
+ */
+
+#include "codec.h"
+
+#include <cstring>
+#include <stdexcept>
+
+namespace ambit
+{
+
+namespace codec
+{
+
+namespace
+{
+
+/// Shortest back-reference worth encoding
+constexpr size_t min_match = 4;
+/// Farthest back-reference (offsets are stored in 16 bits)
+constexpr size_t max_offset = 65535;
+/// Entries in the match finder's hash table
+constexpr size_t hash_bits = 14;
+
+char *put_varint(char *out, size_t value)
+{
+    while (value >= 0x80)
+    {
+        *out++ = static_cast<char>((value & 0x7f) | 0x80);
+        value >>= 7;
+    }
+    *out++ = static_cast<char>(value);
+    return out;
+}
+
+size_t get_varint(const unsigned char *&in, const unsigned char *end)
+{
+    size_t value = 0;
+    for (int shift = 0; shift < 64; shift += 7)
+    {
+        if (in == end)
+            throw std::runtime_error("codec::unpack: truncated chunk");
+        unsigned char byte = *in++;
+        value |= static_cast<size_t>(byte & 0x7f) << shift;
+        if (!(byte & 0x80))
+            return value;
+    }
+    throw std::runtime_error("codec::unpack: malformed chunk");
+}
+
+uint32_t read32(const unsigned char *p)
+{
+    uint32_t value;
+    std::memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+size_t hash(uint32_t value)
+{
+    return (value * 2654435761u) >> (32 - hash_bits);
+}
+
+/// Sequences of (literal count, literals, match length, match offset); the
+/// match length counts from min_match, with 0 standing for no match.
+std::vector<char> compress(const unsigned char *in, size_t n)
+{
+    // Every sequence takes fewer bytes than it covers, give or take the
+    // varints
+    std::vector<char> packed(n + n / 64L + 64L);
+    char *out = packed.data();
+    std::vector<size_t> table(size_t(1) << hash_bits, 0);
+
+    size_t literal = 0L;
+    size_t pos = 0L;
+    while (pos + min_match <= n)
+    {
+        size_t h = hash(read32(in + pos));
+        // Positions are stored plus one, so that 0 means empty
+        size_t candidate = table[h];
+        table[h] = pos + 1L;
+        if (candidate == 0L || pos + 1L - candidate > max_offset ||
+            read32(in + candidate - 1L) != read32(in + pos))
+        {
+            // Stride faster through data that does not compress
+            pos += 1L + ((pos - literal) >> 6);
+            continue;
+        }
+        size_t from = candidate - 1L;
+        size_t length = min_match;
+        while (pos + length < n && in[from + length] == in[pos + length])
+            length++;
+
+        out = put_varint(out, pos - literal);
+        std::memcpy(out, in + literal, pos - literal);
+        out += pos - literal;
+        out = put_varint(out, length - min_match + 1L);
+        size_t offset = pos - from;
+        *out++ = static_cast<char>(offset & 0xff);
+        *out++ = static_cast<char>(offset >> 8);
+
+        pos += length;
+        literal = pos;
+    }
+    out = put_varint(out, n - literal);
+    if (n > literal)
+        std::memcpy(out, in + literal, n - literal);
+    out += n - literal;
+    out = put_varint(out, 0L);
+
+    packed.resize(out - packed.data());
+    return packed;
+}
+
+void decompress(const unsigned char *in, size_t nbytes, unsigned char *out,
+                size_t n)
+{
+    const unsigned char *end = in + nbytes;
+    size_t pos = 0L;
+    while (in != end)
+    {
+        size_t literals = get_varint(in, end);
+        if (literals > static_cast<size_t>(end - in) || literals > n - pos)
+            throw std::runtime_error("codec::unpack: malformed chunk");
+        std::memcpy(out + pos, in, literals);
+        in += literals;
+        pos += literals;
+
+        size_t length = get_varint(in, end);
+        if (length == 0L)
+            continue;
+        length += min_match - 1L;
+        if (end - in < 2)
+            throw std::runtime_error("codec::unpack: truncated chunk");
+        size_t offset = in[0] | (static_cast<size_t>(in[1]) << 8);
+        in += 2;
+        if (offset == 0L || offset > pos || length > n - pos)
+            throw std::runtime_error("codec::unpack: malformed chunk");
+        if (offset >= length)
+        {
+            std::memcpy(out + pos, out + pos - offset, length);
+            pos += length;
+        }
+        else
+        {
+            // Byte by byte: the source overlaps what is being written
+            for (size_t k = 0L; k < length; k++, pos++)
+                out[pos] = out[pos - offset];
+        }
+    }
+    if (pos != n)
+        throw std::runtime_error("codec::unpack: truncated chunk");
+}
+}
+
+std::vector<char> pack(const double *data, size_t n)
+{
+    const unsigned char *bytes = reinterpret_cast<const unsigned char *>(data);
+    std::vector<unsigned char> shuffled(n * sizeof(double));
+    for (size_t i = 0L; i < n; i++)
+        for (size_t j = 0L; j < sizeof(double); j++)
+            shuffled[j * n + i] = bytes[i * sizeof(double) + j];
+    return compress(shuffled.data(), shuffled.size());
+}
+
+void unpack(const char *bytes, size_t nbytes, double *data, size_t n)
+{
+    std::vector<unsigned char> shuffled(n * sizeof(double));
+    decompress(reinterpret_cast<const unsigned char *>(bytes), nbytes,
+               shuffled.data(), shuffled.size());
+    unsigned char *out = reinterpret_cast<unsigned char *>(data);
+    for (size_t i = 0L; i < n; i++)
+        for (size_t j = 0L; j < sizeof(double); j++)
+            out[i * sizeof(double) + j] = shuffled[j * n + i];
+}
+
+uint64_t checksum(const char *bytes, size_t nbytes)
+{
+    const uint64_t prime = 1099511628211ULL;
+    uint64_t sum = 14695981039346656037ULL;
+    size_t words = nbytes / sizeof(uint64_t);
+    for (size_t k = 0L; k < words; k++)
+    {
+        uint64_t word;
+        std::memcpy(&word, bytes + k * sizeof(uint64_t), sizeof(word));
+        sum = (sum ^ word) * prime;
+    }
+    for (size_t k = words * sizeof(uint64_t); k < nbytes; k++)
+        sum = (sum ^ static_cast<unsigned char>(bytes[k])) * prime;
+    return (sum ^ nbytes) * prime;
+}
+}
+}
@@ -0,0 +1,63 @@
+/*
+ * @BEGIN LICENSE
+ *
+ * ambit: C++ library for the implementation of tensor product calculations
+ *        through a clean, concise user interface.
+ *
+ * Copyright (c) 2014-2017 Ambit developers.
+ *
+ * The copyrights for code used from other parties are included in
+ * the corresponding files.
+ *
+ * This file is part of ambit.
+ *
+ * Ambit is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * Ambit is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with ambit; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * @END LICENSE
+ */
+
+#if !defined(TENSOR_FILE_CODEC_H)
+#define TENSOR_FILE_CODEC_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace ambit
+{
+
+/**
+ * Lossless packing of chunks of doubles for tensor files.
+ *
+ * Doubles are byte-shuffled first: byte j of every element is stored next to
+ * byte j of the others, so that the sign/exponent bytes of smooth or sparse
+ * data form long repeated runs. The shuffled bytes are then compressed by a
+ * small LZ77 coder (literal runs and back-references within 64 KB).
+ */
+namespace codec
+{
+
+/// Packs n doubles
+std::vector<char> pack(const double *data, size_t n);
+
+/// Unpacks exactly n doubles from bytes; throws std::runtime_error on
+/// malformed input
+void unpack(const char *bytes, size_t nbytes, double *data, size_t n);
+
+/// 64-bit FNV-1a style checksum of nbytes bytes
+uint64_t checksum(const char *bytes, size_t nbytes);
+}
+}
+
+#endif
@@ -0,0 +1,345 @@
+/*
+ * @BEGIN LICENSE
+ *
+ * ambit: C++ library for the implementation of tensor product calculations
+ *        through a clean, concise user interface.
+ *
+ * Copyright (c) 2014-2017 Ambit developers.
+ *
+ * The copyrights for code used from other parties are included in
+ * the corresponding files.
+ *
+ * This file is part of ambit.
+ *
+ * Ambit is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * Ambit is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with ambit; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * @END LICENSE
+ */
+
+#include "tensor_file.h"
+#include "codec.h"
+
+#include <ambit/settings.h>
+
+#include <algorithm>
+#include <cstring>
+#include <exception>
+#include <istream>
+#include <ostream>
+#include <stdexcept>
+
+#if defined(_OPENMP)
+#include <omp.h>
+#endif
+
+namespace ambit
+{
+
+namespace
+{
+
+const char record_magic[8] = {'A', 'M', 'B', 'I', 'T', 'T', 'N', 'S'};
+
+/// Chunks handled per pass over the stream
+size_t chunk_batch()
+{
+#if defined(_OPENMP)
+    return static_cast<size_t>(std::max(omp_get_max_threads(), 1));
+#else
+    return 1L;
+#endif
+}
+
+size_t align(size_t offset)
+{
+    return (offset + tensor_file_alignment - 1L) / tensor_file_alignment *
+           tensor_file_alignment;
+}
+
+template <typename T> void put(std::ostream &out, T value)
+{
+    out.write(reinterpret_cast<const char *>(&value), sizeof(T));
+}
+
+template <typename T> T get(std::istream &in)
+{
+    T value;
+    in.read(reinterpret_cast<char *>(&value), sizeof(T));
+    if (!in)
+        throw std::runtime_error("read_tensor_record: truncated header");
+    return value;
+}
+
+void put_header(std::ostream &out, const TensorRecord &record)
+{
+    out.write(record_magic, sizeof(record_magic));
+    put<uint32_t>(out, tensor_file_version);
+    put<uint32_t>(out, 0); // reserved
+    put<uint64_t>(out, record.bytes);
+    put<uint64_t>(out, record.name.size());
+    out.write(record.name.data(), record.name.size());
+    put<uint64_t>(out, record.dims.size());
+    for (size_t dim : record.dims)
+        put<uint64_t>(out, dim);
+    put<uint64_t>(out, record.slab_rows);
+    for (const TensorChunk &chunk : record.chunks)
+    {
+        put<uint64_t>(out, chunk.offset);
+        put<uint64_t>(out, chunk.bytes);
+        put<uint64_t>(out, chunk.checksum);
+        put<uint64_t>(out, chunk.encoding);
+    }
+}
+
+/// Runs body(k) for k in [0, n) in parallel, rethrowing the first error
+void parallel_for(size_t n, const std::function<void(size_t)> &body)
+{
+    std::exception_ptr error;
+#pragma omp parallel for schedule(dynamic, 1)
+    for (size_t k = 0; k < n; ++k)
+    {
+        try
+        {
+            body(k);
+        }
+        catch (...)
+        {
+#pragma omp critical(ambit_tensor_file_error)
+            if (!error)
+                error = std::current_exception();
+        }
+    }
+    if (error)
+        std::rethrow_exception(error);
+}
+}
+
+void TensorRecord::plan(const Dimension &tensor_dims)
+{
+    dims = tensor_dims;
+    size_t row_bytes = std::max(row_elements() * sizeof(double), size_t(1));
+    slab_rows = std::max(tensor_file_chunk_bytes / row_bytes, size_t(1));
+    size_t nchunks = (rows() + slab_rows - 1L) / slab_rows;
+    chunks.assign(nchunks, TensorChunk{0, 0, 0, RawChunk});
+}
+
+size_t TensorRecord::rows() const { return dims.empty() ? 1L : dims[0]; }
+
+size_t TensorRecord::row_elements() const
+{
+    size_t n = 1L;
+    for (size_t k = 1L; k < dims.size(); k++)
+        n *= dims[k];
+    return n;
+}
+
+size_t TensorRecord::chunk_rows(size_t c) const
+{
+    return std::min(slab_rows, rows() - first_row(c));
+}
+
+bool at_tensor_record(std::istream &in)
+{
+    char magic[sizeof(record_magic)];
+    std::streampos position = in.tellg();
+    in.read(magic, sizeof(magic));
+    bool found = in.gcount() == sizeof(magic) &&
+                 std::memcmp(magic, record_magic, sizeof(magic)) == 0;
+    in.clear();
+    in.seekg(position);
+    return found;
+}
+
+void write_tensor_record(
+    std::ostream &out, const string &name, const Dimension &dims,
+    const std::function<const double *(size_t, double *)> &source)
+{
+    TensorRecord record;
+    record.name = name;
+    record.plan(dims);
+    record.start = static_cast<int64_t>(out.tellp());
+
+    // The table is written again once the chunks are in place
+    put_header(out, record);
+    size_t offset =
+        static_cast<size_t>(static_cast<int64_t>(out.tellp()) - record.start);
+
+    size_t nchunks = record.chunks.size();
+    size_t batch = chunk_batch();
+    vector<vector<double>> buffers(batch);
+    vector<const double *> raw(batch);
+    vector<vector<char>> packed(batch);
+    const vector<char> padding(tensor_file_alignment, 0);
+
+    for (size_t first = 0L; first < nchunks; first += batch)
+    {
+        size_t count = std::min(batch, nchunks - first);
+        for (size_t k = 0L; k < count; k++)
+        {
+            buffers[k].resize(record.chunk_elements(first + k));
+            raw[k] = source(first + k, buffers[k].data());
+        }
+
+        parallel_for(count, [&](size_t k) {
+            TensorChunk &chunk = record.chunks[first + k];
+            size_t n = record.chunk_elements(first + k);
+            const char *bytes = reinterpret_cast<const char *>(raw[k]);
+            chunk.encoding = RawChunk;
+            chunk.bytes = n * sizeof(double);
+            packed[k].clear();
+            if (settings::compress_tensor_files)
+            {
+                packed[k] = codec::pack(raw[k], n);
+                if (packed[k].size() < chunk.bytes)
+                {
+                    chunk.encoding = PackedChunk;
+                    chunk.bytes = packed[k].size();
+                    bytes = packed[k].data();
+                }
+            }
+            chunk.checksum = codec::checksum(bytes, chunk.bytes);
+        });
+
+        for (size_t k = 0L; k < count; k++)
+        {
+            TensorChunk &chunk = record.chunks[first + k];
+            chunk.offset = align(offset);
+            out.write(padding.data(), chunk.offset - offset);
+            const char *bytes =
+                chunk.encoding == PackedChunk
+                    ? packed[k].data()
+                    : reinterpret_cast<const char *>(raw[k]);
+            out.write(bytes, chunk.bytes);
+            offset = chunk.offset + chunk.bytes;
+        }
+    }
+
+    record.bytes = offset;
+    out.seekp(record.start);
+    put_header(out, record);
+    out.seekp(record.start + static_cast<std::streamoff>(record.bytes));
+    if (!out)
+        throw std::runtime_error("write_tensor_record: unable to write " +
+                                 name);
+}
+
+uint64_t tensor_record_bound(const string &name, const Dimension &dims)
+{
+    TensorRecord record;
+    record.name = name;
+    record.plan(dims);
+
+    // The fields of put_header, then every chunk stored raw
+    size_t offset = sizeof(record_magic) + 2 * sizeof(uint32_t) +
+                    sizeof(uint64_t) * (4 + dims.size()) + name.size() +
+                    sizeof(TensorChunk) * record.chunks.size();
+    for (size_t c = 0L; c < record.chunks.size(); c++)
+        offset = align(offset) + record.chunk_elements(c) * sizeof(double);
+    return offset;
+}
+
+TensorRecord read_tensor_record(std::istream &in)
+{
+    TensorRecord record;
+    record.start = static_cast<int64_t>(in.tellg());
+
+    char magic[sizeof(record_magic)];
+    in.read(magic, sizeof(magic));
+    if (!in || std::memcmp(magic, record_magic, sizeof(magic)) != 0)
+        throw std::runtime_error("read_tensor_record: not a tensor record");
+    uint32_t version = get<uint32_t>(in);
+    if (version > tensor_file_version)
+        throw std::runtime_error(
+            "read_tensor_record: record format version " +
+            std::to_string(version) + " is newer than this library");
+    get<uint32_t>(in); // reserved
+
+    record.bytes = get<uint64_t>(in);
+    record.name.resize(get<uint64_t>(in));
+    in.read(&record.name[0], record.name.size());
+    record.dims.resize(get<uint64_t>(in));
+    for (size_t &dim : record.dims)
+        dim = get<uint64_t>(in);
+    record.slab_rows = get<uint64_t>(in);
+    if (record.slab_rows == 0L)
+        throw std::runtime_error("read_tensor_record: malformed header");
+    record.chunks.resize((record.rows() + record.slab_rows - 1L) /
+                         record.slab_rows);
+    for (TensorChunk &chunk : record.chunks)
+    {
+        chunk.offset = get<uint64_t>(in);
+        chunk.bytes = get<uint64_t>(in);
+        chunk.checksum = get<uint64_t>(in);
+        chunk.encoding = get<uint64_t>(in);
+    }
+    return record;
+}
+
+void read_tensor_chunks(
+    std::istream &in, const TensorRecord &record, size_t first, size_t last,
+    const std::function<double *(size_t)> &destination,
+    const std::function<void(size_t, const double *)> &consume)
+{
+    size_t batch = chunk_batch();
+    vector<vector<char>> stored(batch);
+    vector<vector<double>> buffers(batch);
+    vector<double *> targets(batch);
+
+    for (size_t begin = first; begin < last; begin += batch)
+    {
+        size_t count = std::min(batch, last - begin);
+        for (size_t k = 0L; k < count; k++)
+        {
+            const TensorChunk &chunk = record.chunks[begin + k];
+            stored[k].resize(chunk.bytes);
+            in.seekg(record.start + static_cast<std::streamoff>(chunk.offset));
+            in.read(stored[k].data(), chunk.bytes);
+            if (!in)
+                throw std::runtime_error("read_tensor_chunks: " +
+                                         record.name + " is truncated");
+            targets[k] = destination(begin + k);
+            if (targets[k] == nullptr)
+            {
+                buffers[k].resize(record.chunk_elements(begin + k));
+                targets[k] = buffers[k].data();
+            }
+        }
+
+        parallel_for(count, [&](size_t k) {
+            const TensorChunk &chunk = record.chunks[begin + k];
+            size_t n = record.chunk_elements(begin + k);
+            if (codec::checksum(stored[k].data(), chunk.bytes) !=
+                chunk.checksum)
+                throw std::runtime_error(
+                    "read_tensor_chunks: checksum mismatch in chunk " +
+                    std::to_string(begin + k) + " of " + record.name);
+            if (chunk.encoding == PackedChunk)
+                codec::unpack(stored[k].data(), chunk.bytes, targets[k], n);
+            else if (chunk.encoding == RawChunk &&
+                     chunk.bytes == n * sizeof(double))
+            {
+                if (n > 0L)
+                    std::memcpy(targets[k], stored[k].data(), chunk.bytes);
+            }
+            else
+                throw std::runtime_error("read_tensor_chunks: chunk " +
+                                         std::to_string(begin + k) + " of " +
+                                         record.name + " is malformed");
+        });
+
+        for (size_t k = 0L; k < count; k++)
+            consume(begin + k, targets[k]);
+    }
+}
+}
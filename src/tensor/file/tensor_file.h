@@ -0,0 +1,149 @@
+/*
+ * @BEGIN LICENSE
+ *
+ * ambit: C++ library for the implementation of tensor product calculations
+ *        through a clean, concise user interface.
+ *
+ * Copyright (c) 2014-2017 Ambit developers.
+ *
+ * The copyrights for code used from other parties are included in
+ * the corresponding files.
+ *
+ * This file is part of ambit.
+ *
+ * Ambit is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * Ambit is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with ambit; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * @END LICENSE
+ */
+
+#if !defined(TENSOR_FILE_TENSOR_FILE_H)
+#define TENSOR_FILE_TENSOR_FILE_H
+
+#include <ambit/tensor.h>
+
+#include <cstdint>
+#include <functional>
+#include <iosfwd>
+
+namespace ambit
+{
+
+/**
+ * Chunked tensor records, the format of save() and write_tensor_to_file().
+ *
+ * A record is a header (magic, format version, name, dims and a table of
+ * chunks) followed by the chunks. Each chunk holds whole slabs of the
+ * leading index, starts at a multiple of tensor_file_alignment bytes from
+ * the start of the record and carries a checksum of its stored bytes.
+ * Chunks are packed with codec::pack when settings::compress_tensor_files
+ * is set and packing makes them smaller; otherwise they are stored raw.
+ *
+ * Chunks are packed, checked and unpacked in parallel, a batch of them per
+ * pass over the stream.
+ */
+
+/// Current version of the record format
+constexpr uint32_t tensor_file_version = 1;
+
+/// Alignment of the chunks within a record, in bytes
+constexpr size_t tensor_file_alignment = 4096;
+
+/// Target size of a chunk, in bytes; chunks hold at least one slab
+constexpr size_t tensor_file_chunk_bytes = 4 * 1024 * 1024;
+
+enum TensorChunkEncoding
+{
+    RawChunk = 0,   // <= The doubles as they are in memory
+    PackedChunk = 1 // <= codec::pack
+};
+
+struct TensorChunk
+{
+    /// Position of the chunk from the start of the record
+    uint64_t offset;
+    /// Stored bytes
+    uint64_t bytes;
+    /// codec::checksum of the stored bytes
+    uint64_t checksum;
+    /// A TensorChunkEncoding
+    uint64_t encoding;
+};
+
+struct TensorRecord
+{
+    string name;
+    Dimension dims;
+    /// Leading index values per chunk
+    size_t slab_rows = 1L;
+    vector<TensorChunk> chunks;
+    /// Size of the whole record, in bytes
+    uint64_t bytes = 0L;
+    /// Position of the record in its stream
+    int64_t start = 0L;
+
+    /// Lays out the chunks of a tensor of the given dims
+    void plan(const Dimension &tensor_dims);
+
+    /// Leading index values of the tensor (1 for a scalar)
+    size_t rows() const;
+    /// Elements per leading index value
+    size_t row_elements() const;
+    /// First leading index value of chunk c
+    size_t first_row(size_t c) const { return c * slab_rows; }
+    /// Leading index values held by chunk c
+    size_t chunk_rows(size_t c) const;
+    size_t chunk_elements(size_t c) const
+    {
+        return chunk_rows(c) * row_elements();
+    }
+};
+
+/// True if the stream is positioned at a chunked record (the position is
+/// left unchanged)
+bool at_tensor_record(std::istream &in);
+
+/**
+ * Writes the record of a tensor of the given name and dims to out.
+ *
+ * source(c, buffer) is called in chunk order and returns the
+ * chunk_elements(c) doubles of chunk c, either in place or after filling
+ * buffer with them.
+ */
+void write_tensor_record(
+    std::ostream &out, const string &name, const Dimension &dims,
+    const std::function<const double *(size_t, double *)> &source);
+
+/// The largest record write_tensor_record can write for a tensor of the
+/// given name and dims (all chunks raw), in bytes
+uint64_t tensor_record_bound(const string &name, const Dimension &dims);
+
+/// Reads the header of the record at the current position of in and leaves
+/// the stream past the header
+TensorRecord read_tensor_record(std::istream &in);
+
+/**
+ * Reads chunks [first, last) of a record whose header has been read.
+ *
+ * destination(c) returns where chunk c should be unpacked, or null to have
+ * it unpacked into an internal buffer. consume(c, data) is then called in
+ * chunk order with the chunk in place. Throws std::runtime_error if a
+ * checksum does not match.
+ */
+void read_tensor_chunks(
+    std::istream &in, const TensorRecord &record, size_t first, size_t last,
+    const std::function<double *(size_t)> &destination,
+    const std::function<void(size_t, const double *)> &consume);
+}
+
+#endif
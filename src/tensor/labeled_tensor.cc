@@ -31,8 +31,11 @@
 #include <algorithm>
 #include <numeric>
 #include <ambit/tensor.h>
+#include <ambit/memory.h>
+#include <ambit/timer.h>
 #include "tensorimpl.h"
 #include "indices.h"
+#include <chrono>
 #include <cstring>
 
 namespace ambit
@@ -135,84 +138,154 @@ LabeledTensor tensor_product_get_temp_AB(const LabeledTensor &A,
         Tensor::build(A.T().type(), A.T().name() + " * " + B.T().name(), dims);
     return T(indices::to_string(indices));
 }
+
+// Dimensions of the intermediate of A and B carrying indices
+Dimension contraction_dims(const LabeledTensor &A, const LabeledTensor &B,
+                           const Indices &indices)
+{
+    Dimension dims;
+    for (const string &index : indices)
+    {
+        if (std::find(A.indices().begin(), A.indices().end(), index) !=
+            A.indices().end())
+            dims.push_back(A.dim_by_index(index));
+        else
+            dims.push_back(B.dim_by_index(index));
+    }
+    return dims;
 }
 
-void LabeledTensor::contract(const LabeledTensorContraction &rhs,
-                             bool zero_result, bool add, bool optimize_order)
+// Flops of contracting A with B: two for each element of the union of
+// their indices
+double contraction_flops(const LabeledTensor &A, const LabeledTensor &B)
 {
-    size_t nterms = rhs.size();
-    std::vector<size_t> perm(nterms);
-    std::vector<size_t> best_perm(nterms);
-    std::iota(perm.begin(), perm.end(), 0);
-    std::pair<double, double> best_cpu_memory_cost(1.0e200, 1.0e200);
+    double flops = 2.0 * A.T().numel();
+    for (const string &index : B.indices())
+    {
+        if (std::find(A.indices().begin(), A.indices().end(), index) ==
+            A.indices().end())
+            flops *= B.dim_by_index(index);
+    }
+    return flops;
+}
 
-    if (optimize_order) {
-        do
-        {
-            std::pair<double, double> cpu_memory_cost =
-                rhs.compute_contraction_cost(perm);
-            if (cpu_memory_cost.first < best_cpu_memory_cost.first)
-            {
-                best_perm = perm;
-                best_cpu_memory_cost = cpu_memory_cost;
-            }
-        } while (std::next_permutation(perm.begin(), perm.end()));
-        // at this point 'best_perm' should be used to perform contraction in
-        // optimal order.
-    } else {
-        best_perm = perm;
+// Whether the addends of B can be summed before being contracted: in-core
+// tensors carrying the same labels with the same dimensions, whose sum fits
+// in the memory left under settings::memory_limit.
+bool conformable_addends(const LabeledTensorAddition &B)
+{
+    if (B.size() < 2)
+        return false;
+
+    const LabeledTensor &first = B[0];
+    Indices labels = first.indices();
+    std::sort(labels.begin(), labels.end());
+    if (std::adjacent_find(labels.begin(), labels.end()) != labels.end())
+        return false;
+
+    for (const LabeledTensor &term : B)
+    {
+        Indices term_labels = term.indices();
+        std::sort(term_labels.begin(), term_labels.end());
+        if (term.T().type() != CoreTensor || term_labels != labels)
+            return false;
+        for (const string &index : first.indices())
+            if (term.dim_by_index(index) != first.dim_by_index(index))
+                return false;
     }
 
-    const LabeledTensor &Aref = rhs[best_perm[0]];
-    LabeledTensor A(Aref.T_, Aref.indices_, Aref.factor_);
-    int maxn = int(nterms) - 2;
-    for (int n = 0; n < maxn; ++n)
+    size_t bytes = first.T().numel() * sizeof(double);
+    size_t used = memory::current_in_core();
+    return used < settings::memory_limit &&
+           bytes <= settings::memory_limit - used;
+}
+
+// The sum of the addends of B, labeled like its first term
+LabeledTensor sum_addends(const LabeledTensorAddition &B)
+{
+    vector<Tensor> As;
+    vector<Indices> Ainds;
+    vector<double> alphas;
+    string name;
+    for (const LabeledTensor &term : B)
     {
-        const LabeledTensor &B = rhs[best_perm[n + 1]];
+        As.push_back(term.T());
+        Ainds.push_back(term.indices());
+        alphas.push_back(term.factor());
+        name += (name.empty() ? "" : " + ") + term.T().name();
+    }
 
-        std::vector<Indices> AB_indices =
-            indices::determine_contraction_result(A, B);
-        const Indices &AB_common_idx = AB_indices[0];
-        const Indices &A_fix_idx = AB_indices[1];
-        const Indices &B_fix_idx = AB_indices[2];
-        Dimension dims;
-        Indices indices;
+    Tensor S = Tensor::build(CoreTensor, name, B[0].T().dims());
+    S.permute(As, B[0].indices(), Ainds, alphas, 0.0);
+    return LabeledTensor(S, B[0].indices(), 1.0);
+}
+}
 
-        for (size_t i = 0; i < AB_common_idx.size(); ++i)
-        {
-            // If a common index is also found in the rhs it's a Hadamard index
-            if (std::find(this->indices().begin(), this->indices().end(),
-                          AB_common_idx[i]) != this->indices().end())
-            {
-                dims.push_back(A.dim_by_index(AB_common_idx[i]));
-                indices.push_back(AB_common_idx[i]);
-            }
-        }
+void LabeledTensor::contract(const LabeledTensorContraction &rhs,
+                             bool zero_result, bool add, bool optimize_order)
+{
+    bool log = timer::contraction_logging();
+    auto start = std::chrono::steady_clock::now();
+    double flops = 0.0;
 
-        for (size_t i = 0; i < A_fix_idx.size(); ++i)
-        {
-            dims.push_back(A.dim_by_index(A_fix_idx[i]));
-            indices.push_back(A_fix_idx[i]);
-        }
-        for (size_t i = 0; i < B_fix_idx.size(); ++i)
-        {
-            dims.push_back(B.dim_by_index(B_fix_idx[i]));
-            indices.push_back(B_fix_idx[i]);
-        }
+    ContractionTree tree = rhs.contraction_tree(indices_, optimize_order);
+    size_t nterms = tree.nleaves();
+    size_t root = tree.nodes.size() - 1;
+
+    // Intermediates that have not been consumed yet, by node
+    std::map<size_t, LabeledTensor> intermediates;
+    auto operand = [&](size_t node) -> const LabeledTensor & {
+        return node < nterms ? rhs[node] : intermediates.at(node);
+    };
+
+    for (size_t node = nterms; node < root; ++node)
+    {
+        const ContractionTree::Node &step = tree.nodes[node];
+        const LabeledTensor &A = operand(step.left);
+        const LabeledTensor &B = operand(step.right);
 
         Tensor tAB = Tensor::build(A.T().type(),
-                                   A.T().name() + " * " + B.T().name(), dims);
+                                   A.T().name() + " * " + B.T().name(),
+                                   contraction_dims(A, B, step.indices));
 
-        tAB.contract(A.T(), B.T(), indices, A.indices(), B.indices(),
+        tAB.contract(A.T(), B.T(), step.indices, A.indices(), B.indices(),
                      A.factor() * B.factor(), 0.0);
+        flops += contraction_flops(A, B);
 
-        A.set(LabeledTensor(tAB, indices, 1.0));
+        intermediates.erase(step.left);
+        intermediates.erase(step.right);
+        intermediates.insert(
+            std::make_pair(node, LabeledTensor(tAB, step.indices, 1.0)));
     }
-    const LabeledTensor &B = rhs[best_perm[nterms - 1]];
+
+    const LabeledTensor &A = operand(tree.nodes[root].left);
+    const LabeledTensor &B = operand(tree.nodes[root].right);
 
     T_.contract(A.T(), B.T(), indices(), A.indices(), B.indices(),
                 add ? A.factor() * B.factor() : -A.factor() * B.factor(),
                 zero_result ? 0.0 : 1.0);
+    flops += contraction_flops(A, B);
+
+    if (log)
+    {
+        timer::ContractionRecord record;
+        record.operation = "labeled contract";
+        record.expression = T_.name() + "[" + indices::to_string(indices_) +
+                            "] " + (zero_result ? "=" : (add ? "+=" : "-="));
+        record.dims.push_back(T_.dims());
+        for (size_t term = 0; term < nterms; ++term)
+        {
+            record.expression += string(term == 0 ? " " : " * ") +
+                                 rhs[term].T().name() + "[" +
+                                 indices::to_string(rhs[term].indices()) + "]";
+            record.dims.push_back(rhs[term].T().dims());
+        }
+        record.seconds = std::chrono::duration<double>(
+                             std::chrono::steady_clock::now() - start)
+                             .count();
+        record.flops = flops;
+        timer::log_contraction(record);
+    }
 }
 
 void LabeledTensor::operator=(const LabeledTensorContraction &rhs)
@@ -245,44 +318,38 @@ void LabeledTensor::operator-=(const LabeledTensorBatchedContraction &rhs)
     contract_batched(rhs, false, false);
 }
 
-void LabeledTensor::operator=(const LabeledTensorAddition &rhs)
+void LabeledTensor::add(const LabeledTensorAddition &rhs, double sign,
+                        double beta)
 {
-    T_.zero();
+    vector<Tensor> As;
+    vector<Indices> Ainds;
+    vector<double> alphas;
     for (size_t ind = 0, end = rhs.size(); ind < end; ++ind)
     {
         if (T_ == rhs[ind].T())
             throw std::runtime_error("Self assignment is not allowed.");
         if (T_.rank() != rhs[ind].T().rank())
             throw std::runtime_error("Permuted tensors do not have same rank");
-        T_.permute(rhs[ind].T(), indices_, rhs[ind].indices(),
-                   rhs[ind].factor(), 1.0);
+        As.push_back(rhs[ind].T());
+        Ainds.push_back(rhs[ind].indices());
+        alphas.push_back(sign * rhs[ind].factor());
     }
+    T_.permute(As, indices_, Ainds, alphas, beta);
+}
+
+void LabeledTensor::operator=(const LabeledTensorAddition &rhs)
+{
+    add(rhs, 1.0, 0.0);
 }
 
 void LabeledTensor::operator+=(const LabeledTensorAddition &rhs)
 {
-    for (size_t ind = 0, end = rhs.size(); ind < end; ++ind)
-    {
-        if (T_ == rhs[ind].T())
-            throw std::runtime_error("Self assignment is not allowed.");
-        if (T_.rank() != rhs[ind].T().rank())
-            throw std::runtime_error("Permuted tensors do not have same rank");
-        T_.permute(rhs[ind].T(), indices_, rhs[ind].indices(),
-                   rhs[ind].factor(), 1.0);
-    }
+    add(rhs, 1.0, 1.0);
 }
 
 void LabeledTensor::operator-=(const LabeledTensorAddition &rhs)
 {
-    for (size_t ind = 0, end = rhs.size(); ind < end; ++ind)
-    {
-        if (T_ == rhs[ind].T())
-            throw std::runtime_error("Self assignment is not allowed.");
-        if (T_.rank() != rhs[ind].T().rank())
-            throw std::runtime_error("Permuted tensors do not have same rank");
-        T_.permute(rhs[ind].T(), indices_, rhs[ind].indices(),
-                   -rhs[ind].factor(), 1.0);
-    }
+    add(rhs, -1.0, 1.0);
 }
 
 void LabeledTensor::operator*=(double scale) { T_.scale(scale); }
@@ -295,33 +362,45 @@ operator*(const LabeledTensorAddition &rhs)
     return LabeledTensorDistribution(*this, rhs);
 }
 
-void LabeledTensor::operator=(const LabeledTensorDistribution &rhs)
+void LabeledTensor::distribute(const LabeledTensorDistribution &rhs,
+                               bool zero_result, bool add)
 {
-    T_.zero();
+    // A * (B1 + B2 + ...) is contracted once against the summed addends
+    // when they line up; otherwise each product is accumulated in turn.
+    if (conformable_addends(rhs.B()))
+    {
+        contract(LabeledTensorContraction(rhs.A(), sum_addends(rhs.B())),
+                 zero_result, add);
+        return;
+    }
+
+    if (zero_result)
+        T_.zero();
 
     for (const LabeledTensor &B : rhs.B())
     {
-        *this += const_cast<LabeledTensor &>(rhs.A()) *
-                 const_cast<LabeledTensor &>(B);
+        if (add)
+            *this += const_cast<LabeledTensor &>(rhs.A()) *
+                     const_cast<LabeledTensor &>(B);
+        else
+            *this -= const_cast<LabeledTensor &>(rhs.A()) *
+                     const_cast<LabeledTensor &>(B);
     }
 }
 
+void LabeledTensor::operator=(const LabeledTensorDistribution &rhs)
+{
+    distribute(rhs, true, true);
+}
+
 void LabeledTensor::operator+=(const LabeledTensorDistribution &rhs)
 {
-    for (const LabeledTensor &B : rhs.B())
-    {
-        *this += const_cast<LabeledTensor &>(rhs.A()) *
-                 const_cast<LabeledTensor &>(B);
-    }
+    distribute(rhs, false, true);
 }
 
 void LabeledTensor::operator-=(const LabeledTensorDistribution &rhs)
 {
-    for (const LabeledTensor &B : rhs.B())
-    {
-        *this -= const_cast<LabeledTensor &>(rhs.A()) *
-                 const_cast<LabeledTensor &>(B);
-    }
+    distribute(rhs, false, false);
 }
 
 LabeledTensorDistribution LabeledTensorAddition::
@@ -363,114 +442,23 @@ LabeledTensorContraction::operator double() const
     return C.data()[0];
 }
 
-pair<double, double> LabeledTensorContraction::compute_contraction_cost(
-    const vector<size_t> &perm) const
-{
-#if 0
-    printf("\n\n  Testing the cost of the contraction pattern: ");
-    for (size_t p : perm)
-        printf("[");
-    for (size_t p : perm) {
-        const LabeledTensor &ti = tensors_[p];
-        printf(" %s] ", indices::to_string(ti.indices()).c_str());
-    }
-#endif
-
-    map<string, size_t> indices_to_size;
-
-    for (const LabeledTensor &ti : tensors_)
-    {
-        const Indices &indices = ti.indices();
-        for (size_t i = 0; i < indices.size(); ++i)
-        {
-            indices_to_size[indices[i]] = ti.T().dim(i);
-        }
-    }
-
-    double cpu_cost_total = 0.0;
-    double memory_cost_max = 0.0;
-    Indices first = tensors_[perm[0]].indices();
-    for (size_t i = 1; i < perm.size(); ++i)
-    {
-        Indices second = tensors_[perm[i]].indices();
-        std::sort(first.begin(), first.end());
-        std::sort(second.begin(), second.end());
-        Indices common, first_unique, second_unique;
-
-        // cannot use common.begin() here, need to use back_inserter() because
-        // common.begin() of an
-        // empty vector is not a valid output iterator
-        std::set_intersection(first.begin(), first.end(), second.begin(),
-                              second.end(), back_inserter(common));
-        std::set_difference(first.begin(), first.end(), second.begin(),
-                            second.end(), back_inserter(first_unique));
-        std::set_difference(second.begin(), second.end(), first.begin(),
-                            first.end(), back_inserter(second_unique));
-
-        double common_size = 1.0;
-        for (const string &s : common)
-            common_size *= indices_to_size[s];
-        double first_size = 1.0;
-        for (const string &s : first)
-            first_size *= indices_to_size[s];
-        double second_size = 1.0;
-        for (const string &s : second)
-            second_size *= indices_to_size[s];
-        double first_unique_size = 1.0;
-        for (const string &s : first_unique)
-            first_unique_size *= indices_to_size[s];
-        double second_unique_size = 1.0;
-        for (const string &s : second_unique)
-            second_unique_size *= indices_to_size[s];
-        double result_size = first_unique_size + second_unique_size;
-
-        Indices stored_indices(first_unique);
-        stored_indices.insert(stored_indices.end(), second_unique.begin(),
-                              second_unique.end());
-
-        double cpu_cost = common_size * result_size;
-        double memory_cost = first_size + second_size + result_size;
-        cpu_cost_total += cpu_cost;
-        memory_cost_max = std::max({memory_cost_max, memory_cost});
-
-#if 0
-        printf("\n  First indices        : %s", indices::to_string(first).c_str());
-        printf("\n  Second indices       : %s", indices::to_string(second).c_str());
-
-        printf("\n  Common indices       : %s (%.0f)", indices::to_string(common).c_str(), common_size);
-        printf("\n  First unique indices : %s (%.0f)", indices::to_string(first_unique).c_str(), first_unique_size);
-        printf("\n  Second unique indices: %s (%.0f)", indices::to_string(second_unique).c_str(), second_unique_size);
-
-        printf("\n  CPU cost for this step    : %f.0", cpu_cost);
-        printf("\n  Memory cost for this step : %f.0 = %f.0 + %f.0 + %f.0",
-               memory_cost,
-               first_size,
-               second_size,
-               result_size);
-
-        printf("\n  Stored indices       : %s", indices::to_string(stored_indices).c_str());
-#endif
-
-        first = stored_indices;
-    }
-
-#if 0
-    printf("\n  Total CPU cost                : %f.0", cpu_cost_total);
-    printf("\n  Maximum memory cost           : %f.0", memory_cost_max);
-#endif
-
-    return std::make_pair(cpu_cost_total, memory_cost_max);
-}
-
 LabeledTensorDistribution::operator double() const
 {
     Tensor R = Tensor::build(A_.T().type(), "R", {});
 
-    for (size_t ind = 0L; ind < B_.size(); ind++)
+    if (conformable_addends(B_))
     {
-
-        R.contract(A_.T(), B_[ind].T(), {}, A_.indices(), B_[ind].indices(),
-                   A_.factor() * B_[ind].factor(), 1.0);
+        LabeledTensor S = sum_addends(B_);
+        R.contract(A_.T(), S.T(), {}, A_.indices(), S.indices(), A_.factor(),
+                   0.0);
+    }
+    else
+    {
+        for (size_t ind = 0L; ind < B_.size(); ind++)
+        {
+            R.contract(A_.T(), B_[ind].T(), {}, A_.indices(),
+                       B_[ind].indices(), A_.factor() * B_[ind].factor(), 1.0);
+        }
     }
 
     Tensor C = Tensor::build(CoreTensor, "C", {});
@@ -540,34 +528,13 @@ void LabeledTensor::contract_batched(const LabeledTensorBatchedContraction &rhs_
 
 
     size_t nterms = rhs.size();
-    std::vector<size_t> perm(nterms);
-    std::vector<size_t> best_perm(nterms);
-    std::iota(perm.begin(), perm.end(), 0);
-    std::pair<double, double> best_cpu_memory_cost(1.0e200, 1.0e200);
-
-    if (optimize_order) {
-        do
-        {
-            std::pair<double, double> cpu_memory_cost =
-                rhs.compute_contraction_cost(perm);
-            if (cpu_memory_cost.first < best_cpu_memory_cost.first)
-            {
-                best_perm = perm;
-                best_cpu_memory_cost = cpu_memory_cost;
-            }
-        } while (std::next_permutation(perm.begin(), perm.end()));
-        // at this point 'best_perm' should be used to perform contraction in
-        // optimal order.
-    } else {
-        best_perm = perm;
-    }
 
     std::vector<std::vector<bool>> need_slicing(nterms, std::vector<bool>(batched_size + 1));
 
     // Permute tensor indices if the corresponding tensor needs to be batched.
     LabeledTensorContraction rhsp;
     for (size_t i = 0; i < nterms; ++i) {
-        const LabeledTensor& A = rhs[best_perm[i]];
+        const LabeledTensor& A = rhs[i];
         const Indices& A_indices = A.indices();
         Indices gemm_indices;
         for (const string& s : A_indices) {
@@ -643,179 +610,86 @@ void LabeledTensor::contract_batched(const LabeledTensorBatchedContraction &rhs_
         }
     }
 
-    if (nterms == 2) {
-        // Loop over batches to perform contraction
-        std::vector<size_t> current_batch(batched_size, 0);
-        shared_ptr<TensorImpl> A2;
-        shared_ptr<TensorImpl> B2;
-        shared_ptr<TensorImpl> C2;
-        while (current_batch[0] < slicing_dims[0]) {
-            size_t L_shift = 0, cur_jump = 1;
-            size_t sub_numel = Lt_batch.T().numel();
-            for (int i = batched_size - 1; i >= 0; --i) {
-                L_shift += current_batch[i] * cur_jump;
-                cur_jump *= slicing_dims[i];
-            }
-            L_shift *= sub_numel;
-            std::vector<double>& Lt_batch_data = Ltp_batch.data();
-            std::vector<double>& Lt_data = Ltp.data();
-            std::memcpy(Lt_batch_data.data(), Lt_data.data()+L_shift, sub_numel * sizeof(double));
-
-            for (size_t i = 0; i < nterms; ++i) {
-                if (need_slicing[i][batched_size]) {
-                    size_t cur_shift = 0, cur_jump = 1;
-                    size_t sub_numel_A = batch_tensors[i].numel();
-                    for (int l = batched_size - 1; l >= 0; --l) {
-                        if (need_slicing[i][l]) {
-                            cur_shift += current_batch[l] * cur_jump;
-                            cur_jump *= slicing_dims[l];
-                        }
-                    }
-                    cur_shift *= sub_numel_A;
-                    std::vector<double>& A_batch_data = batch_tensors[i].data();
-                    const std::vector<double>& A_data = rhsp[i].T().data();
-                    std::memcpy(A_batch_data.data(), A_data.data()+cur_shift, sub_numel_A * sizeof(double));
-                }
-            }
-
-            // The following code is identical to Lt_batch.contract(rhs_batch, zero_result, add);
-            const LabeledTensor &A = rhs_batch[0];
-            const LabeledTensor &B = rhs_batch[1];
-
-            Ltp_batch.contract(batch_tensors[0], batch_tensors[1], sub_indices, A.indices(), B.indices(),
-                        A2, B2, C2,
-                        add ? A.factor() * B.factor() : -A.factor() * B.factor(),
-                        zero_result ? 0.0 : 1.0);
-
-            // Copy current batch tensor result to the full result tensor
-            const std::vector<double>& Ltc_batch_data = Ltp_batch.data();
-            std::memcpy(Lt_data.data() + L_shift, Ltc_batch_data.data(), sub_numel * sizeof(double));
-
-            // Determine the indices of next batch
-            for (int i = batched_size - 1; i >= 0; --i) {
-                current_batch[i]++;
-                if (current_batch[i] < slicing_dims[i]) {
-                    break;
-                } else if (i != 0) {
-                    current_batch[i] = 0;
-                }
-            }
-        }
-    } else {
-        // Prepare batch contraction intermediate tensors.
-        std::vector<Tensor> inter_tensors;
-        std::vector<Indices> inter_indices;
-        LabeledTensor A = rhs_batch[0];
-        int maxn = int(nterms) - 2;
-        for (int n = 0; n < maxn; ++n)
-        {
-            LabeledTensor B = rhs_batch[n + 1];
-
-            std::vector<Indices> AB_indices =
-                indices::determine_contraction_result(A, B);
-            const Indices &AB_common_idx = AB_indices[0];
-            const Indices &A_fix_idx = AB_indices[1];
-            const Indices &B_fix_idx = AB_indices[2];
-            Dimension dims;
-            Indices indices;
-
-            for (size_t i = 0; i < AB_common_idx.size(); ++i)
-            {
-                // If a common index is also found in the rhs it's a Hadamard index
-                if (std::find(this->indices().begin(), this->indices().end(),
-                              AB_common_idx[i]) != this->indices().end())
-                {
-                    dims.push_back(A.dim_by_index(AB_common_idx[i]));
-                    indices.push_back(AB_common_idx[i]);
-                }
-            }
-
-            for (size_t i = 0; i < A_fix_idx.size(); ++i)
-            {
-                dims.push_back(A.dim_by_index(A_fix_idx[i]));
-                indices.push_back(A_fix_idx[i]);
-            }
-            for (size_t i = 0; i < B_fix_idx.size(); ++i)
-            {
-                dims.push_back(B.dim_by_index(B_fix_idx[i]));
-                indices.push_back(B_fix_idx[i]);
-            }
-
-            Tensor tAB = Tensor::build(A.T().type(),
-                                       A.T().name() + " * " + B.T().name(), dims);
-            inter_tensors.push_back(tAB);
-            inter_indices.push_back(indices);
+    // Order the contraction of one batch. Its intermediates are built once
+    // and reused for all the batches.
+    ContractionTree tree = rhs_batch.contraction_tree(sub_indices, optimize_order);
+    size_t root = tree.nodes.size() - 1;
+    std::vector<LabeledTensor> operands;
+    for (size_t i = 0; i < nterms; ++i) {
+        operands.push_back(rhs_batch[i]);
+    }
+    for (size_t node = nterms; node < root; ++node) {
+        const ContractionTree::Node &step = tree.nodes[node];
+        const LabeledTensor &A = operands[step.left];
+        const LabeledTensor &B = operands[step.right];
+        Tensor tAB = Tensor::build(A.T().type(),
+                                   A.T().name() + " * " + B.T().name(),
+                                   contraction_dims(A, B, step.indices));
+        operands.push_back(LabeledTensor(tAB, step.indices, 1.0));
+    }
 
-            A.set(LabeledTensor(tAB, indices, 1.0));
+    // Loop over batches to perform contraction
+    std::vector<size_t> current_batch(batched_size, 0);
+    std::vector<shared_ptr<TensorImpl>> A2s(tree.nodes.size());
+    std::vector<shared_ptr<TensorImpl>> B2s(tree.nodes.size());
+    std::vector<shared_ptr<TensorImpl>> C2s(tree.nodes.size());
+    while (current_batch[0] < slicing_dims[0]) {
+        size_t L_shift = 0, cur_jump = 1;
+        size_t sub_numel = Lt_batch.T().numel();
+        for (int i = batched_size - 1; i >= 0; --i) {
+            L_shift += current_batch[i] * cur_jump;
+            cur_jump *= slicing_dims[i];
         }
-
-        // Loop over batches to perform contraction
-        std::vector<size_t> current_batch(batched_size, 0);
-        std::vector<shared_ptr<TensorImpl>> A2s(maxn+1);
-        std::vector<shared_ptr<TensorImpl>> B2s(maxn+1);
-        std::vector<shared_ptr<TensorImpl>> C2s(maxn+1);
-        while (current_batch[0] < slicing_dims[0]) {
-            size_t L_shift = 0, cur_jump = 1;
-            size_t sub_numel = Lt_batch.T().numel();
-            for (int i = batched_size - 1; i >= 0; --i) {
-                L_shift += current_batch[i] * cur_jump;
-                cur_jump *= slicing_dims[i];
-            }
-            L_shift *= sub_numel;
-            std::vector<double>& Lt_batch_data = Ltp_batch.data();
-            std::vector<double>& Lt_data = Ltp.data();
-            std::memcpy(Lt_batch_data.data(), Lt_data.data()+L_shift, sub_numel * sizeof(double));
-
-            for (size_t i = 0; i < nterms; ++i) {
-                if (need_slicing[i][batched_size]) {
-                    size_t cur_shift = 0, cur_jump = 1;
-                    size_t sub_numel_A = batch_tensors[i].numel();
-                    for (int l = batched_size - 1; l >= 0; --l) {
-                        if (need_slicing[i][l]) {
-                            cur_shift += current_batch[l] * cur_jump;
-                            cur_jump *= slicing_dims[l];
-                        }
+        L_shift *= sub_numel;
+        std::vector<double>& Lt_batch_data = Ltp_batch.data();
+        std::vector<double>& Lt_data = Ltp.data();
+        std::memcpy(Lt_batch_data.data(), Lt_data.data()+L_shift, sub_numel * sizeof(double));
+
+        for (size_t i = 0; i < nterms; ++i) {
+            if (need_slicing[i][batched_size]) {
+                size_t cur_shift = 0, cur_jump = 1;
+                size_t sub_numel_A = batch_tensors[i].numel();
+                for (int l = batched_size - 1; l >= 0; --l) {
+                    if (need_slicing[i][l]) {
+                        cur_shift += current_batch[l] * cur_jump;
+                        cur_jump *= slicing_dims[l];
                     }
-                    cur_shift *= sub_numel_A;
-                    std::vector<double>& A_batch_data = batch_tensors[i].data();
-                    const std::vector<double>& A_data = rhsp[i].T().data();
-                    std::memcpy(A_batch_data.data(), A_data.data()+cur_shift, sub_numel_A * sizeof(double));
                 }
+                cur_shift *= sub_numel_A;
+                std::vector<double>& A_batch_data = batch_tensors[i].data();
+                const std::vector<double>& A_data = rhsp[i].T().data();
+                std::memcpy(A_batch_data.data(), A_data.data()+cur_shift, sub_numel_A * sizeof(double));
             }
+        }
 
-            // The following code is identical to Lt_batch.contract(rhs_batch, zero_result, add);
-            const LabeledTensor &A = rhs_batch[0];
-            const LabeledTensor &B0 = rhs_batch[1];
-            Tensor tAB = inter_tensors[0];
-            tAB.contract(batch_tensors[0], B0.T(), inter_indices[0], A.indices(), B0.indices(),
-                         A2s[0], B2s[0], C2s[0], A.factor() * B0.factor(), 0.0);
-
-            for (int n = 1; n < maxn; ++n)
-            {
-                const LabeledTensor &B = rhs_batch[n + 1];
-                inter_tensors[n].contract(inter_tensors[n-1], batch_tensors[n+1], inter_indices[n], inter_indices[n-1], B.indices(),
-                             A2s[n], B2s[n], C2s[n], B.factor(), 0.0);
-            }
-            const LabeledTensor &B = rhs_batch[nterms - 1];
-
-            Ltp_batch.contract(inter_tensors[nterms-3], B.T(), sub_indices, inter_indices[nterms-3], B.indices(),
-                        A2s[maxn], B2s[maxn], C2s[maxn], add ? B.factor() : -B.factor(),
-                        zero_result ? 0.0 : 1.0);
-            // The intermediate tensors in this contraction should be reused for all the batches
-            // to avoid recreating the intermediate of the same size multiple times.
-
-            // Copy current batch tensor result to the full result tensor
-            const std::vector<double>& Ltc_batch_data = Ltp_batch.data();
-            std::memcpy(Lt_data.data() + L_shift, Ltc_batch_data.data(), sub_numel * sizeof(double));
-
-            // Determine the indices of next batch
-            for (int i = batched_size - 1; i >= 0; --i) {
-                current_batch[i]++;
-                if (current_batch[i] < slicing_dims[i]) {
-                    break;
-                } else if (i != 0) {
-                    current_batch[i] = 0;
-                }
+        // The following code is identical to Lt_batch.contract(rhs_batch, zero_result, add);
+        for (size_t node = nterms; node < root; ++node) {
+            const ContractionTree::Node &step = tree.nodes[node];
+            const LabeledTensor &A = operands[step.left];
+            const LabeledTensor &B = operands[step.right];
+            Tensor tAB = operands[node].T();
+            tAB.contract(A.T(), B.T(), step.indices, A.indices(), B.indices(),
+                         A2s[node], B2s[node], C2s[node],
+                         A.factor() * B.factor(), 0.0);
+        }
+        const LabeledTensor &A = operands[tree.nodes[root].left];
+        const LabeledTensor &B = operands[tree.nodes[root].right];
+        Ltp_batch.contract(A.T(), B.T(), sub_indices, A.indices(), B.indices(),
+                    A2s[root], B2s[root], C2s[root],
+                    add ? A.factor() * B.factor() : -A.factor() * B.factor(),
+                    zero_result ? 0.0 : 1.0);
+
+        // Copy current batch tensor result to the full result tensor
+        const std::vector<double>& Ltc_batch_data = Ltp_batch.data();
+        std::memcpy(Lt_data.data() + L_shift, Ltc_batch_data.data(), sub_numel * sizeof(double));
+
+        // Determine the indices of next batch
+        for (int i = batched_size - 1; i >= 0; --i) {
+            current_batch[i]++;
+            if (current_batch[i] < slicing_dims[i]) {
+                break;
+            } else if (i != 0) {
+                current_batch[i] = 0;
             }
         }
     }
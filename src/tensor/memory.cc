@@ -0,0 +1,160 @@
+/*
+ * @BEGIN LICENSE
+ *
+ * ambit: C++ library for the implementation of tensor product calculations
+ *        through a clean, concise user interface.
+ *
+ * Copyright (c) 2014-2017 Ambit developers.
+ *
+ * The copyrights for code used from other parties are included in
+ * the corresponding files.
+ *
+ * This file is part of ambit.
+ *
+ * Ambit is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * Ambit is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License along
+ * with ambit; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * @END LICENSE
+ */
+
+#include <ambit/memory.h>
+#include <ambit/print.h>
+#include <ambit/settings.h>
+
+#include "core/scratch.h"
+#include "tensorimpl.h"
+
+#include <atomic>
+#include <cstdio>
+
+namespace ambit
+{
+namespace memory
+{
+
+namespace
+{
+
+constexpr int ntypes = AgnosticTensor + 1;
+
+std::atomic<size_t> current_bytes[ntypes];
+std::atomic<size_t> peak_bytes[ntypes];
+std::atomic<size_t> in_core_bytes(0);
+std::atomic<size_t> in_core_peak(0);
+
+bool in_core(TensorType type) { return type != DiskTensor; }
+
+void raise_peak(std::atomic<size_t> &peak, size_t value)
+{
+    size_t old = peak.load();
+    while (value > old && !peak.compare_exchange_weak(old, value))
+    {
+    }
+}
+
+// Claims bytes of the in-core budget, or returns false if that would take
+// the in-core total past settings::memory_limit.
+bool claim_in_core(size_t bytes)
+{
+    size_t old = in_core_bytes.load();
+    do
+    {
+        if (old + bytes > settings::memory_limit)
+            return false;
+    } while (!in_core_bytes.compare_exchange_weak(old, old + bytes));
+    raise_peak(in_core_peak, old + bytes);
+    return true;
+}
+
+double megabytes(size_t bytes)
+{
+    return static_cast<double>(bytes) / (1024.0 * 1024.0);
+}
+
+const char *type_name(TensorType type)
+{
+    switch (type)
+    {
+    case CoreTensor:
+        return "Core";
+    case DiskTensor:
+        return "Disk";
+    case DistributedTensor:
+        return "Distributed";
+    default:
+        return "Other";
+    }
+}
+} // namespace
+
+void allocate(TensorType type, size_t bytes)
+{
+    if (in_core(type) && !claim_in_core(bytes))
+    {
+        // Idle scratch buffers of this thread are the only storage that can
+        // be given back on demand.
+        ScratchArena::instance().trim();
+        if (!claim_in_core(bytes))
+        {
+            char buffer[256];
+            snprintf(buffer, sizeof(buffer),
+                     "Out of memory: allocating %.2f MB of %s tensor storage "
+                     "with %.2f MB in use exceeds settings::memory_limit "
+                     "(%.2f MB).",
+                     megabytes(bytes), type_name(type),
+                     megabytes(in_core_bytes.load()),
+                     megabytes(settings::memory_limit));
+            throw detail::OutOfMemoryException(buffer);
+        }
+    }
+
+    size_t now = (current_bytes[type] += bytes);
+    raise_peak(peak_bytes[type], now);
+}
+
+void release(TensorType type, size_t bytes)
+{
+    current_bytes[type] -= bytes;
+    if (in_core(type))
+        in_core_bytes -= bytes;
+}
+
+size_t current(TensorType type) { return current_bytes[type].load(); }
+
+size_t peak(TensorType type) { return peak_bytes[type].load(); }
+
+size_t current_in_core() { return in_core_bytes.load(); }
+
+size_t peak_in_core() { return in_core_peak.load(); }
+
+void reset_peak()
+{
+    for (int type = 0; type < ntypes; type++)
+        peak_bytes[type] = current_bytes[type].load();
+    in_core_peak = in_core_bytes.load();
+}
+
+void report()
+{
+    print("\nMemory usage:\n\n");
+    print("  %-12s %14s %14s\n", "Type", "Current (MB)", "Peak (MB)");
+    for (TensorType type : {CoreTensor, DiskTensor, DistributedTensor})
+        print("  %-12s %14.2f %14.2f\n", type_name(type),
+              megabytes(current(type)), megabytes(peak(type)));
+    print("  %-12s %14.2f %14.2f\n", "In core", megabytes(current_in_core()),
+          megabytes(peak_in_core()));
+    print("  %-12s %14s %14.2f\n", "Limit", "",
+          megabytes(settings::memory_limit));
+}
+} // namespace memory
+} // namespace ambit
@@ -28,8 +28,12 @@
  */
 
 #include "slice.h"
+#include "core/scratch.h"
+#include "disk/io_queue.h"
 #include "math/math.h"
+#include <ambit/settings.h>
 #include <ambit/timer.h>
+#include <algorithm>
 #include <string.h>
 
 namespace ambit
@@ -411,56 +415,51 @@ void slice(CoreTensorImplPtr C, ConstCoreTensorImplPtr A,
         }
     }
 
+    // C = alpha A + beta C over the slice
+    size_t numel = 1L;
+    for (const std::vector<size_t> &range : Cinds)
+        numel *= range[1] - range[0];
+    timer::add_flops(3.0 * numel);
+    timer::add_bytes(3.0 * sizeof(double) * numel);
+
     timer::timer_pop();
 }
-void slice(CoreTensorImplPtr C, ConstDiskTensorImplPtr A,
-           const IndexRange &Cinds, const IndexRange &Ainds, double alpha,
-           double beta)
+namespace
 {
-    timer::timer_push("slice Disk -> Core");
 
-    /// Data pointers
-    double *Cp = C->data().data();
-    FILE *Af = ((DiskTensorImplPtr)A)->fh();
+/// Largest run of a disk slice, in elements (8 MB)
+constexpr size_t disk_run_limit = 1048576L;
 
-    // => Special Case: Rank-0 <= //
-
-    if (C->rank() == 0)
-    {
-        double Ap = 0.0;
-        fseek(Af, 0L, SEEK_SET);
-        fread(&Ap, sizeof(double), 1L, Af);
-        fseek(Af, 0L, SEEK_SET);
-        Cp[0] = alpha * Ap + beta * Cp[0];
-    }
-    else
+/// The contiguous runs of a slice, fusing the trailing indices that are
+/// whole in both tensors
+class SliceRuns
+{
+  public:
+    SliceRuns(ConstTensorImplPtr C, ConstTensorImplPtr A,
+              const IndexRange &Cinds, const IndexRange &Ainds)
+        : Cinds_(Cinds), Ainds_(Ainds)
     {
-        // => Index Logic <= //
+        size_t rank = C->rank();
+        if (rank == 0)
+            return;
 
         /// Sizes of stripes
-        vector<size_t> sizes(C->rank(), 0L);
-        for (size_t ind = 0L; ind < C->rank(); ind++)
+        for (size_t ind = 0L; ind < rank; ind++)
         {
-            sizes[ind] = Cinds[ind][1] - Cinds[ind][0];
+            sizes_.push_back(Cinds[ind][1] - Cinds[ind][0]);
         }
 
-        /// Size of contiguous DAXPY call
+        /// Size of contiguous run
         int fast_dims = 1;
-        size_t fast_size = sizes[C->rank() - 1];
-        for (int ind = ((int)C->rank()) - 2; ind >= 0; ind--)
+        fast_size_ = sizes_[rank - 1];
+        for (int ind = ((int)rank) - 2; ind >= 0; ind--)
         {
-            if (sizes[ind + 1] == A->dims()[ind + 1] &&
-                sizes[ind + 1] == C->dims()[ind + 1])
+            if (sizes_[ind + 1] == A->dims()[ind + 1] &&
+                sizes_[ind + 1] == C->dims()[ind + 1] &&
+                fast_size_ * sizes_[ind] <= disk_run_limit)
             {
-                if (fast_size * sizes[ind] <= disk_buffer__)
-                {
-                    fast_dims++;
-                    fast_size *= sizes[ind];
-                }
-                else
-                {
-                    break;
-                }
+                fast_dims++;
+                fast_size_ *= sizes_[ind];
             }
             else
             {
@@ -468,320 +467,225 @@ void slice(CoreTensorImplPtr C, ConstDiskTensorImplPtr A,
             }
         }
 
-        int slow_dims = C->rank() - fast_dims;
-        size_t slow_size = 1L;
-        for (int dim = 0; dim < slow_dims; dim++)
+        slow_dims_ = rank - fast_dims;
+        for (int dim = 0; dim < slow_dims_; dim++)
         {
-            slow_size *= sizes[dim];
+            count_ *= sizes_[dim];
         }
 
-        vector<size_t> Astrides(C->rank());
-        Astrides[C->rank() - 1] = 1L;
-        for (int ind = ((int)C->rank() - 2); ind >= 0; ind--)
+        Astrides_.resize(rank);
+        Astrides_[rank - 1] = 1L;
+        for (int ind = ((int)rank - 2); ind >= 0; ind--)
         {
-            Astrides[ind] = Astrides[ind + 1] * A->dims()[ind + 1];
+            Astrides_[ind] = Astrides_[ind + 1] * A->dims()[ind + 1];
         }
 
-        vector<size_t> Cstrides(C->rank());
-        Cstrides[C->rank() - 1] = 1L;
-        for (int ind = ((int)C->rank() - 2); ind >= 0; ind--)
+        Cstrides_.resize(rank);
+        Cstrides_[rank - 1] = 1L;
+        for (int ind = ((int)rank - 2); ind >= 0; ind--)
         {
-            Cstrides[ind] = Cstrides[ind + 1] * C->dims()[ind + 1];
+            Cstrides_[ind] = Cstrides_[ind + 1] * C->dims()[ind + 1];
         }
+    }
 
-        /// Buffer of A
-        double *Ap = new double[fast_size];
-        memset(Ap, '\0', sizeof(double) * fast_size);
-
-        // => Slice Operation <= //
-
-        for (size_t ind = 0L; ind < slow_size; ind++)
-        {
-            size_t num = ind;
-            size_t Aoff = 0L;
-            size_t Coff = 0L;
-            for (int dim = slow_dims - 1; dim >= 0; dim--)
-            {
-                size_t val = num % sizes[dim]; // value of the dim-th index
-                num /= sizes[dim];
-                Aoff += (Ainds[dim][0] + val) * Astrides[dim];
-                Coff += (Cinds[dim][0] + val) * Cstrides[dim];
-            }
-            Aoff += Ainds[slow_dims][0] * Astrides[slow_dims];
-            Coff += Cinds[slow_dims][0] * Cstrides[slow_dims];
-
-            double *Ctp = Cp + Coff;
-            double *Atp = Ap;
-            fseek(Af, sizeof(double) * Aoff, SEEK_SET);
-            fread(Atp, sizeof(double), fast_size, Af);
+    /// Number of runs
+    size_t count() const { return count_; }
+    /// Elements in each run
+    size_t fast_size() const { return fast_size_; }
 
-            C_DSCAL(fast_size, beta, Ctp, 1);
-            C_DAXPY(fast_size, alpha, Atp, 1, Ctp, 1);
-        }
-
-        delete[] Ap;
-        fseek(Af, 0L, SEEK_SET);
+    /// Offsets into A and C of run ind
+    void offsets(size_t ind, size_t &Aoff, size_t &Coff) const
+    {
+        Aoff = 0L;
+        Coff = 0L;
+        if (sizes_.empty())
+            return;
+        size_t num = ind;
+        for (int dim = slow_dims_ - 1; dim >= 0; dim--)
+        {
+            size_t val = num % sizes_[dim]; // value of the dim-th index
+            num /= sizes_[dim];
+            Aoff += (Ainds_[dim][0] + val) * Astrides_[dim];
+            Coff += (Cinds_[dim][0] + val) * Cstrides_[dim];
+        }
+        Aoff += Ainds_[slow_dims_][0] * Astrides_[slow_dims_];
+        Coff += Cinds_[slow_dims_][0] * Cstrides_[slow_dims_];
     }
 
-    timer::timer_pop();
-}
-void slice(DiskTensorImplPtr C, ConstCoreTensorImplPtr A,
-           const IndexRange &Cinds, const IndexRange &Ainds, double alpha,
-           double beta)
+  private:
+    const IndexRange &Cinds_;
+    const IndexRange &Ainds_;
+    vector<size_t> sizes_;
+    vector<size_t> Astrides_;
+    vector<size_t> Cstrides_;
+    int slow_dims_ = 0;
+    size_t fast_size_ = 1L;
+    size_t count_ = 1L;
+};
+
+/**
+ * C = alpha * A + beta * C over the runs of a slice where A, C or both are
+ * on disk (Adisk / Cdisk set) and the others in core (Acore / Ccore).
+ *
+ * The runs are grouped into tiles of up to disk_run_limit elements. Up to
+ * settings::disk_queue_depth tiles are in flight on the DiskIOQueue: the
+ * disk operands of the next tiles are read while the current one is
+ * combined, and finished tiles of C are written behind.
+ */
+void stream_slice(const SliceRuns &runs, ConstDiskTensorImplPtr Adisk,
+                  const double *Acore, DiskTensorImplPtr Cdisk, double *Ccore,
+                  double alpha, double beta)
 {
-    timer::timer_push("slice Core -> Disk");
-
-    /// Data pointers
-    FILE *Cf = C->fh();
-    double *Ap = ((CoreTensorImplPtr)A)->data().data();
-
-    // => Special Case: Rank-0 <= //
-
-    if (C->rank() == 0)
+    DiskIOQueue &queue = DiskIOQueue::instance();
+
+    // An empty range along any index leaves nothing to move
+    size_t fast_size = runs.fast_size();
+    if (fast_size == 0L || runs.count() == 0L)
+        return;
+    size_t tile_runs = std::max(disk_run_limit / fast_size, size_t(1));
+    tile_runs = std::min(tile_runs, runs.count());
+    size_t ntiles = (runs.count() + tile_runs - 1L) / tile_runs;
+    size_t depth = std::min(
+        static_cast<size_t>(std::max(settings::disk_queue_depth, 1)), ntiles);
+
+    bool read_C = Cdisk != nullptr && beta != 0.0;
+
+    /// One slot per tile in flight
+    ScratchArena &arena = ScratchArena::instance();
+    vector<ScratchBuffer> Abuffers(depth);
+    vector<ScratchBuffer> Cbuffers(depth);
+    vector<size_t> Areads(depth, 0L);
+    vector<size_t> Creads(depth, 0L);
+    vector<size_t> Cwrites(depth, 0L);
+    for (size_t slot = 0L; slot < depth; slot++)
     {
-        double Cp = 0.0;
-        if (beta != 0.0)
-        {
-            fseek(Cf, 0L, SEEK_SET);
-            fread(&Cp, sizeof(double), 1L, Cf);
-        }
-        Cp = alpha * Ap[0] + beta * Cp;
-        fseek(Cf, 0L, SEEK_SET);
-        fwrite(&Cp, sizeof(double), 1L, Cf);
-        fseek(Cf, 0L, SEEK_SET);
+        if (Adisk)
+            Abuffers[slot] = arena.acquire(tile_runs * fast_size);
+        if (Cdisk)
+            Cbuffers[slot] = arena.acquire(tile_runs * fast_size);
     }
-    else
+
+    auto segments = [&](size_t tile, bool of_A) {
+        DiskIOQueue::Segments list;
+        size_t stop = std::min((tile + 1L) * tile_runs, runs.count());
+        for (size_t ind = tile * tile_runs; ind < stop; ind++)
+        {
+            size_t Aoff, Coff;
+            runs.offsets(ind, Aoff, Coff);
+            list.push_back({of_A ? Aoff : Coff, fast_size});
+        }
+        return list;
+    };
+    auto read_ahead = [&](size_t tile) {
+        size_t slot = tile % depth;
+        if (Adisk)
+            Areads[slot] = queue.read(Adisk->fd(), Abuffers[slot].data(),
+                                      segments(tile, true));
+        // Queued after the last write of this slot, so it cannot overtake it
+        if (read_C)
+            Creads[slot] = queue.read(Cdisk->fd(), Cbuffers[slot].data(),
+                                      segments(tile, false));
+    };
+
+    try
     {
-        // => Index Logic <= //
+        for (size_t tile = 0L; tile < depth; tile++)
+            read_ahead(tile);
 
-        /// Sizes of stripes
-        vector<size_t> sizes(C->rank(), 0L);
-        for (size_t ind = 0L; ind < C->rank(); ind++)
+        for (size_t tile = 0L; tile < ntiles; tile++)
         {
-            sizes[ind] = Cinds[ind][1] - Cinds[ind][0];
-        }
+            size_t slot = tile % depth;
+            queue.wait(Areads[slot]);
+            queue.wait(read_C ? Creads[slot] : Cwrites[slot]);
 
-        /// Size of contiguous DAXPY call
-        int fast_dims = 1;
-        size_t fast_size = sizes[C->rank() - 1];
-        for (int ind = ((int)C->rank()) - 2; ind >= 0; ind--)
-        {
-            if (sizes[ind + 1] == A->dims()[ind + 1] &&
-                sizes[ind + 1] == C->dims()[ind + 1])
+            size_t stop = std::min((tile + 1L) * tile_runs, runs.count());
+            for (size_t ind = tile * tile_runs, run = 0L; ind < stop;
+                 ind++, run++)
             {
-                if (fast_size * sizes[ind] <= disk_buffer__)
+                size_t Aoff, Coff;
+                runs.offsets(ind, Aoff, Coff);
+                const double *Atp = Adisk ? Abuffers[slot].data() +
+                                                run * fast_size
+                                          : Acore + Aoff;
+                double *Ctp = Cdisk ? Cbuffers[slot].data() + run * fast_size
+                                    : Ccore + Coff;
+                if (beta == 0.0 && Cdisk)
                 {
-                    fast_dims++;
-                    fast_size *= sizes[ind];
+                    // The buffer is uninitialized: overwrite it
+                    C_DCOPY(fast_size, const_cast<double *>(Atp), 1, Ctp, 1);
+                    C_DSCAL(fast_size, alpha, Ctp, 1);
                 }
                 else
                 {
-                    break;
+                    C_DSCAL(fast_size, beta, Ctp, 1);
+                    C_DAXPY(fast_size, alpha, const_cast<double *>(Atp), 1,
+                            Ctp, 1);
                 }
             }
-            else
-            {
-                break;
-            }
-        }
 
-        int slow_dims = C->rank() - fast_dims;
-        size_t slow_size = 1L;
-        for (int dim = 0; dim < slow_dims; dim++)
-        {
-            slow_size *= sizes[dim];
+            if (Cdisk)
+                Cwrites[slot] = queue.write(Cdisk->fd(), Cbuffers[slot].data(),
+                                            segments(tile, false));
+            if (tile + depth < ntiles)
+                read_ahead(tile + depth);
         }
 
-        vector<size_t> Astrides(C->rank());
-        Astrides[C->rank() - 1] = 1L;
-        for (int ind = ((int)C->rank() - 2); ind >= 0; ind--)
-        {
-            Astrides[ind] = Astrides[ind + 1] * A->dims()[ind + 1];
-        }
-
-        vector<size_t> Cstrides(C->rank());
-        Cstrides[C->rank() - 1] = 1L;
-        for (int ind = ((int)C->rank() - 2); ind >= 0; ind--)
-        {
-            Cstrides[ind] = Cstrides[ind + 1] * C->dims()[ind + 1];
-        }
-
-        /// Buffer of C
-        double *Cp = new double[fast_size];
-        memset(Cp, '\0', sizeof(double) * fast_size);
-
-        // => Slice Operation <= //
-
-        for (size_t ind = 0L; ind < slow_size; ind++)
-        {
-            size_t num = ind;
-            size_t Aoff = 0L;
-            size_t Coff = 0L;
-            for (int dim = slow_dims - 1; dim >= 0; dim--)
-            {
-                size_t val = num % sizes[dim]; // value of the dim-th index
-                num /= sizes[dim];
-                Aoff += (Ainds[dim][0] + val) * Astrides[dim];
-                Coff += (Cinds[dim][0] + val) * Cstrides[dim];
-            }
-            Aoff += Ainds[slow_dims][0] * Astrides[slow_dims];
-            Coff += Cinds[slow_dims][0] * Cstrides[slow_dims];
-
-            double *Ctp = Cp;
-            double *Atp = Ap + Aoff;
-
-            if (beta != 0.0)
-            {
-                fseek(Cf, sizeof(double) * Coff, SEEK_SET);
-                fread(Ctp, sizeof(double), fast_size, Cf);
-            }
-
-            C_DSCAL(fast_size, beta, Ctp, 1);
-            C_DAXPY(fast_size, alpha, Atp, 1, Ctp, 1);
-
-            fseek(Cf, sizeof(double) * Coff, SEEK_SET);
-            fwrite(Ctp, sizeof(double), fast_size, Cf);
-        }
-
-        delete[] Cp;
-        fseek(Cf, 0L, SEEK_SET);
-    }
-
-    timer::timer_pop();
-}
-void slice(DiskTensorImplPtr C, ConstDiskTensorImplPtr A,
-           const IndexRange &Cinds, const IndexRange &Ainds, double alpha,
-           double beta)
-{
-    timer::timer_push("slice Disk -> Disk");
-
-    /// Data pointers
-    FILE *Cf = C->fh();
-    FILE *Af = A->fh();
-
-    // => Special Case: Rank-0 <= //
-
-    if (C->rank() == 0)
-    {
-        double Cp = 0.0;
-        double Ap;
-        if (beta != 0.0)
-        {
-            fseek(Cf, 0L, SEEK_SET);
-            fread(&Cp, sizeof(double), 1L, Cf);
-        }
-        fseek(Af, 0L, SEEK_SET);
-        fread(&Ap, sizeof(double), 1L, Af);
-        Cp = alpha * Ap + beta * Cp;
-        fseek(Cf, 0L, SEEK_SET);
-        fwrite(&Cp, sizeof(double), 1L, Cf);
-        fseek(Cf, 0L, SEEK_SET);
-        fseek(Af, 0L, SEEK_SET);
+        for (size_t slot = 0L; slot < depth; slot++)
+            queue.wait(Cwrites[slot]);
     }
-    else
+    catch (...)
     {
-        // => Index Logic <= //
-
-        /// Sizes of stripes
-        vector<size_t> sizes(C->rank(), 0L);
-        for (size_t ind = 0L; ind < C->rank(); ind++)
+        // Nothing may still target the buffers once they are released
+        for (size_t slot = 0L; slot < depth; slot++)
         {
-            sizes[ind] = Cinds[ind][1] - Cinds[ind][0];
-        }
-
-        /// Size of contiguous DAXPY call
-        int fast_dims = 1;
-        size_t fast_size = sizes[C->rank() - 1];
-        for (int ind = ((int)C->rank()) - 2; ind >= 0; ind--)
-        {
-            if (sizes[ind + 1] == A->dims()[ind + 1] &&
-                sizes[ind + 1] == C->dims()[ind + 1])
+            for (size_t ticket : {Areads[slot], Creads[slot], Cwrites[slot]})
             {
-                if (fast_size * sizes[ind] <= disk_buffer__)
+                try
                 {
-                    fast_dims++;
-                    fast_size *= sizes[ind];
+                    queue.wait(ticket);
                 }
-                else
+                catch (...)
                 {
-                    break;
                 }
             }
-            else
-            {
-                break;
-            }
-        }
-
-        int slow_dims = C->rank() - fast_dims;
-        size_t slow_size = 1L;
-        for (int dim = 0; dim < slow_dims; dim++)
-        {
-            slow_size *= sizes[dim];
         }
+        throw;
+    }
+}
+}
 
-        vector<size_t> Astrides(C->rank());
-        Astrides[C->rank() - 1] = 1L;
-        for (int ind = ((int)C->rank() - 2); ind >= 0; ind--)
-        {
-            Astrides[ind] = Astrides[ind + 1] * A->dims()[ind + 1];
-        }
-
-        vector<size_t> Cstrides(C->rank());
-        Cstrides[C->rank() - 1] = 1L;
-        for (int ind = ((int)C->rank() - 2); ind >= 0; ind--)
-        {
-            Cstrides[ind] = Cstrides[ind + 1] * C->dims()[ind + 1];
-        }
-
-        /// Buffer of A
-        double *Ap = new double[fast_size];
-        memset(Ap, '\0', sizeof(double) * fast_size);
-        /// Buffer of C
-        double *Cp = new double[fast_size];
-        memset(Cp, '\0', sizeof(double) * fast_size);
-
-        // => Slice Operation <= //
-
-        for (size_t ind = 0L; ind < slow_size; ind++)
-        {
-            size_t num = ind;
-            size_t Aoff = 0L;
-            size_t Coff = 0L;
-            for (int dim = slow_dims - 1; dim >= 0; dim--)
-            {
-                size_t val = num % sizes[dim]; // value of the dim-th index
-                num /= sizes[dim];
-                Aoff += (Ainds[dim][0] + val) * Astrides[dim];
-                Coff += (Cinds[dim][0] + val) * Cstrides[dim];
-            }
-            Aoff += Ainds[slow_dims][0] * Astrides[slow_dims];
-            Coff += Cinds[slow_dims][0] * Cstrides[slow_dims];
-
-            double *Ctp = Cp;
-            double *Atp = Ap;
+void slice(CoreTensorImplPtr C, ConstDiskTensorImplPtr A,
+           const IndexRange &Cinds, const IndexRange &Ainds, double alpha,
+           double beta)
+{
+    timer::timer_push("slice Disk -> Core");
 
-            if (beta != 0.0)
-            {
-                fseek(Cf, sizeof(double) * Coff, SEEK_SET);
-                fread(Ctp, sizeof(double), fast_size, Cf);
-            }
+    // A mapped A is read in place, without going through the queue
+    stream_slice(SliceRuns(C, A, Cinds, Ainds), A->mapping() ? nullptr : A,
+                 A->mapping(), nullptr, C->data().data(), alpha, beta);
 
-            fseek(Af, sizeof(double) * Aoff, SEEK_SET);
-            fread(Atp, sizeof(double), fast_size, Af);
+    timer::timer_pop();
+}
+void slice(DiskTensorImplPtr C, ConstCoreTensorImplPtr A,
+           const IndexRange &Cinds, const IndexRange &Ainds, double alpha,
+           double beta)
+{
+    timer::timer_push("slice Core -> Disk");
 
-            C_DSCAL(fast_size, beta, Ctp, 1);
-            C_DAXPY(fast_size, alpha, Atp, 1, Ctp, 1);
+    stream_slice(SliceRuns(C, A, Cinds, Ainds), nullptr, A->data().data(),
+                 C->mapping() ? nullptr : C, C->mapping(), alpha, beta);
 
-            fseek(Cf, sizeof(double) * Coff, SEEK_SET);
-            fwrite(Ctp, sizeof(double), fast_size, Cf);
-        }
+    timer::timer_pop();
+}
+void slice(DiskTensorImplPtr C, ConstDiskTensorImplPtr A,
+           const IndexRange &Cinds, const IndexRange &Ainds, double alpha,
+           double beta)
+{
+    timer::timer_push("slice Disk -> Disk");
 
-        delete[] Ap;
-        delete[] Cp;
-        fseek(Af, 0L, SEEK_SET);
-        fseek(Cf, 0L, SEEK_SET);
-    }
+    stream_slice(SliceRuns(C, A, Cinds, Ainds), A->mapping() ? nullptr : A,
+                 A->mapping(), C->mapping() ? nullptr : C, C->mapping(), alpha,
+                 beta);
 
     timer::timer_pop();
 }
@@ -28,17 +28,23 @@
  */
 
 #include <algorithm>
+#include <chrono>
 #include <cstdlib>
 #include <fstream>
 #include <iostream>
 #include <list>
+#include <map>
+#include <limits>
 #include <sys/stat.h>
+#include <unistd.h>
 
 #include "core/core.h"
 #include "disk/disk.h"
+#include "file/tensor_file.h"
 #include "indices.h"
 #include "tensorimpl.h"
 
+#include <ambit/memory.h>
 #include <ambit/print.h>
 #include <ambit/tensor.h>
 
@@ -61,6 +67,16 @@ namespace
 {
 
 int ninitialized = 0;
+
+/// Physical memory of the machine in bytes, unlimited when unknown
+size_t physical_memory()
+{
+    long pages = sysconf(_SC_PHYS_PAGES);
+    long page_size = sysconf(_SC_PAGE_SIZE);
+    if (pages <= 0 || page_size <= 0)
+        return std::numeric_limits<size_t>::max();
+    return static_cast<size_t>(pages) * static_cast<size_t>(page_size);
+}
 }
 
 int nprocess = 1;
@@ -69,7 +85,7 @@ int rank = 0;
 
 bool debug = false;
 
-size_t memory = 1 * 1024 * 1024 * 1024;
+size_t memory_limit = physical_memory();
 
 #if defined(HAVE_CYCLOPS)
 const bool distributed_capable = true;
@@ -78,11 +94,64 @@ const bool distributed_capable = false;
 #endif
 
 bool timers = false;
+
+std::string timer_json_file;
+
+std::string timer_trace_file;
+
+std::string contraction_log_file;
+
+int contraction_search_limit = 12;
+
+ContractionPolicy contraction_policy = MinimumFlops;
+
+int disk_queue_depth = 2;
+
+size_t disk_mmap_limit = 0;
+
+bool compress_tensor_files = false;
 } // namespace settings
 
 namespace
 {
 
+/// Interned ids of the timers of the Tensor operations, looked up once.
+/// Per-call details (names, indices, factors) go to the contraction log.
+struct TensorTimers
+{
+    size_t contract = timer::timer_id("Tensor::contract");
+    size_t permute = timer::timer_id("Tensor::permute");
+    size_t permute_sum = timer::timer_id("Tensor::permute_sum");
+};
+
+const TensorTimers &tensor_timers()
+{
+    static const TensorTimers timers;
+    return timers;
+}
+
+string labeled_name(const Tensor &T, const Indices &inds)
+{
+    return T.name() + "[" + indices::to_string(inds) + "]";
+}
+
+/// Logs a Tensor operation that started at start
+void log_operation(const string &operation, const string &expression,
+                   const vector<Dimension> &dims, double alpha, double beta,
+                   std::chrono::steady_clock::time_point start)
+{
+    timer::ContractionRecord record;
+    record.operation = operation;
+    record.expression = expression;
+    record.dims = dims;
+    record.alpha = alpha;
+    record.beta = beta;
+    record.seconds = std::chrono::duration<double>(
+                         std::chrono::steady_clock::now() - start)
+                         .count();
+    timer::log_contraction(record);
+}
+
 void common_initialize(int /*argc*/, char *const * /*argv*/)
 {
     if (settings::ninitialized != 0)
@@ -135,6 +204,8 @@ void finalize()
 #endif
 
     timer::report();
+    if (settings::timers || settings::debug)
+        memory::report();
     timer::finalize();
 }
 
@@ -423,16 +494,19 @@ void Tensor::contract(const Tensor &A, const Tensor &B, const Indices &Cinds,
                      indices::to_string(Binds) + "]\n");
     }
 
-    timer::timer_push("#: " + std::to_string(beta) + " " + name() + "[" +
-                      indices::to_string(Cinds) +
-                      "] = " + std::to_string(alpha) + " " + A.name() + "[" +
-                      indices::to_string(Ainds) + "] * " + B.name() + "[" +
-                      indices::to_string(Binds) + "]");
+    timer::TimerScope scope(tensor_timers().contract);
+    bool log = timer::contraction_logging();
+    auto start = std::chrono::steady_clock::now();
 
     tensor_->contract(A.tensor_.get(), B.tensor_.get(), Cinds, Ainds, Binds, A2,
                       B2, C2, alpha, beta);
 
-    timer::timer_pop();
+    if (log)
+        log_operation("Tensor::contract",
+                      labeled_name(*this, Cinds) + " = " +
+                          labeled_name(A, Ainds) + " * " +
+                          labeled_name(B, Binds),
+                      {dims(), A.dims(), B.dims()}, alpha, beta, start);
 }
 void Tensor::contract(const Tensor &A, const Tensor &B, const Indices &Cinds,
                       const Indices &Ainds, const Indices &Binds, double alpha,
@@ -447,16 +521,19 @@ void Tensor::contract(const Tensor &A, const Tensor &B, const Indices &Cinds,
                      indices::to_string(Binds) + "]\n");
     }
 
-    timer::timer_push("#: " + std::to_string(beta) + " " + name() + "[" +
-                      indices::to_string(Cinds) +
-                      "] = " + std::to_string(alpha) + " " + A.name() + "[" +
-                      indices::to_string(Ainds) + "] * " + B.name() + "[" +
-                      indices::to_string(Binds) + "]");
+    timer::TimerScope scope(tensor_timers().contract);
+    bool log = timer::contraction_logging();
+    auto start = std::chrono::steady_clock::now();
 
     tensor_->contract(A.tensor_.get(), B.tensor_.get(), Cinds, Ainds, Binds,
                       alpha, beta);
 
-    timer::timer_pop();
+    if (log)
+        log_operation("Tensor::contract",
+                      labeled_name(*this, Cinds) + " = " +
+                          labeled_name(A, Ainds) + " * " +
+                          labeled_name(B, Binds),
+                      {dims(), A.dims(), B.dims()}, alpha, beta, start);
 }
 void Tensor::permute(const Tensor &A, const Indices &Cinds,
                      const Indices &Ainds, double alpha, double beta)
@@ -468,13 +545,59 @@ void Tensor::permute(const Tensor &A, const Indices &Cinds,
                      "]\n");
     }
 
-    timer::timer_push("P: " + name() + "[" + indices::to_string(Cinds) +
-                      "] = " + A.name() + "[" + indices::to_string(Ainds) +
-                      "]");
+    timer::TimerScope scope(tensor_timers().permute);
+    bool log = timer::contraction_logging();
+    auto start = std::chrono::steady_clock::now();
 
     tensor_->permute(A.tensor_.get(), Cinds, Ainds, alpha, beta);
 
-    timer::timer_pop();
+    if (log)
+        log_operation("Tensor::permute",
+                      labeled_name(*this, Cinds) + " = " +
+                          labeled_name(A, Ainds),
+                      {dims(), A.dims()}, alpha, beta, start);
+}
+void Tensor::permute(const vector<Tensor> &As, const Indices &Cinds,
+                     const vector<Indices> &Ainds,
+                     const vector<double> &alphas, double beta)
+{
+    if (As.size() != Ainds.size() || As.size() != alphas.size())
+        throw std::runtime_error("Tensor::permute: need one set of indices "
+                                 "and one factor per tensor");
+
+    vector<ConstTensorImplPtr> impls;
+    for (size_t t = 0; t < As.size(); t++)
+        impls.push_back(As[t].tensor_.get());
+
+    // Names the terms, only when they are printed or logged
+    auto terms = [&]() {
+        string terms;
+        for (size_t t = 0; t < As.size(); t++)
+            terms += (t ? " + " : "") + labeled_name(As[t], Ainds[t]);
+        return terms;
+    };
+
+    if (ambit::settings::debug)
+    {
+        ambit::print("    P: " + name() + "[" + indices::to_string(Cinds) +
+                     "] = " + terms() + "\n");
+    }
+
+    timer::TimerScope scope(tensor_timers().permute_sum);
+    bool log = timer::contraction_logging();
+    auto start = std::chrono::steady_clock::now();
+
+    tensor_->permute_sum(impls, Cinds, Ainds, alphas, beta);
+
+    if (log)
+    {
+        vector<Dimension> Tdims{dims()};
+        for (const Tensor &A : As)
+            Tdims.push_back(A.dims());
+        log_operation("Tensor::permute_sum",
+                      labeled_name(*this, Cinds) + " = " + terms(), Tdims, 1.0,
+                      beta, start);
+    }
 }
 void Tensor::slice(const Tensor &A, const IndexRange &Cinds,
                    const IndexRange &Ainds, double alpha, double beta)
@@ -558,35 +681,26 @@ Tensor load_tensor(const std::string &filename)
     return t;
 }
 
-void write_tensor_to_file(Tensor t, std::ofstream &out)
+namespace
 {
-    // write the tensor name
-    auto name = t.name();
-    size_t size = name.size();
-    out.write(reinterpret_cast<char *>(&size), sizeof(size_t));
-    out.write(&name[0], size);
 
-    // write the rank and the size of each dimension
-    size_t rank = t.rank();
-    out.write(reinterpret_cast<char *>(&rank), sizeof(size_t));
-    for (size_t m = 0; m < rank; m++)
-    {
-        size_t dim = t.dim(m);
-        out.write(reinterpret_cast<char *>(&dim), sizeof(size_t));
-    }
-
-    // write the size of the date and the data.
-    size_t data_size = t.numel();
-    out.write(reinterpret_cast<char *>(&data_size), sizeof(size_t));
-    const std::vector<double> &data = t.data();
-    out.write(reinterpret_cast<const char *>(&data[0]),
-              data_size * sizeof(double));
+/// Ranges of the leading index values [first, first + rows) of a tensor
+IndexRange slab_ranges(const Dimension &dims, size_t first, size_t rows)
+{
+    IndexRange ranges;
+    for (size_t dim : dims)
+        ranges.push_back({0L, dim});
+    if (!ranges.empty())
+        ranges[0] = {first, first + rows};
+    return ranges;
 }
 
-void read_tensor_from_file(Tensor &t, std::ifstream &in)
+/// Reads the name and dims of a tensor saved in the unchunked layout of
+/// earlier versions, up to the size of the data
+void read_unchunked_header(std::istream &in, std::string &name,
+                           std::vector<size_t> &dims)
 {
     // read the tensor name
-    std::string name;
     size_t name_size;
     in.read(reinterpret_cast<char *>(&name_size), sizeof(size_t));
     name.resize(name_size);
@@ -595,13 +709,21 @@ void read_tensor_from_file(Tensor &t, std::ifstream &in)
     // read the rank and the size of each dimension
     size_t rank = 0;
     in.read(reinterpret_cast<char *>(&rank), sizeof(size_t));
-    std::vector<size_t> dims(rank, 0);
+    dims.assign(rank, 0);
     for (size_t m = 0; m < rank; m++)
     {
         size_t dim;
         in.read(reinterpret_cast<char *>(&dim), sizeof(size_t));
         dims[m] = dim;
     }
+}
+
+/// Reads a tensor saved in the unchunked layout of earlier versions
+void read_unchunked_tensor(Tensor &t, std::istream &in)
+{
+    std::string name;
+    std::vector<size_t> dims;
+    read_unchunked_header(in, name, dims);
 
     // allocate tensor or resize existing one
     if (t.is_set() == false)
@@ -621,4 +743,232 @@ void read_tensor_from_file(Tensor &t, std::ifstream &in)
     in.read(reinterpret_cast<char *>(&data[0]), data_size * sizeof(double));
 }
 
+/// Checks that ranges select a block of a tensor of the given dims and
+/// returns the dims of the block
+Dimension block_dims(const Dimension &dims, const IndexRange &ranges,
+                     const std::string &filename)
+{
+    if (ranges.size() != dims.size())
+        throw std::runtime_error("load: the ranges do not match the rank of "
+                                 "the tensor in " +
+                                 filename);
+    Dimension sizes;
+    for (size_t m = 0; m < dims.size(); m++)
+    {
+        if (ranges[m].size() != 2 || ranges[m][0] > ranges[m][1] ||
+            ranges[m][1] > dims[m])
+            throw std::runtime_error("load: range " + std::to_string(m) +
+                                     " is out of the bounds of the tensor "
+                                     "in " +
+                                     filename);
+        sizes.push_back(ranges[m][1] - ranges[m][0]);
+    }
+    return sizes;
+}
+
+/// Reads the runs of the block of an unchunked tensor that ranges select
+void read_unchunked_block(Tensor &block, std::istream &in,
+                          const IndexRange &ranges,
+                          const std::string &filename)
+{
+    std::string name;
+    std::vector<size_t> dims;
+    read_unchunked_header(in, name, dims);
+    Dimension sizes = block_dims(dims, ranges, filename);
+    block = Tensor::build(CoreTensor, name, sizes);
+    in.seekg(sizeof(size_t), std::ios_base::cur); // data size
+    std::streamoff data_start = in.tellg();
+
+    size_t rank = dims.size();
+    size_t run = rank == 0 ? 1L : sizes[rank - 1];
+    if (block.numel() == 0)
+        return;
+
+    // Walks the runs along the last index in the order of the block
+    std::vector<size_t> strides(rank, 1L);
+    for (int m = static_cast<int>(rank) - 2; m >= 0; m--)
+        strides[m] = strides[m + 1] * dims[m + 1];
+    std::vector<size_t> index(rank, 0L);
+    double *data = block.data().data();
+    for (size_t offset = 0L; offset < block.numel(); offset += run)
+    {
+        size_t position = 0L;
+        for (size_t m = 0; m < rank; m++)
+            position += (ranges[m][0] + index[m]) * strides[m];
+        in.seekg(data_start + static_cast<std::streamoff>(
+                                  position * sizeof(double)));
+        in.read(reinterpret_cast<char *>(data + offset), run * sizeof(double));
+
+        for (int m = static_cast<int>(rank) - 2; m >= 0; m--)
+        {
+            if (++index[m] < sizes[m])
+                break;
+            index[m] = 0L;
+        }
+    }
+    if (!in)
+        throw std::runtime_error("load: " + filename + " is truncated");
+}
+
+/// Reads the chunks of a chunked tensor that hold the block ranges select
+void read_chunked_block(Tensor &block, std::istream &in,
+                        const IndexRange &ranges, const std::string &filename)
+{
+    TensorRecord record = read_tensor_record(in);
+    Dimension sizes = block_dims(record.dims, ranges, filename);
+    block = Tensor::build(CoreTensor, record.name, sizes);
+    if (block.numel() == 0)
+        return;
+
+    // Leading index values [low, high) of the block
+    size_t low = sizes.empty() ? 0L : ranges[0][0];
+    size_t high = sizes.empty() ? 1L : ranges[0][1];
+    size_t first = low / record.slab_rows;
+    size_t last = (high + record.slab_rows - 1L) / record.slab_rows;
+
+    std::map<size_t, Tensor> tiles;
+    read_tensor_chunks(
+        in, record, first, last,
+        [&](size_t c) -> double * {
+            Dimension dims = record.dims;
+            if (!dims.empty())
+                dims[0] = record.chunk_rows(c);
+            tiles[c] = Tensor::build(CoreTensor, "tile", dims);
+            return tiles[c].data().data();
+        },
+        [&](size_t c, const double *) {
+            Tensor tile = tiles[c];
+            tiles.erase(c);
+            if (sizes.empty())
+            {
+                block.data()[0] = tile.data()[0];
+                return;
+            }
+            size_t row = record.first_row(c);
+            size_t begin = std::max(low, row);
+            size_t end = std::min(high, row + record.chunk_rows(c));
+            IndexRange Branges = slab_ranges(sizes, begin - low, end - begin);
+            IndexRange Tranges = ranges;
+            Tranges[0] = {begin - row, end - row};
+            block.slice(tile, Branges, Tranges);
+        });
+}
+}
+
+void write_tensor_to_file(Tensor t, std::ostream &out)
+{
+    // Core data is written in place, other tensors a chunk at a time
+    bool in_core = t.type() == CoreTensor;
+    TensorRecord layout;
+    layout.plan(t.dims());
+
+    write_tensor_record(
+        out, t.name(), t.dims(),
+        [&](size_t c, double *buffer) -> const double * {
+            size_t first = layout.first_row(c);
+            if (in_core)
+                return t.data().data() + first * layout.row_elements();
+
+            Dimension dims = t.dims();
+            if (!dims.empty())
+                dims[0] = layout.chunk_rows(c);
+            Tensor tile = Tensor::build(CoreTensor, "tile", dims);
+            tile.slice(t, slab_ranges(dims, 0L, layout.chunk_rows(c)),
+                       slab_ranges(t.dims(), first, layout.chunk_rows(c)));
+            std::copy(tile.data().begin(), tile.data().end(), buffer);
+            return buffer;
+        });
+}
+
+void read_tensor_from_file(Tensor &t, std::istream &in)
+{
+    if (!at_tensor_record(in))
+    {
+        read_unchunked_tensor(t, in);
+        return;
+    }
+    TensorRecord record = read_tensor_record(in);
+
+    // allocate tensor or resize existing one
+    if (t.is_set() == false)
+    {
+        t = Tensor::build(CoreTensor, record.name, record.dims);
+    }
+    else if (t.type() == CoreTensor)
+    {
+        t.set_name(record.name);
+        t.resize(record.dims);
+    }
+    else if (t.dims() != record.dims)
+    {
+        throw std::runtime_error("read_tensor_from_file: the dimensions of " +
+                                 t.name() + " do not match those of " +
+                                 record.name);
+    }
+
+    // Chunks land in place in core tensors and go through a tile otherwise
+    bool in_core = t.type() == CoreTensor;
+    read_tensor_chunks(
+        in, record, 0L, record.chunks.size(),
+        [&](size_t c) -> double * {
+            return in_core ? t.data().data() +
+                                 record.first_row(c) * record.row_elements()
+                           : nullptr;
+        },
+        [&](size_t c, const double *data) {
+            if (in_core)
+                return;
+            Dimension dims = record.dims;
+            if (!dims.empty())
+                dims[0] = record.chunk_rows(c);
+            Tensor tile = Tensor::build(CoreTensor, "tile", dims);
+            std::copy(data, data + record.chunk_elements(c),
+                      tile.data().begin());
+            t.slice(tile,
+                    slab_ranges(t.dims(), record.first_row(c),
+                                record.chunk_rows(c)),
+                    slab_ranges(dims, 0L, record.chunk_rows(c)));
+        });
+    in.seekg(record.start + static_cast<std::streamoff>(record.bytes));
+}
+
+void load(Tensor &t, const std::string &filename, const IndexRange &ranges)
+{
+    // check if file exists or not
+    std::ifstream in(filename.c_str(), std::ios_base::binary);
+    if (!in.good())
+    {
+        std::string error = "File " + filename + " does not exist.";
+        throw std::runtime_error(error);
+    }
+    // read the block into core
+    Tensor block;
+    if (at_tensor_record(in))
+        read_chunked_block(block, in, ranges, filename);
+    else
+        read_unchunked_block(block, in, ranges, filename);
+    in.close();
+
+    if (t.is_set() == false)
+    {
+        t = block;
+        return;
+    }
+    if (t.dims() != block.dims())
+        throw std::runtime_error("load: the dimensions of " + t.name() +
+                                 " do not match the ranges read from " +
+                                 filename);
+    t.set_name(block.name());
+    IndexRange whole = slab_ranges(block.dims(), 0L,
+                                   block.rank() == 0 ? 1L : block.dim(0));
+    t.slice(block, whole, whole);
+}
+
+Tensor load_tensor(const std::string &filename, const IndexRange &ranges)
+{
+    Tensor t;
+    load(t, filename, ranges);
+    return t;
+}
+
 } // namespace ambit
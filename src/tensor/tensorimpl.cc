@@ -60,6 +60,20 @@ void TensorImpl::slice(ConstTensorImplPtr A, const IndexRange &Cinds,
     ambit::slice(this, A, Cinds, Ainds, alpha, beta);
 }
 
+void TensorImpl::permute_sum(const vector<ConstTensorImplPtr> &As,
+                             const Indices &Cinds,
+                             const vector<Indices> &Ainds,
+                             const vector<double> &alphas, double beta)
+{
+    if (As.empty())
+    {
+        scale(beta);
+        return;
+    }
+    for (size_t t = 0; t < As.size(); t++)
+        permute(As[t], Cinds, Ainds[t], alphas[t], t == 0 ? beta : 1.0);
+}
+
 void TensorImpl::zero() { scale(0.0); }
 
 void TensorImpl::copy(ConstTensorImplPtr other)
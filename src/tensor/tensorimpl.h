@@ -62,6 +62,10 @@ class OutOfMemoryException : public std::runtime_error
 {
   public:
     OutOfMemoryException() : std::runtime_error("Out of memory") {}
+    explicit OutOfMemoryException(const std::string &str)
+        : std::runtime_error(str)
+    {
+    }
 };
 } // namespace detail
 
@@ -171,6 +175,13 @@ class TensorImpl
             "Operation not supported in this tensor implementation.");
     }
 
+    // C = sum_t alphas[t] * As[t](Ainds[t]) + beta * C. By default one
+    // permute per term.
+    virtual void permute_sum(const vector<ConstTensorImplPtr> &As,
+                             const Indices &Cinds,
+                             const vector<Indices> &Ainds,
+                             const vector<double> &alphas, double beta = 0.0);
+
     virtual void contract(ConstTensorImplPtr A, ConstTensorImplPtr B,
                           const Indices &Cinds, const Indices &Ainds,
                           const Indices &Binds, double alpha = 1.0,
@@ -36,9 +36,14 @@
 #include <ambit/timer.h>
 #include <ambit/print.h>
 
+#include <algorithm>
 #include <chrono>
 #include <cassert>
 #include <cstring>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
 
 namespace ambit
 {
@@ -53,58 +58,259 @@ namespace
 
 struct TimerDetail
 {
-    // Description of the timing block
-    string name;
+    // Interned name of the timing block
+    size_t id;
 
     // Accumulated runtime
     clock::duration total_time;
     // Number of times the timer has been called
     size_t total_calls;
+    // Shortest and longest calls
+    clock::duration min_time;
+    clock::duration max_time;
+    // Work done while the timer was the innermost one running
+    double flops;
+    double bytes;
 
-    TimerDetail *parent;
-    map<string, TimerDetail> children;
+    // Positions of the parent and children in the thread's tree
+    size_t parent;
+    vector<size_t> children;
 
     time_point start_time;
 
-    TimerDetail()
-        : name("(no name)"), total_time(0), total_calls(0), parent(nullptr)
+    TimerDetail(size_t id, size_t parent)
+        : id(id), total_time(0), total_calls(0),
+          min_time(clock::duration::max()), max_time(0), flops(0.0),
+          bytes(0.0), parent(parent)
     {
     }
 };
 
-TimerDetail *current_timer = nullptr;
-TimerDetail *root = nullptr;
+// One call of a timer, recorded for the trace
+struct TimerEvent
+{
+    size_t id;
+    time_point begin;
+    time_point end;
+};
+
+// The timers of one thread. timers[0] is the root, and current is the
+// position of the innermost running timer.
+struct TimerTree
+{
+    vector<TimerDetail> timers;
+    size_t current = 0;
+    // Calls recorded while settings::timer_trace_file is set
+    vector<TimerEvent> events;
+    // The generation of trees that this one belongs to
+    size_t generation;
+    // Number of the thread in the trace
+    size_t thread;
+
+    TimerTree(size_t generation, size_t thread)
+        : generation(generation), thread(thread)
+    {
+        timers.emplace_back(0, 0);
+    }
+};
+
+// Guards the names, the list of trees and the generation. None of these are
+// touched on the hot path once a thread has its tree and its ids.
+std::mutex registry_mutex;
+vector<string> names{"Total Run Time"};
+std::unordered_map<string, size_t> ids{{"Total Run Time", 0}};
+vector<std::unique_ptr<TimerTree>> trees;
+// Bumped by finalize so that threads drop the trees it freed
+size_t generation = 0;
+// Time zero of the trace
+const time_point epoch = clock::now();
+
+// Guards the contraction log, which is appended to once per operation
+std::mutex log_mutex;
+vector<ContractionRecord> contraction_records;
+
+thread_local TimerTree *thread_tree = nullptr;
+thread_local std::unordered_map<string, size_t> thread_ids;
+
+TimerTree &tree()
+{
+    // The thread's tree was freed by finalize if the generation moved on
+    if (thread_tree == nullptr || thread_tree->generation != generation)
+    {
+        std::lock_guard<std::mutex> lock(registry_mutex);
+        trees.emplace_back(new TimerTree(generation, trees.size()));
+        thread_tree = trees.back().get();
+    }
+    return *thread_tree;
 }
 
-void initialize()
+// A tree of timers merged from the trees of every thread
+struct MergedTimer
 {
-    root = new TimerDetail();
-    root->name = "Total Run Time";
-    root->parent = nullptr;
-    root->total_calls = 1;
+    string name;
+    clock::duration total_time{0};
+    size_t total_calls = 0;
+    clock::duration min_time = clock::duration::max();
+    clock::duration max_time{0};
+    double flops = 0.0;
+    double bytes = 0.0;
+    map<string, MergedTimer> children;
+};
 
-    current_timer = root;
+void merge(MergedTimer &merged, const TimerTree &tree, size_t timer)
+{
+    for (size_t child : tree.timers[timer].children)
+    {
+        const TimerDetail &detail = tree.timers[child];
+        MergedTimer &into = merged.children[names[detail.id]];
+        into.name = names[detail.id];
+        into.total_time += detail.total_time;
+        into.total_calls += detail.total_calls;
+        into.min_time = std::min(into.min_time, detail.min_time);
+        into.max_time = std::max(into.max_time, detail.max_time);
+        into.flops += detail.flops;
+        into.bytes += detail.bytes;
+        merge(into, tree, child);
+    }
+}
+
+MergedTimer merged_timers()
+{
+    MergedTimer root;
+    root.name = names[0];
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    for (const auto &thread : trees)
+        merge(root, *thread, 0);
+    return root;
+}
 
+long long nanoseconds(clock::duration time)
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(time).count();
+}
+
+// Writes s as a JSON string literal
+void write_string(std::ostream &out, const string &s)
+{
+    out << '"';
+    for (char c : s)
+    {
+        if (c == '"' || c == '\\')
+            out << '\\' << c;
+        else if (static_cast<unsigned char>(c) < 0x20)
+        {
+            char escaped[8];
+            snprintf(escaped, 8, "\\u%04x", c);
+            out << escaped;
+        }
+        else
+            out << c;
+    }
+    out << '"';
+}
+
+// This is a recursive function
+void write_timer_json(std::ostream &out, const MergedTimer &timer, int depth)
+{
+    string indent(2 * depth, ' ');
+    out << indent << "{\"name\": ";
+    write_string(out, timer.name);
+    if (depth > 0)
+    {
+        // A timer that is still running when we write has no calls yet
+        size_t calls = timer.total_calls;
+        out << ", \"calls\": " << calls
+            << ", \"total_ns\": " << nanoseconds(timer.total_time)
+            << ", \"min_ns\": " << (calls ? nanoseconds(timer.min_time) : 0)
+            << ", \"max_ns\": " << nanoseconds(timer.max_time)
+            << ", \"mean_ns\": "
+            << (calls ? nanoseconds(timer.total_time) / (long long)calls : 0)
+            << ", \"flops\": " << timer.flops
+            << ", \"bytes\": " << timer.bytes;
+    }
+    out << ", \"children\": [";
+    size_t n = 0;
+    for (auto &child : timer.children)
+    {
+        out << (n++ == 0 ? "\n" : ",\n");
+        write_timer_json(out, child.second, depth + 1);
+    }
+    if (n > 0)
+        out << "\n" << indent;
+    out << "]}";
+}
+
+string dimension_string(const Dimension &dims)
+{
+    string text = "[";
+    for (size_t d = 0; d < dims.size(); ++d)
+        text += (d == 0 ? "" : ",") + std::to_string(dims[d]);
+    return text + "]";
+}
+
+void write_file(const string &filename, void (*writer)(std::ostream &))
+{
+    std::ofstream out(filename);
+    if (!out)
+        throw std::runtime_error("timer: unable to open " + filename);
+    writer(out);
+    if (!out)
+        throw std::runtime_error("timer: unable to write " + filename);
+}
+}
+
+void initialize()
+{
     // Determine timer overhead
+    size_t overhead = timer_id("Timer Overhead");
     for (int i = 0; i < 1000; ++i)
     {
-        timer_push("Timer Overhead");
+        timer_push(overhead);
         timer_pop();
     }
 }
 
 void finalize()
 {
-    assert(root == current_timer);
-    delete root;
-    root = current_timer = nullptr;
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    assert(thread_tree == nullptr || thread_tree->current == 0);
+    trees.clear();
+    ++generation;
 }
 
 namespace
 {
 
+// The GFLOP/s, GB/s and flops per byte of a timer that counted its work
+string throughput(const MergedTimer *timer)
+{
+    double seconds = std::chrono::duration<double>(timer->total_time).count();
+    if (seconds <= 0.0 || (timer->flops == 0.0 && timer->bytes == 0.0))
+        return "";
+
+    char buffer[128];
+    string rates;
+    if (timer->flops > 0.0)
+    {
+        snprintf(buffer, 128, "%.3f GFLOP/s", timer->flops / seconds * 1.0e-9);
+        rates += buffer;
+    }
+    if (timer->bytes > 0.0)
+    {
+        snprintf(buffer, 128, "%s%.3f GB/s", rates.empty() ? "" : ", ",
+                 timer->bytes / seconds * 1.0e-9);
+        rates += buffer;
+    }
+    if (timer->flops > 0.0 && timer->bytes > 0.0)
+    {
+        snprintf(buffer, 128, ", %.3f flop/byte", timer->flops / timer->bytes);
+        rates += buffer;
+    }
+    return " [" + rates + "]";
+}
+
 // This is a recursive function
-void print_timer_info(TimerDetail *timer)
+void print_timer_info(const MergedTimer *timer, const MergedTimer *root)
 {
     char buffer[512];
     if (timer != root)
@@ -113,12 +319,16 @@ void print_timer_info(TimerDetail *timer)
                  std::chrono::duration_cast<std::chrono::milliseconds>(
                      timer->total_time),
                  timer->total_calls,
-                 std::chrono::duration_cast<std::chrono::milliseconds>(
-                     timer->total_time) /
-                     timer->total_calls);
-        print("%s%*s%s\n", buffer,
+                 timer->total_calls
+                     ? std::chrono::duration_cast<std::chrono::milliseconds>(
+                           timer->total_time)
+                               .count() /
+                           (long long)timer->total_calls
+                     : 0LL);
+        print("%s%*s%s%s\n", buffer,
               //              60 - ambit::current_indent() - strlen(buffer),
-              60 - strlen(buffer), "", timer->name.c_str());
+              60 - strlen(buffer), "", timer->name.c_str(),
+              throughput(timer).c_str());
     }
     else
     {
@@ -130,7 +340,7 @@ void print_timer_info(TimerDetail *timer)
 
         for (auto &child : timer->children)
         {
-            print_timer_info(&child.second);
+            print_timer_info(&child.second, root);
         }
 
         unindent(2);
@@ -141,23 +351,173 @@ void print_timer_info(TimerDetail *timer)
 void report()
 {
     if (settings::timers)
-        print_timer_info(root);
+    {
+        // Timers run by several threads add up, so a parallel region may
+        // report more time than the wall clock saw
+        MergedTimer root = merged_timers();
+        print_timer_info(&root, &root);
+
+        if (settings::rank == 0 && !settings::timer_json_file.empty())
+            write_file(settings::timer_json_file, write_json);
+        if (settings::rank == 0 && !settings::timer_trace_file.empty())
+            write_file(settings::timer_trace_file, write_trace);
+    }
+
+    // The log is also kept for debug printing, with or without timers
+    if (settings::rank == 0 && !settings::contraction_log_file.empty() &&
+        !contraction_log().empty())
+        write_file(settings::contraction_log_file, write_contraction_log);
+}
+
+void write_json(std::ostream &out)
+{
+    write_timer_json(out, merged_timers(), 0);
+    out << "\n";
+}
+
+void write_trace(std::ostream &out)
+{
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    out << "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [";
+    const char *separator = "\n";
+    char buffer[128];
+    for (const auto &thread : trees)
+    {
+        snprintf(buffer, 128,
+                 "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": %d, "
+                 "\"tid\": %zu, \"args\": {\"name\": \"thread %zu\"}}",
+                 settings::rank, thread->thread, thread->thread);
+        out << separator << buffer;
+        separator = ",\n";
+
+        // Complete events, in microseconds from the start of the run
+        for (const TimerEvent &event : thread->events)
+        {
+            out << separator << "{\"name\": ";
+            write_string(out, names[event.id]);
+            snprintf(buffer, 128,
+                     ", \"ph\": \"X\", \"pid\": %d, \"tid\": %zu, "
+                     "\"ts\": %.3f, \"dur\": %.3f}",
+                     settings::rank, thread->thread,
+                     nanoseconds(event.begin - epoch) * 1.0e-3,
+                     nanoseconds(event.end - event.begin) * 1.0e-3);
+            out << buffer;
+        }
+    }
+    out << "\n]}\n";
+}
+
+bool contraction_logging()
+{
+    return settings::debug || !settings::contraction_log_file.empty();
+}
+
+void log_contraction(const ContractionRecord &record)
+{
+    if (settings::debug)
+    {
+        string dims;
+        for (const Dimension &d : record.dims)
+            dims += " " + dimension_string(d);
+        print("%s: %s :%s : perm C/A/B %d%d%d : m %zu n %zu k %zu batch %zu "
+              ": %.3f ms : %.3f GFLOP/s\n",
+              record.operation.c_str(), record.expression.c_str(),
+              dims.c_str(), record.permC, record.permA, record.permB,
+              record.m, record.n, record.k, record.batch,
+              record.seconds * 1.0e3, record.gflops());
+    }
+
+    if (settings::contraction_log_file.empty())
+        return;
+    std::lock_guard<std::mutex> lock(log_mutex);
+    contraction_records.push_back(record);
+}
+
+vector<ContractionRecord> contraction_log()
+{
+    std::lock_guard<std::mutex> lock(log_mutex);
+    return contraction_records;
+}
+
+void clear_contraction_log()
+{
+    std::lock_guard<std::mutex> lock(log_mutex);
+    contraction_records.clear();
+}
+
+void write_contraction_log(std::ostream &out)
+{
+    for (const ContractionRecord &record : contraction_log())
+    {
+        out << "{\"operation\": ";
+        write_string(out, record.operation);
+        out << ", \"expression\": ";
+        write_string(out, record.expression);
+        out << ", \"dims\": [";
+        for (size_t t = 0; t < record.dims.size(); ++t)
+            out << (t == 0 ? "" : ", ") << dimension_string(record.dims[t]);
+        out << "], \"alpha\": " << record.alpha
+            << ", \"beta\": " << record.beta
+            << ", \"permC\": " << (record.permC ? "true" : "false")
+            << ", \"permA\": " << (record.permA ? "true" : "false")
+            << ", \"permB\": " << (record.permB ? "true" : "false")
+            << ", \"m\": " << record.m << ", \"n\": " << record.n
+            << ", \"k\": " << record.k << ", \"batch\": " << record.batch
+            << ", \"seconds\": " << record.seconds
+            << ", \"flops\": " << record.flops
+            << ", \"bytes\": " << record.bytes
+            << ", \"gflops\": " << record.gflops() << "}\n";
+    }
+}
+
+size_t timer_id(const string &name)
+{
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    auto id = ids.find(name);
+    if (id != ids.end())
+        return id->second;
+    names.push_back(name);
+    ids[name] = names.size() - 1;
+    return names.size() - 1;
 }
 
 void timer_push(const string &name)
 {
     if (settings::timers)
     {
-        assert(current_timer != nullptr);
+        // Each thread caches the ids it has seen to stay off the registry
+        auto id = thread_ids.find(name);
+        if (id == thread_ids.end())
+            id = thread_ids.emplace(name, timer_id(name)).first;
+        timer_push(id->second);
+    }
+}
 
-        if (current_timer->children.count(name) == 0)
+void timer_push(size_t id)
+{
+    if (settings::timers)
+    {
+        TimerTree &timers = tree();
+
+        size_t current = timers.current;
+        size_t child = 0;
+        for (size_t c : timers.timers[current].children)
+        {
+            if (timers.timers[c].id == id)
+            {
+                child = c;
+                break;
+            }
+        }
+        if (child == 0)
         {
-            current_timer->children[name].name = name;
-            current_timer->children[name].parent = current_timer;
+            child = timers.timers.size();
+            timers.timers.emplace_back(id, current);
+            timers.timers[current].children.push_back(child);
         }
 
-        current_timer = &current_timer->children[name];
-        current_timer->start_time = clock::now();
+        timers.current = child;
+        timers.timers[child].start_time = clock::now();
     }
 }
 
@@ -165,11 +525,60 @@ void timer_pop()
 {
     if (settings::timers)
     {
-        current_timer->total_time += clock::now() - current_timer->start_time;
-        current_timer->total_calls++;
+        TimerTree &timers = tree();
+        // Timers turned on inside a scope have nothing to pop
+        if (timers.current == 0)
+            return;
 
-        current_timer = current_timer->parent;
+        TimerDetail &timer = timers.timers[timers.current];
+        time_point end = clock::now();
+        clock::duration elapsed = end - timer.start_time;
+        timer.total_time += elapsed;
+        timer.total_calls++;
+        timer.min_time = std::min(timer.min_time, elapsed);
+        timer.max_time = std::max(timer.max_time, elapsed);
+
+        if (!settings::timer_trace_file.empty())
+            timers.events.push_back(TimerEvent{timer.id, timer.start_time, end});
+
+        timers.current = timer.parent;
+    }
+}
+
+void add_flops(double flops)
+{
+    if (settings::timers)
+    {
+        TimerTree &timers = tree();
+        timers.timers[timers.current].flops += flops;
     }
 }
+
+void add_bytes(double bytes)
+{
+    if (settings::timers)
+    {
+        TimerTree &timers = tree();
+        timers.timers[timers.current].bytes += bytes;
+    }
+}
+
+TimerScope::TimerScope(const string &name) : active_(settings::timers)
+{
+    if (active_)
+        timer_push(name);
+}
+
+TimerScope::TimerScope(size_t id) : active_(settings::timers)
+{
+    if (active_)
+        timer_push(id);
+}
+
+TimerScope::~TimerScope()
+{
+    if (active_ && settings::timers)
+        timer_pop();
+}
 }
 }
@@ -0,0 +1,460 @@
+/*
+ * @BEGIN LICENSE
+ *
+ * ambit: C++ library for the implementation of tensor product calculations
+ *        through a clean, concise user interface.
+ *
+ * Copyright (c) 2014-2017 Ambit developers.
+ *
+ * The copyrights for code used from other parties are included in
+ * the corresponding files.
+ *
+ * This file is part of ambit.
+ *
+ * Ambit is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * Ambit is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License along
+ * with ambit; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * @END LICENSE
+ */
+
+// Contraction, permutation, slice, blocked and disk I/O micro-benchmarks.
+//
+//   test_benchmark [--sizes 32,64] [--repeat 5] [--warmup 1] [--filter text]
+//                  [--json out.json] [--baseline base.json [--tolerance 0.25]]
+//                  [--quick]
+//
+// Every benchmark is run at each size of the sweep: warmup runs are
+// discarded, then the median and percentiles of the timed runs are reported.
+// With --baseline, the medians are compared against those of an earlier
+// --json file and the run fails if any is slower by more than the tolerance.
+// --quick runs one tiny size once, to check that every benchmark still runs.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <ambit/blocked_tensor.h>
+#include <ambit/print.h>
+#include <ambit/tensor.h>
+
+using namespace ambit;
+
+namespace
+{
+
+// The operation a benchmark times at one size, and the work it does
+struct Run
+{
+    std::function<void()> operation;
+    double flops;
+    double bytes;
+};
+
+struct Benchmark
+{
+    std::string name;
+    // Builds the tensors for a size and returns the operation on them
+    std::function<Run(size_t n)> prepare;
+};
+
+struct Result
+{
+    std::string name;
+    size_t size;
+    std::vector<double> seconds; // sorted
+    double flops;
+    double bytes;
+
+    double percentile(double p) const
+    {
+        double position = p / 100.0 * (seconds.size() - 1);
+        size_t below = static_cast<size_t>(position);
+        size_t above = std::min(below + 1, seconds.size() - 1);
+        return seconds[below] +
+               (position - below) * (seconds[above] - seconds[below]);
+    }
+    double median() const { return percentile(50.0); }
+    double mean() const
+    {
+        double sum = 0.0;
+        for (double s : seconds)
+            sum += s;
+        return sum / seconds.size();
+    }
+};
+
+Tensor random_tensor(TensorType type, const std::string &name,
+                     const Dimension &dims)
+{
+    Tensor T = Tensor::build(CoreTensor, name, dims);
+    std::vector<double> &data = T.data();
+    for (size_t i = 0; i < data.size(); ++i)
+        data[i] = double(std::rand()) / double(RAND_MAX);
+    if (type == CoreTensor)
+        return T;
+    Tensor D = Tensor::build(type, name, dims);
+    D.copy(T);
+    return D;
+}
+
+size_t numel(const Dimension &dims)
+{
+    size_t n = 1;
+    for (size_t d : dims)
+        n *= d;
+    return n;
+}
+
+// C(Cinds) = A(Ainds) * B(Binds) with the dimensions given per index label
+Benchmark contraction(const std::string &name, const std::string &Cinds,
+                      const std::string &Ainds, const std::string &Binds,
+                      std::function<size_t(size_t n, char index)> extent)
+{
+    return Benchmark{
+        "contract/" + name, [=](size_t n) {
+            auto dims = [&](const std::string &inds) {
+                Dimension d;
+                for (char index : inds)
+                    d.push_back(extent(n, index));
+                return d;
+            };
+            Tensor C = random_tensor(CoreTensor, "C", dims(Cinds));
+            Tensor A = random_tensor(CoreTensor, "A", dims(Ainds));
+            Tensor B = random_tensor(CoreTensor, "B", dims(Binds));
+
+            std::string all = Cinds + Ainds + Binds;
+            std::sort(all.begin(), all.end());
+            all.erase(std::unique(all.begin(), all.end()), all.end());
+            double flops = 2.0 * numel(dims(all));
+            double bytes = sizeof(double) *
+                           (C.numel() + A.numel() + B.numel());
+
+            auto labels = [](const std::string &inds) {
+                std::string labels;
+                for (char index : inds)
+                    labels += std::string(labels.empty() ? "" : ",") + index;
+                return labels;
+            };
+            std::string c = labels(Cinds), a = labels(Ainds),
+                        b = labels(Binds);
+            return Run{[=]() mutable { C(c) = A(a) * B(b); }, flops, bytes};
+        }};
+}
+
+// Reverses the indices of a rank-r tensor of about 4 n^3 elements
+Benchmark permutation(size_t rank)
+{
+    return Benchmark{
+        "permute/rank" + std::to_string(rank), [=](size_t n) {
+            size_t extent = std::max<size_t>(
+                2, static_cast<size_t>(std::round(
+                       std::pow(4.0 * n * n * n, 1.0 / rank))));
+            Dimension dims(rank, extent);
+            Tensor C = random_tensor(CoreTensor, "C", dims);
+            Tensor A = random_tensor(CoreTensor, "A", dims);
+
+            std::string a, c;
+            for (size_t r = 0; r < rank; ++r)
+            {
+                a += std::string(r == 0 ? "" : ",") + char('a' + r);
+                c += std::string(r == 0 ? "" : ",") + char('a' + rank - 1 - r);
+            }
+            return Run{[=]() mutable { C(c) = A(a); }, 0.0,
+                       2.0 * sizeof(double) * C.numel()};
+        }};
+}
+
+// Copies the middle n^3 block of a (2n)^3 tensor of type Atype into one of
+// type Ctype
+Benchmark slice(const std::string &name, TensorType Ctype, TensorType Atype)
+{
+    return Benchmark{
+        "slice/" + name, [=](size_t n) {
+            Tensor A = random_tensor(Atype, "A", {2 * n, 2 * n, 2 * n});
+            Tensor C = random_tensor(Ctype, "C", {n, n, n});
+            IndexRange Cinds(3, {0, n});
+            IndexRange Ainds(3, {n / 2, n / 2 + n});
+            return Run{[=]() mutable { C.slice(A, Cinds, Ainds); }, 0.0,
+                       2.0 * sizeof(double) * C.numel()};
+        }};
+}
+
+// C(pqrs) = A(pqtu) * B(turs) over the 16 blocks of a general space of an
+// occupied (n/8) and a virtual (n/4) space
+Benchmark blocked_contraction()
+{
+    return Benchmark{"blocked/contract", [](size_t n) {
+                         size_t no = std::max<size_t>(1, n / 8);
+                         size_t nv = std::max<size_t>(1, n / 4);
+                         std::vector<size_t> occupied, virtuals;
+                         for (size_t i = 0; i < no; ++i)
+                             occupied.push_back(i);
+                         for (size_t a = 0; a < nv; ++a)
+                             virtuals.push_back(no + a);
+                         BlockedTensor::reset_mo_spaces();
+                         BlockedTensor::add_mo_space("o", "i,j", occupied,
+                                                     NoSpin);
+                         BlockedTensor::add_mo_space("v", "a,b", virtuals,
+                                                     NoSpin);
+                         BlockedTensor::add_composite_mo_space(
+                             "g", "p,q,r,s,t,u", {"o", "v"});
+
+                         BlockedTensor C =
+                             BlockedTensor::build(CoreTensor, "C", {"gggg"});
+                         BlockedTensor A =
+                             BlockedTensor::build(CoreTensor, "A", {"gggg"});
+                         BlockedTensor B =
+                             BlockedTensor::build(CoreTensor, "B", {"gggg"});
+                         size_t ng = no + nv;
+                         double flops = 2.0 * std::pow(double(ng), 6.0);
+                         double bytes = 3.0 * sizeof(double) *
+                                        std::pow(double(ng), 4.0);
+                         return Run{[=]() mutable {
+                                        C("pqrs") = A("pqtu") * B("turs");
+                                    },
+                                    flops, bytes};
+                     }};
+}
+
+// Saves, or loads, a tensor of 4 n^3 elements
+Benchmark tensor_file(bool saving)
+{
+    return Benchmark{
+        saving ? "io/save" : "io/load", [=](size_t n) {
+            std::string filename = "benchmark.ten";
+            Tensor A = random_tensor(CoreTensor, "A", {4 * n, n, n});
+            save(A, filename);
+            double bytes = sizeof(double) * A.numel();
+            if (saving)
+                return Run{[=]() { save(A, filename); }, 0.0, bytes};
+            return Run{[=]() mutable { load(A, filename); }, 0.0, bytes};
+        }};
+}
+
+std::vector<Benchmark> benchmarks()
+{
+    auto square = [](size_t n, char) { return 4 * n; };
+    auto vector = [](size_t n, char) { return 16 * n; };
+    auto cube = [](size_t n, char) { return n * n * n; };
+    auto linear = [](size_t n, char) { return n; };
+
+    std::vector<Benchmark> all{
+        contraction("gemm", "ij", "ik", "kj", square),
+        contraction("gemm_transposed", "ij", "ki", "jk", square),
+        contraction("gemm_permuted", "ijab", "icja", "cb", linear),
+        contraction("batched_gemm", "Pij", "Pik", "Pkj", linear),
+        contraction("gemv", "i", "ij", "j", vector),
+        contraction("ger", "ij", "i", "j", vector),
+        contraction("dot", "", "i", "i", cube),
+        contraction("hadamard", "i", "i", "i", cube),
+        contraction("hadamard_gemm", "Pij", "Pik", "Pjk", linear)};
+    for (size_t rank = 2; rank <= 8; ++rank)
+        all.push_back(permutation(rank));
+    all.push_back(slice("core_core", CoreTensor, CoreTensor));
+    all.push_back(slice("disk_core", CoreTensor, DiskTensor));
+    all.push_back(slice("core_disk", DiskTensor, CoreTensor));
+    all.push_back(blocked_contraction());
+    all.push_back(tensor_file(true));
+    all.push_back(tensor_file(false));
+    return all;
+}
+
+Result measure(const Benchmark &benchmark, size_t n, int warmup, int repeat)
+{
+    Run run = benchmark.prepare(n);
+    for (int i = 0; i < warmup; ++i)
+        run.operation();
+
+    Result result{benchmark.name, n, {}, run.flops, run.bytes};
+    for (int i = 0; i < repeat; ++i)
+    {
+        auto start = std::chrono::steady_clock::now();
+        run.operation();
+        result.seconds.push_back(std::chrono::duration<double>(
+                                     std::chrono::steady_clock::now() - start)
+                                     .count());
+    }
+    std::sort(result.seconds.begin(), result.seconds.end());
+    return result;
+}
+
+void write_json(const std::string &filename, const std::vector<Result> &results)
+{
+    std::ofstream out(filename);
+    if (!out)
+        throw std::runtime_error("unable to open " + filename);
+    out << "{\"benchmarks\": [\n";
+    for (size_t r = 0; r < results.size(); ++r)
+    {
+        const Result &result = results[r];
+        // One benchmark per line, which is what read_baseline expects
+        out << "{\"name\": \"" << result.name << "\", \"size\": " << result.size
+            << ", \"repeat\": " << result.seconds.size()
+            << ", \"median_s\": " << result.median()
+            << ", \"p10_s\": " << result.percentile(10.0)
+            << ", \"p90_s\": " << result.percentile(90.0)
+            << ", \"min_s\": " << result.seconds.front()
+            << ", \"max_s\": " << result.seconds.back()
+            << ", \"mean_s\": " << result.mean()
+            << ", \"flops\": " << result.flops
+            << ", \"bytes\": " << result.bytes << "}"
+            << (r + 1 < results.size() ? ",\n" : "\n");
+    }
+    out << "]}\n";
+    if (!out)
+        throw std::runtime_error("unable to write " + filename);
+}
+
+// The median seconds of each benchmark and size in a file from write_json
+std::map<std::pair<std::string, size_t>, double>
+read_baseline(const std::string &filename)
+{
+    std::ifstream in(filename);
+    if (!in)
+        throw std::runtime_error("unable to open " + filename);
+
+    auto field = [](const std::string &line, const std::string &key) {
+        size_t at = line.find("\"" + key + "\": ");
+        if (at == std::string::npos)
+            throw std::runtime_error("baseline line without " + key + ": " +
+                                     line);
+        return line.substr(at + key.size() + 4);
+    };
+
+    std::map<std::pair<std::string, size_t>, double> medians;
+    std::string line;
+    while (std::getline(in, line))
+    {
+        if (line.compare(0, 9, "{\"name\": ") != 0)
+            continue;
+        std::string name = field(line, "name").substr(1);
+        name = name.substr(0, name.find('"'));
+        size_t size = std::stoul(field(line, "size"));
+        medians[std::make_pair(name, size)] = std::stod(field(line, "median_s"));
+    }
+    return medians;
+}
+
+std::vector<size_t> parse_sizes(const std::string &text)
+{
+    std::vector<size_t> sizes;
+    std::stringstream stream(text);
+    std::string size;
+    while (std::getline(stream, size, ','))
+        sizes.push_back(std::stoul(size));
+    if (sizes.empty())
+        throw std::runtime_error("no sizes given");
+    return sizes;
+}
+}
+
+int main(int argc, char *argv[])
+{
+    std::vector<size_t> sizes{32, 64};
+    int repeat = 5;
+    int warmup = 1;
+    std::string filter, json, baseline;
+    double tolerance = 0.25;
+
+    for (int arg = 1; arg < argc; ++arg)
+    {
+        std::string option = argv[arg];
+        bool has_value = arg + 1 < argc;
+        if (option == "--quick")
+        {
+            sizes = {8};
+            repeat = 1;
+            warmup = 0;
+        }
+        else if (option == "--sizes" && has_value)
+            sizes = parse_sizes(argv[++arg]);
+        else if (option == "--repeat" && has_value)
+            repeat = std::max(1, std::atoi(argv[++arg]));
+        else if (option == "--warmup" && has_value)
+            warmup = std::max(0, std::atoi(argv[++arg]));
+        else if (option == "--filter" && has_value)
+            filter = argv[++arg];
+        else if (option == "--json" && has_value)
+            json = argv[++arg];
+        else if (option == "--baseline" && has_value)
+            baseline = argv[++arg];
+        else if (option == "--tolerance" && has_value)
+            tolerance = std::atof(argv[++arg]);
+        else
+        {
+            std::fprintf(stderr, "test_benchmark: unknown option %s\n",
+                         option.c_str());
+            return EXIT_FAILURE;
+        }
+    }
+
+    srand(0);
+    ambit::initialize(argc, argv);
+
+    std::vector<Result> results;
+    ambit::print("%-28s %5s %12s %12s %12s %10s %10s\n", "Benchmark", "Size",
+                 "Median (ms)", "P10 (ms)", "P90 (ms)", "GFLOP/s", "GB/s");
+    for (const Benchmark &benchmark : benchmarks())
+    {
+        if (benchmark.name.find(filter) == std::string::npos)
+            continue;
+        for (size_t n : sizes)
+        {
+            results.push_back(measure(benchmark, n, warmup, repeat));
+            const Result &result = results.back();
+            double median = result.median();
+            ambit::print("%-28s %5zu %12.3f %12.3f %12.3f %10.3f %10.3f\n",
+                         result.name.c_str(), n, median * 1.0e3,
+                         result.percentile(10.0) * 1.0e3,
+                         result.percentile(90.0) * 1.0e3,
+                         median > 0.0 ? result.flops / median * 1.0e-9 : 0.0,
+                         median > 0.0 ? result.bytes / median * 1.0e-9 : 0.0);
+        }
+    }
+    std::remove("benchmark.ten");
+
+    if (!json.empty())
+        write_json(json, results);
+
+    bool regressed = false;
+    if (!baseline.empty())
+    {
+        auto medians = read_baseline(baseline);
+        ambit::print("\nAgainst %s (tolerance %.0f%%):\n", baseline.c_str(),
+                     tolerance * 100.0);
+        for (const Result &result : results)
+        {
+            auto base = medians.find(std::make_pair(result.name, result.size));
+            if (base == medians.end())
+                continue;
+            double ratio = result.median() / base->second;
+            bool slower = ratio > 1.0 + tolerance;
+            regressed |= slower;
+            ambit::print("%-28s %5zu %8.3fx%s\n", result.name.c_str(),
+                         result.size, ratio, slower ? "  REGRESSION" : "");
+        }
+    }
+
+    ambit::finalize();
+    return regressed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -27,10 +27,16 @@
  * @END LICENSE
  */
 
+#include <ambit/memory.h>
+#include <ambit/settings.h>
 #include <ambit/tensor.h>
+#include <ambit/timer.h>
 #include <cmath>
 #include <cstdlib>
+#include <functional>
+#include <sstream>
 #include <stdexcept>
+#include <thread>
 
 #define ANSI_COLOR_RED "\x1b[31m"
 #define ANSI_COLOR_GREEN "\x1b[32m"
@@ -1726,6 +1732,131 @@ double try_permute_rank4_lkji()
     return relative_difference(C1, C2);
 }
 
+double try_permute_sum_rank3()
+{
+    // Every term has a different fast index, and C spans several tiles
+    Dimension Cdims = {37, 45, 50};
+    Tensor C1 = Tensor::build(CoreTensor, "C1", Cdims);
+    Tensor C2 = Tensor::build(CoreTensor, "C2", Cdims);
+    initialize_random(C1, C2);
+
+    Tensor A = Tensor::build(CoreTensor, "A", {37, 45, 50});
+    Tensor B = Tensor::build(CoreTensor, "B", {50, 37, 45});
+    Tensor D = Tensor::build(CoreTensor, "D", {45, 50, 37});
+    initialize_random(A);
+    initialize_random(B);
+    initialize_random(D);
+
+    double scale = 1.0, keep = 0.0;
+    if (mode == 0)
+    {
+        C1.permute({A, B, D}, {"i", "j", "k"},
+                   {{"i", "j", "k"}, {"k", "i", "j"}, {"j", "k", "i"}},
+                   {alpha, -0.5 * alpha, 2.0 * alpha}, beta);
+        scale = alpha;
+        keep = beta;
+    }
+    else if (mode == 1)
+        C1("ijk") = A("ijk") - 0.5 * B("kij") + 2.0 * D("jki");
+    else if (mode == 2)
+    {
+        C1("ijk") += A("ijk") - 0.5 * B("kij") + 2.0 * D("jki");
+        keep = 1.0;
+    }
+    else if (mode == 3)
+    {
+        C1("ijk") -= A("ijk") - 0.5 * B("kij") + 2.0 * D("jki");
+        scale = -1.0;
+        keep = 1.0;
+    }
+    else
+        throw std::runtime_error("Bad mode.");
+
+    std::vector<double> &Av = A.data();
+    std::vector<double> &Bv = B.data();
+    std::vector<double> &Dv = D.data();
+    std::vector<double> &Cv = C2.data();
+    for (size_t i = 0; i < Cdims[0]; i++)
+    {
+        for (size_t j = 0; j < Cdims[1]; j++)
+        {
+            for (size_t k = 0; k < Cdims[2]; k++)
+            {
+                double &c = Cv[(i * Cdims[1] + j) * Cdims[2] + k];
+                c = keep * c + scale * Av[(i * 45 + j) * 50 + k] -
+                    0.5 * scale * Bv[(k * 37 + i) * 45 + j] +
+                    2.0 * scale * Dv[(j * 50 + k) * 37 + i];
+            }
+        }
+    }
+
+    return relative_difference(C1, C2);
+}
+
+double try_permute_sum_rank4_antisymmetrize()
+{
+    Dimension Cdims = {9, 9, 20, 20};
+    Tensor C1 = Tensor::build(CoreTensor, "C1", Cdims);
+    Tensor C2 = Tensor::build(CoreTensor, "C2", Cdims);
+    initialize_random(C1, C2);
+
+    Tensor A = Tensor::build(CoreTensor, "A", Cdims);
+    initialize_random(A);
+
+    double scale = 1.0, keep = 0.0;
+    if (mode == 0)
+    {
+        C1.permute({A, A, A, A}, {"i", "j", "a", "b"},
+                   {{"i", "j", "a", "b"},
+                    {"j", "i", "a", "b"},
+                    {"i", "j", "b", "a"},
+                    {"j", "i", "b", "a"}},
+                   {alpha, -alpha, -alpha, alpha}, beta);
+        scale = alpha;
+        keep = beta;
+    }
+    else if (mode == 1)
+        C1("ijab") = A("ijab") - A("jiab") - A("ijba") + A("jiba");
+    else if (mode == 2)
+    {
+        C1("ijab") += A("ijab") - A("jiab") - A("ijba") + A("jiba");
+        keep = 1.0;
+    }
+    else if (mode == 3)
+    {
+        C1("ijab") -= A("ijab") - A("jiab") - A("ijba") + A("jiba");
+        scale = -1.0;
+        keep = 1.0;
+    }
+    else
+        throw std::runtime_error("Bad mode.");
+
+    std::vector<double> &Av = A.data();
+    std::vector<double> &Cv = C2.data();
+    auto at = [&](size_t i, size_t j, size_t a, size_t b) {
+        return ((i * Cdims[1] + j) * Cdims[2] + a) * Cdims[3] + b;
+    };
+    for (size_t i = 0; i < Cdims[0]; i++)
+    {
+        for (size_t j = 0; j < Cdims[1]; j++)
+        {
+            for (size_t a = 0; a < Cdims[2]; a++)
+            {
+                for (size_t b = 0; b < Cdims[3]; b++)
+                {
+                    double &c = Cv[at(i, j, a, b)];
+                    c = keep * c + scale * Av[at(i, j, a, b)] -
+                        scale * Av[at(j, i, a, b)] -
+                        scale * Av[at(i, j, b, a)] +
+                        scale * Av[at(j, i, b, a)];
+                }
+            }
+        }
+    }
+
+    return relative_difference(C1, C2);
+}
+
 double try_permute_label_fail()
 {
     Dimension Cdims = {3, 4};
@@ -2311,6 +2442,73 @@ double try_contract_gemm8()
 {
     return try_C_equal_A_B("ji", "ki", "kj", {1, 0}, {2, 0}, {2, 1});
 }
+double try_C_equal_A_B_batched(size_t np, size_t ni, size_t nj, size_t nk)
+{
+    Tensor A = Tensor::build(CoreTensor, "A", {np, ni, nk});
+    initialize_random(A);
+    Tensor B = Tensor::build(CoreTensor, "B", {np, nk, nj});
+    initialize_random(B);
+    Tensor C1 = Tensor::build(CoreTensor, "C1", {np, ni, nj});
+    Tensor C2 = Tensor::build(CoreTensor, "C2", {np, ni, nj});
+    initialize_random(C1, C2);
+
+    if (mode == 0)
+        C1.contract(A, B, {"p", "i", "j"}, {"p", "i", "k"}, {"p", "k", "j"},
+                    alpha, beta);
+    else if (mode == 1)
+        C1("pij") = A("pik") * B("pkj");
+    else if (mode == 2)
+        C1("pij") += A("pik") * B("pkj");
+    else if (mode == 3)
+        C1("pij") -= A("pik") * B("pkj");
+    else
+        throw std::runtime_error("Bad mode.");
+
+    C2.scale(beta);
+    std::vector<double> &Av = A.data();
+    std::vector<double> &Bv = B.data();
+    std::vector<double> &Cv = C2.data();
+    for (size_t p = 0; p < np; ++p)
+    {
+        for (size_t i = 0; i < ni; ++i)
+        {
+            for (size_t j = 0; j < nj; ++j)
+            {
+                for (size_t k = 0; k < nk; ++k)
+                {
+                    Cv[(p * ni + i) * nj + j] += alpha *
+                                                 Av[(p * ni + i) * nk + k] *
+                                                 Bv[(p * nk + k) * nj + j];
+                }
+            }
+        }
+    }
+
+    return relative_difference(C1, C2);
+}
+double try_contract_batched_gemm1()
+{
+    return try_C_equal_A_B_batched(50, 3, 4, 5);
+}
+double try_contract_batched_gemm2()
+{
+    return try_C_equal_A_B_batched(2, 130, 131, 132);
+}
+double try_contract_batched_gemv()
+{
+    return try_C_equal_A_B_batched(50, 6, 1, 5);
+}
+double try_contract_plan_reuse()
+{
+    // Same labels, alternating shapes: cached plans must not be mixed up
+    double diff = 0.0;
+    for (int repeat = 0; repeat < 3; repeat++)
+    {
+        diff = std::max(diff, try_C_equal_A_B_batched(4, 3, 4, 5));
+        diff = std::max(diff, try_C_equal_A_B_batched(4, 5, 1, 3));
+    }
+    return diff;
+}
 double try_contract_label_fail()
 {
     Dimension Cdims = {3, 4};
@@ -2471,6 +2669,475 @@ double try_get()
     return error;
 }
 
+double try_memory_peak()
+{
+    size_t before = memory::current(CoreTensor);
+    memory::reset_peak();
+    {
+        Tensor C = Tensor::build(CoreTensor, "C", {100, 100});
+        Tensor D = Tensor::build(CoreTensor, "D", {50, 100});
+    }
+    size_t expected = before + 15000 * sizeof(double);
+    if (memory::peak(CoreTensor) < expected ||
+        memory::peak_in_core() < expected)
+        return 1.0;
+    return static_cast<double>(memory::current(CoreTensor) != before);
+}
+
+double try_memory_limit_fail()
+{
+    size_t limit = settings::memory_limit;
+    settings::memory_limit = memory::current_in_core() + 1024 * 1024;
+    try
+    {
+        // 8 MB of storage against a 1 MB allowance
+        Tensor C = Tensor::build(CoreTensor, "C", {1024, 1024});
+    }
+    catch (...)
+    {
+        settings::memory_limit = limit;
+        throw;
+    }
+    settings::memory_limit = limit;
+    return 0.0;
+}
+
+/// Copies T into a new tensor of the given type
+Tensor copy_to(TensorType type, const Tensor &T)
+{
+    Tensor C = Tensor::build(type, T.name() + " copy", T.dims());
+    IndexRange ranges;
+    for (size_t dim : T.dims())
+        ranges.push_back({0L, dim});
+    C.slice(T, ranges, ranges);
+    return C;
+}
+
+/// Runs op with at most extra bytes of core memory beyond what is in use
+void with_memory_to_spare(size_t extra, const std::function<void()> &op)
+{
+    size_t limit = settings::memory_limit;
+    settings::memory_limit = memory::current_in_core() + extra;
+    try
+    {
+        op();
+    }
+    catch (...)
+    {
+        settings::memory_limit = limit;
+        throw;
+    }
+    settings::memory_limit = limit;
+}
+
+double try_disk_permute()
+{
+    Tensor A = Tensor::build(CoreTensor, "A", {7, 8, 9, 10});
+    Tensor C = Tensor::build(CoreTensor, "C", {10, 8, 7, 9});
+    initialize_random(A);
+    initialize_random(C);
+    Tensor Ad = copy_to(DiskTensor, A);
+    Tensor Cd = copy_to(DiskTensor, C);
+
+    C.permute(A, {"l", "j", "i", "k"}, {"i", "j", "k", "l"}, 2.0, 0.5);
+    // Tiles of a few hundred elements
+    with_memory_to_spare(16 * 1024, [&]() {
+        Cd.permute(Ad, {"l", "j", "i", "k"}, {"i", "j", "k", "l"}, 2.0, 0.5);
+    });
+
+    return relative_difference(copy_to(CoreTensor, Cd), C);
+}
+
+double try_disk_contract()
+{
+    Tensor A = Tensor::build(CoreTensor, "A", {20, 16, 15});
+    Tensor B = Tensor::build(CoreTensor, "B", {15, 21, 16});
+    Tensor C = Tensor::build(CoreTensor, "C", {20, 21});
+    initialize_random(A);
+    initialize_random(B);
+    initialize_random(C);
+    Tensor Ad = copy_to(DiskTensor, A);
+    Tensor Cd = copy_to(DiskTensor, C);
+
+    C.contract(A, B, {"i", "j"}, {"i", "k", "l"}, {"l", "j", "k"}, 1.5, 0.5);
+    // A and C stay on disk, B in core
+    with_memory_to_spare(16 * 1024, [&]() {
+        Cd.contract(Ad, B, {"i", "j"}, {"i", "k", "l"}, {"l", "j", "k"}, 1.5,
+                    0.5);
+    });
+
+    return relative_difference(copy_to(CoreTensor, Cd), C);
+}
+
+double try_disk_slice_streamed()
+{
+    // Runs of 100 elements, in two tiles of runs
+    Tensor A = Tensor::build(CoreTensor, "A", {300, 70, 100});
+    Tensor C = Tensor::build(CoreTensor, "C", {300, 60, 100});
+    initialize_random(A);
+    initialize_random(C);
+    Tensor Ad = copy_to(DiskTensor, A);
+    Tensor Cd = copy_to(DiskTensor, C);
+    Tensor Ed = Tensor::build(DiskTensor, "E", {300, 60, 100});
+
+    IndexRange Cranges = {{0, 300}, {0, 60}, {0, 100}};
+    IndexRange Aranges = {{0, 300}, {5, 65}, {0, 100}};
+    C.slice(A, Cranges, Aranges, 2.0, 0.5);
+    Cd.slice(A, Cranges, Aranges, 2.0, 0.5);
+    Ed.slice(Ad, Cranges, Aranges, 2.0, 0.0);
+
+    Tensor E = Tensor::build(CoreTensor, "E", {300, 60, 100});
+    E.slice(A, Cranges, Aranges, 2.0, 0.0);
+
+    return std::max(relative_difference(copy_to(CoreTensor, Cd), C),
+                    relative_difference(copy_to(CoreTensor, Ed), E));
+}
+
+double try_disk_labeled()
+{
+    Tensor A = Tensor::build(CoreTensor, "A", {12, 13});
+    Tensor B = Tensor::build(CoreTensor, "B", {13, 14});
+    Tensor C = Tensor::build(CoreTensor, "C", {14, 12});
+    Tensor D = Tensor::build(CoreTensor, "D", {12, 12});
+    Tensor E = Tensor::build(CoreTensor, "E", {12, 12});
+    initialize_random(A);
+    initialize_random(B);
+    initialize_random(C);
+    Tensor Ad = copy_to(DiskTensor, A);
+    Tensor Bd = copy_to(DiskTensor, B);
+
+    // Core result of disk operands, through a disk intermediate
+    D("ij") = A("ik") * B("kl") * C("lj");
+    E("ij") = Ad("ik") * Bd("kl") * C("lj");
+
+    return relative_difference(E, D);
+}
+
+double try_disk_mapped()
+{
+    Tensor A = Tensor::build(CoreTensor, "A", {20, 16, 15});
+    Tensor B = Tensor::build(CoreTensor, "B", {15, 21, 16});
+    Tensor C = Tensor::build(CoreTensor, "C", {20, 21});
+    Tensor P = Tensor::build(CoreTensor, "P", {15, 20, 16});
+    initialize_random(A);
+    initialize_random(B);
+    initialize_random(C);
+
+    // Every disk tensor below is mapped and worked on in place
+    size_t limit = settings::disk_mmap_limit;
+    settings::disk_mmap_limit = 1024 * 1024;
+    Tensor Ad = copy_to(DiskTensor, A);
+    Tensor Bd = copy_to(DiskTensor, B);
+    Tensor Cd = copy_to(DiskTensor, C);
+    Tensor Pd = Tensor::build(DiskTensor, "P", {15, 20, 16});
+    settings::disk_mmap_limit = limit;
+
+    C.contract(A, B, {"i", "j"}, {"i", "k", "l"}, {"l", "j", "k"}, 1.5, 0.5);
+    Cd.contract(Ad, Bd, {"i", "j"}, {"i", "k", "l"}, {"l", "j", "k"}, 1.5,
+                0.5);
+    P.permute(A, {"l", "i", "k"}, {"i", "k", "l"});
+    Pd.permute(Ad, {"l", "i", "k"}, {"i", "k", "l"});
+
+    return std::max(relative_difference(copy_to(CoreTensor, Cd), C),
+                    relative_difference(copy_to(CoreTensor, Pd), P));
+}
+
+double try_disk_zero()
+{
+    Tensor A = Tensor::build(CoreTensor, "A", {30, 40, 50});
+    initialize_random(A);
+
+    size_t limit = settings::disk_mmap_limit;
+    settings::disk_mmap_limit = 1024 * 1024;
+    Tensor Am = copy_to(DiskTensor, A);
+    settings::disk_mmap_limit = limit;
+    Tensor Ad = copy_to(DiskTensor, A);
+
+    // Holes punched in the file, read back through pread and the mapping
+    Ad.scale(0.0);
+    Am.scale(0.0);
+    Tensor B = Tensor::build(DiskTensor, "B", {30, 40, 50});
+
+    return copy_to(CoreTensor, Ad).norm() + copy_to(CoreTensor, Am).norm() +
+           copy_to(CoreTensor, B).norm();
+}
+
+double try_disk_threaded()
+{
+    // Disk tensors built concurrently get files of their own
+    std::vector<double> diffs(4, 0.0);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t)
+    {
+        threads.emplace_back([&, t]() {
+            for (int i = 0; i < 20; ++i)
+            {
+                Tensor A = Tensor::build(CoreTensor, "A", {10, 10});
+                A.set(t * 100.0 + i);
+                Tensor D = copy_to(DiskTensor, A);
+                Tensor C = copy_to(CoreTensor, D);
+                for (double value : C.data())
+                    diffs[t] += std::fabs(value - (t * 100.0 + i));
+            }
+        });
+    }
+    for (std::thread &thread : threads)
+        thread.join();
+    return diffs[0] + diffs[1] + diffs[2] + diffs[3];
+}
+
+double try_timers_threaded()
+{
+    Tensor A = Tensor::build(CoreTensor, "A", {20, 30});
+    Tensor B = Tensor::build(CoreTensor, "B", {30, 40});
+    initialize_random(A);
+    initialize_random(B);
+    Tensor C = Tensor::build(CoreTensor, "C", {20, 40});
+    C("ij") = A("ik") * B("kj");
+
+    // Each thread times its contractions into a tree of its own
+    bool timers = settings::timers;
+    settings::timers = true;
+    std::vector<Tensor> Cs;
+    for (int t = 0; t < 4; ++t)
+        Cs.push_back(Tensor::build(CoreTensor, "C", {20, 40}));
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t)
+    {
+        threads.emplace_back([&, t]() {
+            timer::TimerScope scope("threaded contractions");
+            for (int i = 0; i < 10; ++i)
+                Cs[t]("ij") = A("ik") * B("kj");
+        });
+    }
+    for (std::thread &thread : threads)
+        thread.join();
+    settings::timers = timers;
+
+    double diff = 0.0;
+    for (Tensor &Ct : Cs)
+    {
+        Ct("ij") -= C("ij");
+        diff += Ct.norm();
+    }
+    return diff;
+}
+
+double try_timer_export()
+{
+    Tensor A = Tensor::build(CoreTensor, "A", {20, 30});
+    Tensor B = Tensor::build(CoreTensor, "B", {30, 40});
+    Tensor C = Tensor::build(CoreTensor, "C", {20, 40});
+    initialize_random(A);
+    initialize_random(B);
+
+    // Naming a trace file turns on event recording; the file itself is only
+    // written by the report at finalize
+    bool timers = settings::timers;
+    settings::timers = true;
+    settings::timer_trace_file = "timer_trace.json";
+    {
+        timer::TimerScope scope("exported \"timer\"");
+        C("ij") = A("ik") * B("kj");
+    }
+    settings::timer_trace_file.clear();
+    settings::timers = timers;
+
+    std::ostringstream json, trace;
+    timer::write_json(json);
+    timer::write_trace(trace);
+
+    // The timer name is escaped, and the BLAS call nests under the scope
+    std::string name = "{\"name\": \"exported \\\"timer\\\"\"";
+    double missing = 0.0;
+    for (const std::string &text :
+         {name + ", \"calls\": 1, \"total_ns\": ",
+          std::string("{\"name\": \"BLAS\", \"calls\": 1,")})
+    {
+        missing += json.str().find(text) == std::string::npos;
+    }
+    for (const std::string &text :
+         {name + ", \"ph\": \"X\"",
+          std::string("{\"name\": \"BLAS\", \"ph\": \"X\"")})
+    {
+        missing += trace.str().find(text) == std::string::npos;
+    }
+    return missing;
+}
+
+double try_timer_running()
+{
+    // A timer that has not stopped yet has no calls to average over
+    bool timers = settings::timers;
+    settings::timers = true;
+    std::ostringstream json;
+    {
+        timer::TimerScope scope("running timer");
+        timer::write_json(json);
+    }
+    settings::timers = timers;
+
+    return json.str().find("{\"name\": \"running timer\", \"calls\": 0, "
+                           "\"total_ns\": 0, \"min_ns\": 0, \"max_ns\": 0, "
+                           "\"mean_ns\": 0,") == std::string::npos;
+}
+
+double try_timer_after_throw()
+{
+    Tensor A = Tensor::build(CoreTensor, "A", {20, 30});
+    Tensor C = Tensor::build(CoreTensor, "C", {20, 30});
+
+    // A permute that throws must not leave its timer running
+    bool timers = settings::timers;
+    settings::timers = true;
+    try
+    {
+        C("ij") = A("ji");
+    }
+    catch (std::runtime_error &)
+    {
+    }
+    {
+        timer::TimerScope scope("after a throw");
+    }
+    settings::timers = timers;
+
+    std::ostringstream json;
+    timer::write_json(json);
+    return json.str().find("\n  {\"name\": \"after a throw\"") ==
+           std::string::npos;
+}
+
+double try_timer_after_contract_throw()
+{
+    Tensor A = Tensor::build(CoreTensor, "A", {20, 30});
+    Tensor B = Tensor::build(CoreTensor, "B", {40, 30});
+    Tensor C = Tensor::build(CoreTensor, "C", {20, 40});
+    Tensor D = Tensor::build(CoreTensor, "D", {30, 20});
+
+    // Contractions that throw, on non-conformable indices and on running out
+    // of memory for a permuted operand, must not leave their timers running
+    bool timers = settings::timers;
+    settings::timers = true;
+    try
+    {
+        C("ij") = A("ik") * D("jk");
+    }
+    catch (std::runtime_error &)
+    {
+    }
+    try
+    {
+        with_memory_to_spare(0L, [&]() { C("ij") = A("ik") * B("jk"); });
+    }
+    catch (std::runtime_error &)
+    {
+    }
+    {
+        timer::TimerScope scope("after a contraction throw");
+    }
+    settings::timers = timers;
+
+    std::ostringstream json;
+    timer::write_json(json);
+    return json.str().find("\n  {\"name\": \"after a contraction throw\"") ==
+           std::string::npos;
+}
+
+double try_contraction_log()
+{
+    Tensor A = Tensor::build(CoreTensor, "A", {20, 30});
+    Tensor B = Tensor::build(CoreTensor, "B", {30, 40});
+    Tensor C = Tensor::build(CoreTensor, "C", {20, 40});
+    Tensor D = Tensor::build(CoreTensor, "D", {40, 20});
+    initialize_random(A);
+    initialize_random(B);
+
+    // Naming a log file turns on logging; clearing it before the report
+    // keeps the file from being written
+    timer::clear_contraction_log();
+    settings::contraction_log_file = "contraction_log.jsonl";
+    C("ij") = A("ik") * B("kj");
+    D("ji") = C("ij");
+    settings::contraction_log_file.clear();
+    std::vector<timer::ContractionRecord> log = timer::contraction_log();
+    timer::clear_contraction_log();
+
+    // Timers alone log nothing
+    bool timers = settings::timers;
+    settings::timers = true;
+    D("ji") = C("ij");
+    settings::timers = timers;
+    if (!timer::contraction_log().empty())
+        return 1.0;
+
+    // The core contraction finishes before the Tensor and labeled ones that
+    // ran it
+    if (log.size() != 5)
+        return 1.0;
+    const timer::ContractionRecord &core = log[0];
+    const timer::ContractionRecord &tensor = log[1];
+    const timer::ContractionRecord &labeled = log[2];
+    const timer::ContractionRecord &permute = log[3];
+    const timer::ContractionRecord &tensor_permute = log[4];
+    double wrong = 0.0;
+    wrong += core.operation != "contract";
+    wrong += core.expression != "C[i,j] = A[i,k] * B[k,j]";
+    wrong += core.m != 20 || core.n != 40 || core.k != 30 || core.batch != 1;
+    wrong += core.permA || core.permB || core.permC;
+    wrong += core.flops != 2.0 * 20 * 30 * 40;
+    wrong += core.alpha != 1.0 || core.beta != 0.0;
+    wrong += tensor.operation != "Tensor::contract";
+    wrong += tensor.expression != core.expression;
+    wrong += tensor.dims != core.dims;
+    wrong += tensor.alpha != 1.0 || tensor.beta != 0.0;
+    wrong += labeled.operation != "labeled contract";
+    wrong += labeled.expression != "C[i,j] = A[i,k] * B[k,j]";
+    wrong += labeled.dims !=
+             std::vector<Dimension>{{20, 40}, {20, 30}, {30, 40}};
+    wrong += labeled.flops != core.flops;
+    wrong += permute.operation != "permute";
+    wrong += permute.expression != "D[j,i] = C[i,j]";
+    wrong += tensor_permute.operation != "Tensor::permute";
+    wrong += tensor_permute.expression != "D[j,i] = C[i,j]";
+    return wrong;
+}
+
+double try_disk_empty()
+{
+    // Built with mapping off (the default) and on
+    Tensor D = Tensor::build(DiskTensor, "D", {0, 5});
+    size_t limit = settings::disk_mmap_limit;
+    settings::disk_mmap_limit = 1024 * 1024;
+    Tensor Dm = Tensor::build(DiskTensor, "Dm", {0, 5});
+    settings::disk_mmap_limit = limit;
+
+    return D.numel() + Dm.numel();
+}
+
+double try_disk_slice_empty()
+{
+    Tensor A = Tensor::build(CoreTensor, "A", {4, 5});
+    initialize_random(A);
+    Tensor D = copy_to(DiskTensor, A);
+    Tensor C = Tensor::build(CoreTensor, "C", {4, 5});
+
+    // Empty fast and slow ranges, from and to disk, change nothing
+    C.slice(D, {{0, 4}, {2, 2}}, {{0, 4}, {2, 2}});
+    C.slice(D, {{1, 1}, {0, 5}}, {{1, 1}, {0, 5}});
+    D.slice(C, {{0, 4}, {2, 2}}, {{0, 4}, {2, 2}});
+    D.slice(C, {{1, 1}, {0, 5}}, {{1, 1}, {0, 5}});
+
+    // An empty disk tensor copies both ways
+    Tensor E = Tensor::build(DiskTensor, "E", {0, 5});
+    Tensor F = copy_to(CoreTensor, E);
+    Tensor G = copy_to(DiskTensor, F);
+
+    Tensor Dc = copy_to(CoreTensor, D);
+    Dc("ij") -= A("ij");
+    return C.norm() + Dc.norm() + F.numel() + G.numel();
+}
+
 int main(int argc, char *argv[])
 {
     printf(ANSI_COLOR_RESET);
@@ -2494,6 +3161,9 @@ int main(int argc, char *argv[])
     success &= test_function(try_copy, "Copy", kExact);
     success &= test_function(try_scale, "Scale", kExact);
     success &= test_function(try_get, "Get/Set", kExact);
+    success &= test_function(try_memory_peak, "Memory Peak", kExact);
+    success &=
+        test_function(try_memory_limit_fail, "Memory Limit Fail", kException);
     printf("%s\n", std::string(82, '-').c_str());
     printf("Tests: %s\n\n", success ? "All passed" : "Some failed");
 
@@ -2786,6 +3456,10 @@ int main(int argc, char *argv[])
         test_function(try_permute_rank4_ikjl, "Permute Rank-4 ikjl", kExact);
     success &=
         test_function(try_permute_rank4_lkji, "Permute Rank-4 lkji", kExact);
+    success &= test_function(try_permute_sum_rank3, "Permute Sum Rank-3",
+                             kEpsilon);
+    success &= test_function(try_permute_sum_rank4_antisymmetrize,
+                             "Permute Sum Rank-4 antisymmetrize", kEpsilon);
     mode = 0;
     alpha = random_double();
     beta = random_double();
@@ -2818,6 +3492,10 @@ int main(int argc, char *argv[])
         test_function(try_permute_rank4_ikjl, "Permute Rank-4 ikjl", kExact);
     success &=
         test_function(try_permute_rank4_lkji, "Permute Rank-4 lkji", kExact);
+    success &= test_function(try_permute_sum_rank3, "Permute Sum Rank-3",
+                             kEpsilon);
+    success &= test_function(try_permute_sum_rank4_antisymmetrize,
+                             "Permute Sum Rank-4 antisymmetrize", kEpsilon);
     mode = 1;
     alpha = 1.0;
     beta = 0.0;
@@ -2850,6 +3528,10 @@ int main(int argc, char *argv[])
         test_function(try_permute_rank4_ikjl, "Permute Rank-4 ikjl", kExact);
     success &=
         test_function(try_permute_rank4_lkji, "Permute Rank-4 lkji", kExact);
+    success &= test_function(try_permute_sum_rank3, "Permute Sum Rank-3",
+                             kEpsilon);
+    success &= test_function(try_permute_sum_rank4_antisymmetrize,
+                             "Permute Sum Rank-4 antisymmetrize", kEpsilon);
     mode = 2;
     alpha = 1.0;
     beta = 1.0;
@@ -2882,6 +3564,10 @@ int main(int argc, char *argv[])
         test_function(try_permute_rank4_ikjl, "Permute Rank-4 ikjl", kExact);
     success &=
         test_function(try_permute_rank4_lkji, "Permute Rank-4 lkji", kExact);
+    success &= test_function(try_permute_sum_rank3, "Permute Sum Rank-3",
+                             kEpsilon);
+    success &= test_function(try_permute_sum_rank4_antisymmetrize,
+                             "Permute Sum Rank-4 antisymmetrize", kEpsilon);
     mode = 3;
     alpha = -1.0;
     beta = 1.0;
@@ -2914,6 +3600,10 @@ int main(int argc, char *argv[])
         test_function(try_permute_rank4_ikjl, "Permute Rank-4 ikjl", kExact);
     success &=
         test_function(try_permute_rank4_lkji, "Permute Rank-4 lkji", kExact);
+    success &= test_function(try_permute_sum_rank3, "Permute Sum Rank-3",
+                             kEpsilon);
+    success &= test_function(try_permute_sum_rank4_antisymmetrize,
+                             "Permute Sum Rank-4 antisymmetrize", kEpsilon);
     printf("%s\n", std::string(82, '-').c_str());
     printf("Tests: %s\n\n", success ? "All Passed" : "Some Failed");
 
@@ -2970,6 +3660,40 @@ int main(int argc, char *argv[])
     success &= test_function(try_contract_gemm6, "Contract gemm 6", kEpsilon);
     success &= test_function(try_contract_gemm7, "Contract gemm 7", kEpsilon);
     success &= test_function(try_contract_gemm8, "Contract gemm 8", kEpsilon);
+    success &= test_function(try_contract_batched_gemm1,
+                             "Contract batched gemm 1", kEpsilon);
+    success &= test_function(try_contract_batched_gemm2,
+                             "Contract batched gemm 2", kEpsilon);
+    success &= test_function(try_contract_batched_gemv,
+                             "Contract batched gemv", kEpsilon);
+    success &= test_function(try_contract_plan_reuse, "Contract plan reuse",
+                             kEpsilon);
+    success &= test_function(try_disk_permute, "Disk permute (tiled)",
+                             kEpsilon);
+    success &= test_function(try_disk_contract, "Disk contract (tiled)",
+                             kEpsilon);
+    success &= test_function(try_disk_slice_streamed, "Disk slice (streamed)",
+                             kEpsilon);
+    success &= test_function(try_disk_labeled, "Disk labeled contraction",
+                             kEpsilon);
+    success &= test_function(try_disk_mapped, "Disk mapped permute/contract",
+                             kEpsilon);
+    success &= test_function(try_disk_zero, "Disk zero (sparse)", kExact);
+    success &= test_function(try_disk_empty, "Disk empty", kExact);
+    success &= test_function(try_disk_slice_empty, "Disk slice empty", kExact);
+    success &= test_function(try_disk_threaded, "Disk tensors from threads",
+                             kExact);
+    success &= test_function(try_timers_threaded, "Timers from threads",
+                             kEpsilon);
+    success &= test_function(try_timer_export, "Timer JSON and trace export",
+                             kExact);
+    success &= test_function(try_contraction_log, "Contraction log", kExact);
+    success &= test_function(try_timer_running, "Timer JSON while running",
+                             kExact);
+    success &= test_function(try_timer_after_throw, "Timers after a throw",
+                             kExact);
+    success &= test_function(try_timer_after_contract_throw,
+                             "Timers after a contraction throw", kExact);
     mode = 0;
     alpha = random_double();
     beta = random_double();
@@ -2996,6 +3720,14 @@ int main(int argc, char *argv[])
     success &= test_function(try_contract_gemm6, "Contract gemm 6", kEpsilon);
     success &= test_function(try_contract_gemm7, "Contract gemm 7", kEpsilon);
     success &= test_function(try_contract_gemm8, "Contract gemm 8", kEpsilon);
+    success &= test_function(try_contract_batched_gemm1,
+                             "Contract batched gemm 1", kEpsilon);
+    success &= test_function(try_contract_batched_gemm2,
+                             "Contract batched gemm 2", kEpsilon);
+    success &= test_function(try_contract_batched_gemv,
+                             "Contract batched gemv", kEpsilon);
+    success &= test_function(try_contract_plan_reuse, "Contract plan reuse",
+                             kEpsilon);
     mode = 1;
     alpha = 1.0;
     beta = 0.0;
@@ -3022,6 +3754,14 @@ int main(int argc, char *argv[])
     success &= test_function(try_contract_gemm6, "Contract gemm 6", kEpsilon);
     success &= test_function(try_contract_gemm7, "Contract gemm 7", kEpsilon);
     success &= test_function(try_contract_gemm8, "Contract gemm 8", kEpsilon);
+    success &= test_function(try_contract_batched_gemm1,
+                             "Contract batched gemm 1", kEpsilon);
+    success &= test_function(try_contract_batched_gemm2,
+                             "Contract batched gemm 2", kEpsilon);
+    success &= test_function(try_contract_batched_gemv,
+                             "Contract batched gemv", kEpsilon);
+    success &= test_function(try_contract_plan_reuse, "Contract plan reuse",
+                             kEpsilon);
     mode = 2;
     alpha = 1.0;
     beta = 1.0;
@@ -3048,6 +3788,14 @@ int main(int argc, char *argv[])
     success &= test_function(try_contract_gemm6, "Contract gemm 6", kEpsilon);
     success &= test_function(try_contract_gemm7, "Contract gemm 7", kEpsilon);
     success &= test_function(try_contract_gemm8, "Contract gemm 8", kEpsilon);
+    success &= test_function(try_contract_batched_gemm1,
+                             "Contract batched gemm 1", kEpsilon);
+    success &= test_function(try_contract_batched_gemm2,
+                             "Contract batched gemm 2", kEpsilon);
+    success &= test_function(try_contract_batched_gemv,
+                             "Contract batched gemv", kEpsilon);
+    success &= test_function(try_contract_plan_reuse, "Contract plan reuse",
+                             kEpsilon);
     mode = 3;
     alpha = -1.0;
     beta = 1.0;
@@ -3074,6 +3822,14 @@ int main(int argc, char *argv[])
     success &= test_function(try_contract_gemm6, "Contract gemm 6", kEpsilon);
     success &= test_function(try_contract_gemm7, "Contract gemm 7", kEpsilon);
     success &= test_function(try_contract_gemm8, "Contract gemm 8", kEpsilon);
+    success &= test_function(try_contract_batched_gemm1,
+                             "Contract batched gemm 1", kEpsilon);
+    success &= test_function(try_contract_batched_gemm2,
+                             "Contract batched gemm 2", kEpsilon);
+    success &= test_function(try_contract_batched_gemv,
+                             "Contract batched gemv", kEpsilon);
+    success &= test_function(try_contract_plan_reuse, "Contract plan reuse",
+                             kEpsilon);
     printf("%s\n", std::string(82, '-').c_str());
     printf("Tests: %s\n\n", success ? "All Passed" : "Some Failed");
 
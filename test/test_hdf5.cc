@@ -34,6 +34,7 @@
 #include <assert.h>
 #include <stdexcept>
 
+#include <ambit/blocked_tensor.h>
 #include <ambit/print.h>
 #include <ambit/tensor.h>
 #include <ambit/io/hdf5/file.h>
@@ -97,6 +98,66 @@ void test_hdf5()
     write(test, result["Sigma"]);
 }
 
+double difference(Tensor A, Tensor B)
+{
+    Tensor D = Tensor::build(CoreTensor, "D", A.dims());
+    D("ij") = A("ij");
+    D("ij") -= B("ij");
+    return D.norm();
+}
+
+bool test_hdf5_read()
+{
+    using namespace ambit::io::hdf5;
+
+    Tensor A = build("A", {40, 30});
+    initialize_random(A);
+    bool success = true;
+    {
+        File file("read.h5", kOpenModeCreateNew, kDeleteModeDeleteOnClose);
+
+        // Chunked and compressed, read back whole
+        write(file, A, kFilterDeflate);
+        Tensor B = read(file, "A");
+        success &= difference(A, B) == 0.0;
+
+        // A hyperslab of the dataset into a block of a disk tensor
+        Dataset<double> set(file, "A");
+        Tensor C = Tensor::build(DiskTensor, "C", {12, 9});
+        set.read(C, {{2, 12}, {0, 9}}, {{5, 15}, {20, 29}});
+        Tensor Cref = build("Cref", {12, 9});
+        Cref.slice(A, {{2, 12}, {0, 9}}, {{5, 15}, {20, 29}});
+        Tensor Cd = build("Cd", {12, 9});
+        Cd.slice(C, {{2, 12}, {0, 9}}, {{2, 12}, {0, 9}});
+        success &= difference(Cd, Cref) == 0.0;
+
+        // A block of a tensor into a hyperslab of the dataset
+        Tensor E = build("E", {3, 4});
+        initialize_random(E);
+        set.write(E, {{30, 33}, {1, 5}}, {{0, 3}, {0, 4}});
+        A.slice(E, {{30, 33}, {1, 5}}, {{0, 3}, {0, 4}});
+        success &= difference(A, read(file, "A")) == 0.0;
+
+        // Blocks as datasets of a group
+        BlockedTensor::reset_mo_spaces();
+        BlockedTensor::add_mo_space("O", "i,j", {0, 1, 2}, AlphaSpin);
+        BlockedTensor::add_mo_space("V", "a,b", {3, 4, 5, 6}, AlphaSpin);
+        BlockedTensor T = BlockedTensor::build(CoreTensor, "T", {"OV", "VV"});
+        T.iterate([](const std::vector<size_t> &, const std::vector<SpinType> &,
+                     double &value) {
+            value = double(std::rand()) / double(RAND_MAX);
+        });
+        write(file, T, kFilterDeflate);
+        BlockedTensor U;
+        read(file, "T", U);
+        success &= difference(T.block("OV"), U.block("OV")) == 0.0;
+        success &= difference(T.block("VV"), U.block("VV")) == 0.0;
+    }
+    ambit::print("  HDF5 chunked, hyperslab and blocked I/O: %s\n",
+                 success ? "passed" : "failed");
+    return success;
+}
+
 int main(int argc, char *argv[])
 {
     srand(time(nullptr));
@@ -117,7 +178,8 @@ int main(int argc, char *argv[])
     }
 
     test_hdf5();
+    bool success = test_hdf5_read();
 
     ambit::finalize();
-    return EXIT_SUCCESS;
+    return success ? EXIT_SUCCESS : EXIT_FAILURE;
 }
@@ -28,9 +28,13 @@
  */
 
 #include <ambit/blocked_tensor.h>
+#include <ambit/settings.h>
 #include <cmath>
+#include <numeric>
 #include <cstdlib>
+#include <fstream>
 #include <stdexcept>
+#include <sys/stat.h>
 
 #define ANSI_COLOR_RED "\x1b[31m"
 #define ANSI_COLOR_GREEN "\x1b[32m"
@@ -136,6 +140,141 @@ bool test_tensor_io_3()
     return testTensor2.norm();
 }
 
+bool test_tensor_io_compressed()
+{
+    // Several chunks, half of the amplitudes zero
+    Tensor testTensor = build("Test Tensor", {600, 50, 50});
+    initialize_random(testTensor);
+    std::vector<double> &data = testTensor.data();
+    for (size_t n = 0; n < data.size(); n += 2)
+        data[n] = 0.0;
+
+    settings::compress_tensor_files = true;
+    save(testTensor, "test.ten");
+    settings::compress_tensor_files = false;
+
+    struct stat buf;
+    stat("test.ten", &buf);
+    if (static_cast<size_t>(buf.st_size) >= data.size() * sizeof(double))
+        return true;
+
+    Tensor testTensor2 = load_tensor("test.ten");
+    testTensor2("abc") += -testTensor("abc");
+    return testTensor2.norm();
+}
+
+bool test_tensor_io_disk()
+{
+    Tensor testTensor = build("Test Tensor", {300, 70, 70});
+    initialize_random(testTensor);
+    Tensor diskTensor =
+        Tensor::build(DiskTensor, "Test Tensor", testTensor.dims());
+    diskTensor("abc") = testTensor("abc");
+
+    save(diskTensor, "test.ten");
+
+    Tensor diskTensor2 =
+        Tensor::build(DiskTensor, "Test Tensor 2", testTensor.dims());
+    load(diskTensor2, "test.ten");
+
+    Tensor testTensor2 = build("Test Tensor 2", testTensor.dims());
+    testTensor2("abc") = diskTensor2("abc");
+    testTensor2("abc") += -testTensor("abc");
+    return testTensor2.norm();
+}
+
+bool test_tensor_io_checksum()
+{
+    Tensor testTensor = build("Test Tensor", {3, 7, 7});
+    initialize_random(testTensor);
+    save(testTensor, "test.ten");
+
+    // Flip a bit of the last element
+    std::fstream file("test.ten", std::ios_base::binary | std::ios_base::in |
+                                      std::ios_base::out);
+    file.seekg(-1, std::ios_base::end);
+    char byte = file.get() ^ 1;
+    file.seekp(-1, std::ios_base::end);
+    file.put(byte);
+    file.close();
+
+    Tensor testTensor2 = load_tensor("test.ten");
+    return false;
+}
+
+bool test_tensor_io_unchunked()
+{
+    Tensor testTensor = build("Test Tensor", {3, 7, 7});
+    initialize_random(testTensor);
+
+    // The layout written by earlier versions
+    std::ofstream out("test.ten", std::ios_base::binary);
+    std::string name = testTensor.name();
+    size_t size = name.size();
+    out.write(reinterpret_cast<char *>(&size), sizeof(size_t));
+    out.write(&name[0], size);
+    size_t rank = testTensor.rank();
+    out.write(reinterpret_cast<char *>(&rank), sizeof(size_t));
+    for (size_t dim : testTensor.dims())
+        out.write(reinterpret_cast<char *>(&dim), sizeof(size_t));
+    size = testTensor.numel();
+    out.write(reinterpret_cast<char *>(&size), sizeof(size_t));
+    out.write(reinterpret_cast<const char *>(testTensor.data().data()),
+              size * sizeof(double));
+    out.close();
+
+    Tensor testTensor2 = load_tensor("test.ten");
+    testTensor2("abc") += -testTensor("abc");
+    return testTensor2.norm();
+}
+
+bool test_tensor_io_sliced()
+{
+    // The leading range spans chunks
+    Tensor testTensor = build("Test Tensor", {600, 50, 50});
+    initialize_random(testTensor);
+    save(testTensor, "test.ten");
+
+    IndexRange ranges = {{150, 450}, {10, 20}, {5, 45}};
+    Tensor block = load_tensor("test.ten", ranges);
+
+    Tensor reference = build("Reference", {300, 10, 40});
+    reference.slice(testTensor, {{0, 300}, {0, 10}, {0, 40}}, ranges);
+    block("abc") += -reference("abc");
+    return block.norm();
+}
+
+bool test_tensor_io_sliced_unchunked()
+{
+    Tensor testTensor = build("Test Tensor", {9, 8, 7});
+    initialize_random(testTensor);
+
+    std::ofstream out("test.ten", std::ios_base::binary);
+    std::string name = testTensor.name();
+    size_t size = name.size();
+    out.write(reinterpret_cast<char *>(&size), sizeof(size_t));
+    out.write(&name[0], size);
+    size_t rank = testTensor.rank();
+    out.write(reinterpret_cast<char *>(&rank), sizeof(size_t));
+    for (size_t dim : testTensor.dims())
+        out.write(reinterpret_cast<char *>(&dim), sizeof(size_t));
+    size = testTensor.numel();
+    out.write(reinterpret_cast<char *>(&size), sizeof(size_t));
+    out.write(reinterpret_cast<const char *>(testTensor.data().data()),
+              size * sizeof(double));
+    out.close();
+
+    // Into a pre-allocated disk tensor
+    IndexRange ranges = {{2, 7}, {1, 8}, {3, 6}};
+    Tensor block = Tensor::build(DiskTensor, "Block", {5, 7, 3});
+    load(block, "test.ten", ranges);
+
+    Tensor reference = build("Reference", {5, 7, 3});
+    reference.slice(testTensor, {{0, 5}, {0, 7}, {0, 3}}, ranges);
+    reference("abc") += -block("abc");
+    return reference.norm();
+}
+
 bool test_tensor_io_blocked_1()
 {
     // register the orbital spaces with the class
@@ -235,6 +374,65 @@ bool test_tensor_io_blocked_3()
     return testTensor2.norm();
 }
 
+bool test_tensor_io_blocked_block()
+{
+    // register the orbital spaces with the class
+    BlockedTensor::reset_mo_spaces();
+    BlockedTensor::add_mo_space("O", "i,j,k,l", {0, 1, 2, 3, 4}, AlphaSpin);
+    BlockedTensor::add_mo_space("V", "a,b,c,d", {7, 8, 9}, AlphaSpin);
+
+    BlockedTensor testTensor =
+        BlockedTensor::build(CoreTensor, "T", {"OOO", "OOV", "OVV", "VVV"});
+    for (const std::string &label : testTensor.block_labels())
+    {
+        Tensor t = testTensor.block(label);
+        initialize_random(t);
+    }
+    save(testTensor, "block.ten");
+
+    // one block, found through the index
+    Tensor t_ovv = load_block("block.ten", "OVV");
+    t_ovv("abc") += -testTensor.block("OVV")("abc");
+    return t_ovv.norm();
+}
+
+bool test_tensor_io_blocked_chunked()
+{
+    // Blocks of several chunks and of less than one, raw and packed
+    std::vector<size_t> occupied(20), virtuals(40);
+    std::iota(occupied.begin(), occupied.end(), 0);
+    std::iota(virtuals.begin(), virtuals.end(), 20);
+    BlockedTensor::reset_mo_spaces();
+    BlockedTensor::add_mo_space("O", "i,j,k,l", occupied, AlphaSpin);
+    BlockedTensor::add_mo_space("V", "a,b,c,d", virtuals, AlphaSpin);
+
+    BlockedTensor testTensor =
+        BlockedTensor::build(CoreTensor, "T", {"OOVV", "OVOV", "OOOO"});
+    for (const std::string &label : testTensor.block_labels())
+    {
+        Tensor t = testTensor.block(label);
+        initialize_random(t);
+        std::vector<double> &data = t.data();
+        for (size_t n = 0; n < data.size(); n += 2)
+            data[n] = 0.0;
+    }
+
+    double error = 0.0;
+    for (bool compress : {false, true})
+    {
+        settings::compress_tensor_files = compress;
+        save(testTensor, "block.ten");
+        settings::compress_tensor_files = false;
+
+        BlockedTensor testTensor2 = load_blocked_tensor("block.ten");
+        testTensor2("ijab") += -testTensor("ijab");
+        testTensor2("iajb") += -testTensor("iajb");
+        testTensor2("ijkl") += -testTensor("ijkl");
+        error += testTensor2.norm();
+    }
+    return error;
+}
+
 int main(int argc, char *argv[])
 {
     printf(ANSI_COLOR_RESET);
@@ -251,12 +449,28 @@ int main(int argc, char *argv[])
                         "Save/load Tensor (on an empty tensor)"),
         std::make_tuple(kPass, test_tensor_io_3,
                         "Save/load Tensor (return a tensor)"),
+        std::make_tuple(kPass, test_tensor_io_compressed,
+                        "Save/load Tensor (compressed chunks)"),
+        std::make_tuple(kPass, test_tensor_io_disk,
+                        "Save/load Tensor (disk tensors)"),
+        std::make_tuple(kException, test_tensor_io_checksum,
+                        "Load Tensor (corrupted chunk)"),
+        std::make_tuple(kPass, test_tensor_io_unchunked,
+                        "Load Tensor (unchunked file)"),
+        std::make_tuple(kPass, test_tensor_io_sliced,
+                        "Load Tensor ranges (chunked file)"),
+        std::make_tuple(kPass, test_tensor_io_sliced_unchunked,
+                        "Load Tensor ranges (unchunked file)"),
         std::make_tuple(kPass, test_tensor_io_blocked_2,
                         "Save/load BlockedTensor (on a pre-allocated tensor)"),
         std::make_tuple(kPass, test_tensor_io_blocked_2,
                         "Save/load BlockedTensor (on an empty tensor)"),
         std::make_tuple(kPass, test_tensor_io_blocked_3,
                         "Save/load BlockedTensor (return a tensor)"),
+        std::make_tuple(kPass, test_tensor_io_blocked_block,
+                        "Load one block of a BlockedTensor"),
+        std::make_tuple(kPass, test_tensor_io_blocked_chunked,
+                        "Save/load BlockedTensor (multi-chunk blocks)"),
     };
 
     std::vector<std::tuple<std::string, TestResult, double>> results;
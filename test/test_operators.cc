@@ -625,6 +625,141 @@ double test_E_abcd_equal_Aijab_Bklcd_C_jl_D_ik()
     return difference(E, e4).second;
 }
 
+double test_Eae_equal_Aab_Bbc_Ccd_Dde(bool greedy)
+{
+    size_t na = 2;
+    size_t nb = 10;
+    size_t nc = 2;
+    size_t nd = 10;
+    size_t ne = 2;
+
+    Tensor A = build_and_fill("A", {na, nb}, a2);
+    Tensor B = build_and_fill("B", {nb, nc}, b2);
+    Tensor C = build_and_fill("C", {nc, nd}, c2);
+    Tensor D = build_and_fill("D", {nd, ne}, d2);
+    Tensor E = build_and_fill("E", {na, ne}, e2);
+
+    // (A * B) * (C * D) needs fewer multiply-adds than any chain
+    LabeledTensorContraction ABCD = A("ab") * B("bc") * C("cd") * D("de");
+    int limit = settings::contraction_search_limit;
+    if (greedy)
+        settings::contraction_search_limit = 2;
+    ContractionTree tree = ABCD.contraction_tree({"a", "e"});
+    E("ae") = ABCD;
+    settings::contraction_search_limit = limit;
+
+    if (tree.str() != "((0 * 1) * (2 * 3))")
+        throw std::runtime_error("Unexpected contraction order " + tree.str());
+
+    for (size_t a = 0; a < na; ++a)
+    {
+        for (size_t e = 0; e < ne; ++e)
+        {
+            e2[a][e] = 0.0;
+            for (size_t b = 0; b < nb; ++b)
+            {
+                for (size_t c = 0; c < nc; ++c)
+                {
+                    for (size_t d = 0; d < nd; ++d)
+                    {
+                        e2[a][e] += a2[a][b] * b2[b][c] * c2[c][d] * d2[d][e];
+                    }
+                }
+            }
+        }
+    }
+
+    return difference(E, e2).second;
+}
+
+double test_contraction_tree_optimal()
+{
+    return test_Eae_equal_Aab_Bbc_Ccd_Dde(false);
+}
+
+double test_contraction_tree_greedy()
+{
+    return test_Eae_equal_Aab_Bbc_Ccd_Dde(true);
+}
+
+double test_contraction_tree_search_limit()
+{
+    // A chain of 24 matrices, A0("ab") * A1("bc") * ... * A23("xy")
+    std::vector<Tensor> As;
+    for (int t = 0; t < 24; ++t)
+        As.push_back(Tensor::build(tensor_type, "A" + std::to_string(t),
+                                   {2, 2}));
+    auto labels = [](int t) {
+        return std::string{char('a' + t), char('b' + t)};
+    };
+    LabeledTensorContraction chain = As[0](labels(0)) * As[1](labels(1));
+    for (int t = 2; t < 24; ++t)
+        chain *= As[t](labels(t));
+
+    // A limit past what the search can hold falls back to greedy ordering
+    int limit = settings::contraction_search_limit;
+    settings::contraction_search_limit = 64;
+    ContractionTree tree = chain.contraction_tree({"a", "y"});
+    settings::contraction_search_limit = limit;
+
+    if (tree.nleaves() != 24)
+        throw std::runtime_error("Unexpected contraction order " + tree.str());
+    return 0.0;
+}
+
+double test_contraction_tree_policy()
+{
+    size_t ni = 3;
+    size_t nj = 2;
+    size_t nk = 3;
+    size_t nl = 7;
+
+    Tensor A = build_and_fill("A", {ni, nj}, a2);
+    Tensor B = build_and_fill("B", {nj, nk}, b2);
+    Tensor C = build_and_fill("C", {nk, nl}, c2);
+    Tensor D = build_and_fill("D", {ni, nl}, d2);
+
+    // (A * B) * C needs fewer FLOPs, A * (B * C) less memory
+    LabeledTensorContraction ABC = A("ij") * B("jk") * C("kl");
+    Indices result = {"i", "l"};
+    string flops_order = ABC.contraction_tree(result, true, MinimumFlops).str();
+    string memory_order =
+        ABC.contraction_tree(result, true, MinimumMemory).str();
+    size_t limit = settings::memory_limit;
+    settings::memory_limit = 45 * sizeof(double);
+    string capped_order =
+        ABC.contraction_tree(result, true, FlopsUnderMemoryCap).str();
+    settings::memory_limit = limit;
+
+    if (flops_order != "((0 * 1) * 2)" || memory_order != "(0 * (1 * 2))" ||
+        capped_order != memory_order)
+        throw std::runtime_error("Unexpected contraction orders " +
+                                 flops_order + ", " + memory_order + ", " +
+                                 capped_order);
+
+    ContractionPolicy policy = settings::contraction_policy;
+    settings::contraction_policy = MinimumMemory;
+    D("il") = ABC;
+    settings::contraction_policy = policy;
+
+    for (size_t i = 0; i < ni; ++i)
+    {
+        for (size_t l = 0; l < nl; ++l)
+        {
+            d2[i][l] = 0.0;
+            for (size_t j = 0; j < nj; ++j)
+            {
+                for (size_t k = 0; k < nk; ++k)
+                {
+                    d2[i][l] += a2[i][j] * b2[j][k] * c2[k][l];
+                }
+            }
+        }
+    }
+
+    return difference(D, d2).second;
+}
+
 double test_C_equal_2_A()
 {
     size_t ni = 9;
@@ -1095,6 +1230,36 @@ double test_F_equal_D_times_2g_minus_g()
     return difference(F, a2).second;
 }
 
+double test_F_minus_equal_D_times_g_sum()
+{
+    size_t ni = 9, nj = 9, nk = 9, nl = 9;
+
+    Tensor F = build_and_fill("F", {ni, nj}, a2);
+    Tensor D = build_and_fill("D", {nk, nl}, b2);
+    Tensor g = build_and_fill("g", {ni, nj, nk, nl}, c4);
+
+    F("i,j") -= D("k,l") *
+                (g("i,j,k,l") - 0.5 * g("i,l,k,j") + g("j,i,k,l"));
+
+    for (size_t i = 0; i < ni; ++i)
+    {
+        for (size_t j = 0; j < nj; ++j)
+        {
+            for (size_t k = 0; k < nk; ++k)
+            {
+                for (size_t l = 0; l < nl; ++l)
+                {
+                    a2[i][j] -= b2[k][l] * (c4[i][j][k][l] -
+                                            0.5 * c4[i][l][k][j] +
+                                            c4[j][i][k][l]);
+                }
+            }
+        }
+    }
+
+    return difference(F, a2).second;
+}
+
 double test_Dij_equal_2_times_Aij_plus_Bij()
 {
     size_t ni = 9, nj = 6;
@@ -1903,6 +2068,17 @@ int main(int argc, char *argv[])
         std::make_tuple(
             kPass, test_E_abcd_equal_Aijab_Bklcd_C_jl_D_ik,
             "E(\"abcd\") += A(\"ijab\") * B(\"klcd\") * C(\"jl\") * D(\"ik\")"),
+        std::make_tuple(kPass, test_contraction_tree_optimal,
+                        "E(\"ae\") = A(\"ab\") * B(\"bc\") * C(\"cd\") * "
+                        "D(\"de\") (optimal)"),
+        std::make_tuple(kPass, test_contraction_tree_greedy,
+                        "E(\"ae\") = A(\"ab\") * B(\"bc\") * C(\"cd\") * "
+                        "D(\"de\") (greedy)"),
+        std::make_tuple(kPass, test_contraction_tree_search_limit,
+                        "Contraction order search limit past 20 terms"),
+        std::make_tuple(kPass, test_contraction_tree_policy,
+                        "D(\"il\") = A(\"ij\") * B(\"jk\") * C(\"kl\") "
+                        "(policies)"),
         std::make_tuple(kPass, test_Cij_equal_Aij_plus_Bij,
                         "C(\"ij\") = A(\"ij\") + B(\"ij\")"),
         std::make_tuple(kPass, test_Dij_equal_Aij_plus_Bij_plus_Cij,
@@ -1920,6 +2096,9 @@ int main(int argc, char *argv[])
         std::make_tuple(
             kPass, test_F_equal_D_times_2g_minus_g,
             "F(\"ij\") = D(\"kl\") * (2.0 * g(\"ijkl\") - g(\"ikjl\"))"),
+        std::make_tuple(kPass, test_F_minus_equal_D_times_g_sum,
+                        "F(\"ij\") -= D(\"kl\") * (g(\"ijkl\") - 0.5 * "
+                        "g(\"ilkj\") + g(\"jikl\"))"),
         std::make_tuple(kPass, test_Dij_equal_2_times_Aij_plus_Bij,
                         "C(\"ij\") = 2.0 * (A(\"ij\") - B(\"ij\"))"),
         std::make_tuple(kPass, test_Dij_equal_negate_Aij_plus_Bij,
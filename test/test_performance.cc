@@ -33,6 +33,7 @@
 #include <cstdlib>
 #include <assert.h>
 #include <stdexcept>
+#include <tuple>
 
 #include <ambit/print.h>
 #include <ambit/tensor.h>
@@ -143,6 +144,129 @@ void test_performance()
     //    }
 }
 
+/// Straightforward permutation that walks C in order and reads A with
+/// whatever stride falls out, as CoreTensorImpl::permute used to.
+void reference_permute(Tensor &C, const Tensor &A, const std::string &Cinds,
+                       const std::string &Ainds)
+{
+    const Dimension &Cdims = C.dims();
+    const Dimension &Adims = A.dims();
+    size_t rank = Cdims.size();
+
+    std::vector<size_t> Astrides(rank, 1L);
+    for (int dim = ((int)rank) - 2; dim >= 0; dim--)
+        Astrides[dim] = Astrides[dim + 1] * Adims[dim + 1];
+    std::vector<size_t> AstridesC(rank);
+    for (size_t dim = 0; dim < rank; dim++)
+        AstridesC[dim] = Astrides[Ainds.find(Cinds[dim])];
+
+    double *Cp = C.data().data();
+    const double *Ap = A.data().data();
+    std::vector<size_t> index(rank, 0L);
+    size_t Aoffset = 0L;
+    for (size_t ind = 0L, numel = C.numel(); ind < numel; ind++)
+    {
+        Cp[ind] = Ap[Aoffset];
+        for (int dim = ((int)rank) - 1; dim >= 0; dim--)
+        {
+            index[dim]++;
+            Aoffset += AstridesC[dim];
+            if (index[dim] < Cdims[dim])
+                break;
+            Aoffset -= Cdims[dim] * AstridesC[dim];
+            index[dim] = 0L;
+        }
+    }
+}
+
+void test_permute_performance()
+{
+    int repeats = 3;
+
+    ambit::print("\npermutations, repeats %d\n", repeats);
+
+    // C indices, A indices, extent of every index
+    std::vector<std::tuple<std::string, std::string, size_t>> cases = {
+        std::make_tuple("ji", "ij", 2000),
+        std::make_tuple("jikl", "ijkl", 40),
+        std::make_tuple("ijlk", "ijkl", 40),
+        std::make_tuple("lkji", "ijkl", 40),
+        std::make_tuple("fedcba", "abcdef", 12),
+        std::make_tuple("cabfdeihg", "abcdefghi", 5)};
+
+    for (const auto &c : cases)
+    {
+        const std::string &Cinds = std::get<0>(c);
+        const std::string &Ainds = std::get<1>(c);
+        Dimension dims(Cinds.size(), std::get<2>(c));
+
+        Tensor A = build("A", dims);
+        Tensor C = build("C", dims);
+        Tensor Cref = build("Cref", dims);
+        std::vector<double> &Av = A.data();
+        for (size_t i = 0; i < Av.size(); i++)
+            Av[i] = double(std::rand()) / double(RAND_MAX);
+
+        std::string label = "C(" + Cinds + ") = A(" + Ainds + ")";
+        timing("P. permute       " + label, repeats, [&]
+               {
+                   C(Cinds) = A(Ainds);
+               });
+        timing("P. strided walk  " + label, repeats, [&]
+               {
+                   reference_permute(Cref, A, Cinds, Ainds);
+               });
+
+        std::vector<double> &Cv = C.data();
+        std::vector<double> &Crefv = Cref.data();
+        for (size_t i = 0; i < Cv.size(); i++)
+        {
+            if (Cv[i] != Crefv[i])
+                throw std::runtime_error("Permutation " + label +
+                                         " does not match the reference.");
+        }
+    }
+}
+
+void test_permute_sum_performance()
+{
+    int repeats = 3;
+    size_t no = 30, nv = 60;
+
+    ambit::print("\nantisymmetrization, no %zu, nv %zu, repeats %d\n", no, nv,
+                 repeats);
+
+    Tensor A = build("A", {no, no, nv, nv});
+    Tensor C = build("C", {no, no, nv, nv});
+    Tensor Cref = build("Cref", {no, no, nv, nv});
+    std::vector<double> &Av = A.data();
+    for (size_t i = 0; i < Av.size(); i++)
+        Av[i] = double(std::rand()) / double(RAND_MAX);
+
+    timing("S. fused      C(ijab) = A(ijab) - A(jiab) - A(ijba) + A(jiba)",
+           repeats, [&]
+           {
+               C("ijab") = A("ijab") - A("jiab") - A("ijba") + A("jiba");
+           });
+    timing("S. term-wise  C(ijab) = A(ijab) - A(jiab) - A(ijba) + A(jiba)",
+           repeats, [&]
+           {
+               Cref("ijab") = A("ijab");
+               Cref("ijab") -= A("jiab");
+               Cref("ijab") -= A("ijba");
+               Cref("ijab") += A("jiba");
+           });
+
+    std::vector<double> &Cv = C.data();
+    std::vector<double> &Crefv = Cref.data();
+    for (size_t i = 0; i < Cv.size(); i++)
+    {
+        if (std::fabs(Cv[i] - Crefv[i]) > 1.0e-12)
+            throw std::runtime_error(
+                "Fused antisymmetrization does not match the reference.");
+    }
+}
+
 int main(int argc, char *argv[])
 {
     srand(time(nullptr));
@@ -166,6 +290,8 @@ int main(int argc, char *argv[])
     }
 
     test_performance();
+    test_permute_performance();
+    test_permute_sum_performance();
 
     ambit::finalize();
     return EXIT_SUCCESS;